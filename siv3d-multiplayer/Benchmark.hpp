@@ -0,0 +1,78 @@
+﻿# pragma once
+# include <Siv3D.hpp>
+
+// イベント経路の処理コストを 1 操作あたりの時間・バイト数・ヒープ確保回数で計測するマイクロベンチマーク
+// MULTIPLAYER_BENCHMARK を定義してビルドすると、Main.cpp の operator new が確保回数を数える
+namespace Benchmark {
+
+  /// @brief これまでのヒープ確保回数（operator new を置き換えていない場合は常に 0）
+  inline std::atomic<uint64> allocation_count{ 0 };
+
+  /// @brief operator new から呼ぶ
+  inline void count_allocation(void) noexcept {
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  /// @brief 1 ケースの計測結果
+  struct Result {
+    String name;
+    uint64 iterations = 0;
+    double ns_per_op = 0.0;
+    double bytes_per_op = 0.0; // 1 操作で生成・処理したペイロードのバイト数
+    double allocs_per_op = 0.0;
+  };
+
+  /// @brief 最適化で操作が消されないように結果を書き込む先
+  inline volatile uint64 sink = 0;
+
+  /// @brief op を min_time 以上かかる回数まで繰り返して計測する
+  /// @param op 1 操作を行い、処理したバイト数を返す関数 size_t()
+  template<class Op>
+  Result measure(const StringView name, Op&& op, const Duration min_time = 0.2s) {
+    // ウォームアップ（初回のみの確保やキャッシュの影響を除く）
+    for (int32 i = 0; i < 16; ++i) sink = sink + op();
+    const uint64 min_ns = static_cast<uint64>(min_time.count() * 1e9);
+    for (uint64 iterations = 16;; iterations *= 2) {
+      uint64 bytes = 0;
+      const uint64 allocs_before = allocation_count.load(std::memory_order_relaxed);
+      const uint64 start_ns = Time::GetNanosec();
+      for (uint64 i = 0; i < iterations; ++i) bytes += op();
+      const uint64 elapsed_ns = Time::GetNanosec() - start_ns;
+      const uint64 allocs = allocation_count.load(std::memory_order_relaxed) - allocs_before;
+      sink = sink + bytes;
+      if (elapsed_ns >= min_ns or iterations >= (uint64{ 1 } << 32)) {
+        return Result{
+          .name = String{ name },
+          .iterations = iterations,
+          .ns_per_op = static_cast<double>(elapsed_ns) / iterations,
+          .bytes_per_op = static_cast<double>(bytes) / iterations,
+          .allocs_per_op = static_cast<double>(allocs) / iterations,
+        };
+      }
+    }
+  }
+
+  /// @brief 結果をコミット間で比較できる JSON にする
+  /// @param label 計測対象の識別子（コミットハッシュなど）
+  inline JSON to_json(const Array<Result>& results, const StringView label) {
+    JSON json;
+    json[U"label"] = String{ label };
+    json[U"counts_allocations"] = (allocation_count.load(std::memory_order_relaxed) > 0);
+    json[U"cases"] = JSON::Parse(U"[]");
+    for (const Result& result : results) {
+      JSON item;
+      item[U"name"] = result.name;
+      item[U"iterations"] = result.iterations;
+      item[U"ns_per_op"] = result.ns_per_op;
+      item[U"bytes_per_op"] = result.bytes_per_op;
+      item[U"allocs_per_op"] = result.allocs_per_op;
+      json[U"cases"].push_back(item);
+    }
+    return json;
+  }
+
+  inline String format(const Result& result) {
+    return U"{:<40} {:>12.1f} ns/op {:>8.1f} B/op {:>8.2f} allocs/op"_fmt(
+      result.name, result.ns_per_op, result.bytes_per_op, result.allocs_per_op);
+  }
+}
@@ -0,0 +1,92 @@
+﻿# pragma once
+# include <Siv3D.hpp>
+
+// 盤面のように値の範囲が小さい要素を、1要素あたり数ビットに詰めて読み書きする
+namespace BitPacking {
+
+  /// @brief 0 ~ max_value を表すのに必要なビット数
+  inline constexpr uint32 bits_for(const uint32 max_value) {
+    return (max_value == 0) ? 1 : static_cast<uint32>(std::bit_width(max_value));
+  }
+
+  /// @brief bits ビットずつの値を count 個詰めたときのバイト数
+  inline constexpr size_t packed_size(const size_t count, const uint32 bits) {
+    return (count * bits + 7) / 8;
+  }
+
+  /// @brief Serializer に下位ビットから順に値を詰めて書き込む
+  /// @remark 最後に flush() を呼ぶと、端数のビットを1バイト単位に切り上げて書き出す
+  class Writer {
+  public:
+    explicit Writer(Serializer<MemoryWriter>& writer) : writer_(writer) {}
+    /// @brief value の下位 bits ビット（1 ~ 32）を書き込む
+    void write(const uint32 value, const uint32 bits) {
+      buffer_ |= static_cast<uint64>(value & mask_(bits)) << used_;
+      used_ += bits;
+      if (used_ >= 32) {
+        const uint32 chunk = static_cast<uint32>(buffer_);
+        writer_->write(&chunk, sizeof(chunk));
+        buffer_ >>= 32;
+        used_ -= 32;
+      }
+    }
+    /// @brief grid の各要素を bits ビットずつ書き込む
+    template<class T>
+    void write_grid(const Grid<T>& grid, const uint32 bits) {
+      for (const T& value : grid) write(static_cast<uint32>(value), bits);
+    }
+    void flush(void) {
+      const uint32 chunk = static_cast<uint32>(buffer_);
+      writer_->write(&chunk, (used_ + 7) / 8);
+      buffer_ = 0;
+      used_ = 0;
+    }
+  private:
+    Serializer<MemoryWriter>& writer_;
+    uint64 buffer_ = 0;
+    uint32 used_ = 0;
+    static constexpr uint32 mask_(const uint32 bits) { return (bits >= 32) ? 0xFFFFFFFFu : ((1u << bits) - 1); }
+  };
+
+  /// @brief Writer で詰めたビット列を読み出す
+  /// @remark 書き込んだ総ビット数を指定し、それより先は読み進めない
+  class Reader {
+  public:
+    Reader(Deserializer<MemoryViewReader>& reader, const size_t bit_count)
+      : reader_(reader), remaining_bytes_((bit_count + 7) / 8) {
+      is_valid_ = (reader_->size() - reader_->getPos()) >= static_cast<int64>(remaining_bytes_);
+    }
+    /// @brief 指定したビット数を読み出せるだけのデータが残っているか
+    bool is_valid(void) const { return is_valid_; }
+    /// @brief bits ビット（1 ~ 32）を読み出す（データが足りなければ 0）
+    uint32 read(const uint32 bits) {
+      while (available_ < bits) {
+        if (remaining_bytes_ == 0) {
+          is_valid_ = false;
+          return 0;
+        }
+        const size_t size = Min<size_t>(remaining_bytes_, 4);
+        uint32 chunk = 0;
+        reader_->read(&chunk, size);
+        buffer_ |= static_cast<uint64>(chunk) << available_;
+        available_ += static_cast<uint32>(size * 8);
+        remaining_bytes_ -= size;
+      }
+      const uint32 value = static_cast<uint32>(buffer_) & ((bits >= 32) ? 0xFFFFFFFFu : ((1u << bits) - 1));
+      buffer_ >>= bits;
+      available_ -= bits;
+      return value;
+    }
+    /// @brief grid の各要素を bits ビットずつ読み出す（grid は読み出す大きさに確保しておく）
+    template<class T>
+    void read_grid(Grid<T>& grid, const uint32 bits) {
+      for (T& value : grid) value = static_cast<T>(read(bits));
+    }
+  private:
+    Deserializer<MemoryViewReader>& reader_;
+    size_t remaining_bytes_;
+    uint64 buffer_ = 0;
+    uint32 available_ = 0;
+    bool is_valid_ = true;
+  };
+}
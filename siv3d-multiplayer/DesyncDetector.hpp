@@ -0,0 +1,104 @@
+﻿# pragma once
+# include <Siv3D.hpp>
+# include "IGame.hpp"
+
+/// @brief 手数ごとの状態ハッシュの履歴を交換し、クライアント間で状態が食い違ったことを検出する
+/// @remark 1手あたりの処理は履歴への追加だけなので、本番でも有効にしたままにできる
+class DesyncDetector {
+public:
+  /// @brief 前回の報告以降の手数ごとのハッシュ（ReservedEventCode::state_hash で送る）
+  struct HashReport {
+    Array<StateHash> history;
+    template<class Archive>
+    void SIV3D_SERIALIZE(Archive& archive) {
+      archive(history);
+    }
+  };
+  /// @brief 検出した不一致
+  struct Desync {
+    LocalPlayerID player_id = 0; // 食い違った相手
+    uint32 move = 0; // 最初に食い違った手数
+    uint64 local_hash = 0;
+    uint64 remote_hash = 0;
+  };
+  /// @param interval 何手ごとに報告を送るか
+  /// @param history_size 保持する手数の数（interval より大きくする）
+  explicit DesyncDetector(const uint32 interval = 8, const size_t history_size = 16)
+    : interval_(Max<uint32>(interval, 1)), history_size_(Max<size_t>(history_size, interval + 1)) {}
+  void set_interval(const uint32 interval) {
+    interval_ = Max<uint32>(interval, 1);
+    history_size_ = Max<size_t>(history_size_, interval_ + 1);
+  }
+  /// @brief 新しいゲームのために履歴と受け取った報告を捨てる
+  void reset(void) {
+    history_.clear();
+    pending_.clear();
+    desynced_.clear();
+    last_reported_moves_ = 0;
+  }
+  /// @brief 現在の状態を記録する
+  /// @return interval 手進んでいれば相手に送る報告
+  Optional<HashReport> record(const StateHash& state);
+  /// @brief 相手の報告を受け取る
+  void receive(const LocalPlayerID player_id, HashReport&& report) {
+    if (desynced_.contains(player_id) or report.history.isEmpty()) return;
+    pending_[player_id] = std::move(report);
+  }
+  /// @brief 自分の履歴が追いついた報告を照合し、見つかった不一致を返す（相手ごとに最初の1回だけ）
+  Array<Desync> check(void);
+  size_t get_desync_count(void) const { return desynced_.size(); }
+private:
+  uint32 interval_;
+  size_t history_size_;
+  Array<StateHash> history_; // 手数の昇順
+  uint32 last_reported_moves_ = 0;
+  HashTable<LocalPlayerID, HashReport> pending_; // 照合待ちの相手の報告
+  HashSet<LocalPlayerID> desynced_; // 不一致を通知済みの相手
+};
+
+inline Optional<DesyncDetector::HashReport> DesyncDetector::record(const StateHash& state) {
+  if (not history_.isEmpty()) {
+    if (state.moves == history_.back().moves) {
+      // スナップショットなどで同じ手数のまま状態が置き換わった
+      history_.back().hash = state.hash;
+      return none;
+    }
+    if (state.moves < history_.back().moves) {
+      // 新しいゲームに切り替わった
+      history_.clear();
+      last_reported_moves_ = 0;
+    }
+  }
+  history_.push_back(state);
+  if (history_.size() > history_size_) history_.pop_front();
+  if (state.moves < last_reported_moves_ + interval_) return none;
+  HashReport report;
+  for (const StateHash& entry : history_) {
+    if (entry.moves > last_reported_moves_) report.history.push_back(entry);
+  }
+  last_reported_moves_ = state.moves;
+  return report;
+}
+
+inline Array<DesyncDetector::Desync> DesyncDetector::check(void) {
+  Array<Desync> desyncs;
+  if (history_.isEmpty()) return desyncs;
+  const uint32 local_moves = history_.back().moves;
+  for (auto it = pending_.begin(); it != pending_.end();) {
+    const auto& [player_id, report] = *it;
+    // 相手の方が先に進んでいれば、自分が追いつくまで待つ
+    if (report.history.back().moves > local_moves) {
+      ++it;
+      continue;
+    }
+    for (const StateHash& remote : report.history) {
+      const auto local = std::find_if(history_.begin(), history_.end(), [&](const StateHash& entry) { return entry.moves == remote.moves; });
+      if (local == history_.end() or local->hash == remote.hash) continue;
+      desyncs.push_back({ player_id, remote.moves, local->hash, remote.hash });
+      desynced_.insert(player_id);
+      break;
+    }
+    it = pending_.erase(it);
+  }
+  return desyncs;
+}
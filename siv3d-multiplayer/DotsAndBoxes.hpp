@@ -2,6 +2,11 @@
 # include <Siv3D.hpp>
 # include "IGame.hpp"
 # include "OnlineManager.hpp"
+# include "Sequencing.hpp"
+# include "Zobrist.hpp"
+# include "BitPacking.hpp"
+# include "PackedGrid.hpp"
+# include "FontCache.hpp"
 
 namespace DotsAndBoxes {
   
@@ -30,49 +35,340 @@ namespace DotsAndBoxes {
     }
   };
 
+  /// @brief 描画やアセットに依存しない盤面とルール（ヘッドレス実行でもそのまま使う）
+  class Board {
+  private:
+    BitPacking::PackedGrid<LineColor> horizontal_lines_; // 水平線（1本2ビット）
+    BitPacking::PackedGrid<LineColor> vertical_lines_; // 垂直線
+    BitPacking::PackedGrid<LineColor> box_owners_; // 各ボックスはどのプレイヤーのものか管理
+    Size grid_size_{ 6,4 }; // 盤面サイズ（セル数）
+    std::array<int32, 3> scores_{}; // 各プレイヤーの得点（LineColor の値で引く）
+    LineColor turn_ = LineColor::Red; // 次に線を引く色
+    Optional<LineColor> winner_ = none; // ゲームの勝者、引き分け時はNone
+    uint32 move_count_ = 0; // 適用した手数
+    uint64 hash_ = 0; // 線・ボックス・手番の Zobrist ハッシュ
+    bool try_complete_box_(const Point& box, LineColor color);
+    bool is_consistent_(uint32 move_count) const;
+    void calc_result_(void);
+    void rehash_(void);
+  public:
+    void initialize(const Size& grid_size);
+    void clear(void);
+    bool is_finished(void) const { return winner_.has_value(); }
+    Optional<LineColor> get_winner(void) const { return winner_; }
+    LineColor get_turn(void) const { return turn_; }
+    const Size& get_grid_size(void) const { return grid_size_; }
+    const BitPacking::PackedGrid<LineColor>& get_horizontal_lines(void) const { return horizontal_lines_; }
+    const BitPacking::PackedGrid<LineColor>& get_vertical_lines(void) const { return vertical_lines_; }
+    const BitPacking::PackedGrid<LineColor>& get_box_owners(void) const { return box_owners_; }
+    int32 get_score(const LineColor color) const { return scores_[static_cast<size_t>(color)]; }
+    /// @brief 引かれた線の数
+    size_t count_drawn_lines(void) const;
+    /// @brief color のプレイヤーが取ったボックスの数（盤面から数える）
+    size_t count_boxes(const LineColor color) const { return box_owners_.count(color); }
+    /// @brief 3辺が引かれたボックス（次の1本で取れるボックス）の一覧
+    /// @remark ボックスの行ごとに4辺の有無を語単位で足し合わせ、32 個ずつ判定する
+    Array<Point> get_three_sided_boxes(void) const;
+    uint32 get_move_count(void) const { return move_count_; }
+    uint64 get_hash(void) const { return hash_; }
+    /// @brief 操作が合法か（盤面内の未使用の線を手番の色で引くか）
+    bool can_operate(const Operation& op) const;
+    /// @brief 操作を適用する（完成したかを調べるのは引いた線に接する1~2個のボックスだけ）
+    /// @return 合法で適用された場合 true
+    bool operate(const Operation& op);
+    /// @brief 操作の陣営（赤が 0, 青が 1, 色のない操作は範囲外）
+    static size_t side_of(const Operation& op) { return static_cast<size_t>(op.line_color) - 1; }
+    /// @brief 手番のプレイヤーの合法手の一覧
+    Array<Operation> get_legal_operations(void) const;
+    /// @brief 線とボックスを1要素2ビットに詰めて書き出す（得点と勝敗はボックスから求め直せるので送らない）
+    void write_packed(Serializer<MemoryWriter>& writer) const;
+    /// @brief write_packed() で書き出した盤面を読み込む
+    /// @return 読み込めた場合 true（盤面が大きすぎる・データが足りない・ありえない盤面の場合は false）
+    bool read_packed(Deserializer<MemoryViewReader>& reader);
+    static constexpr uint32 color_bits = BitPacking::bits_for(static_cast<uint32>(LineColor::Blue));
+    static_assert(color_bits == BitPacking::PackedGrid<LineColor>::bits);
+    static constexpr int32 max_grid_size = 1024; // スナップショットから受け付ける盤面の1辺の最大値
+  };
+
   class Game : public IGame {
   private:
+    // 描画用のフォント（ヘッドレス実行では生成しないよう、最初の描画時にキャッシュから借りる）
+    struct Assets {
+      FontCache::Handle font_ui;
+      FontCache::Handle font_result;
+    };
+    constexpr static int32 ui_font_size = 64;
+    constexpr static int32 result_font_size = 128;
+    static constexpr uint16 snapshot_version = 1; // スナップショットの形式
     OnlineManager* network_ = nullptr;
-    Grid<LineColor> horizontal_lines_; // 水平線
-    Grid<LineColor> vertical_lines_; // 垂直線
-    Grid<LineColor> box_owners_; // 各ボックスはどのプレイヤーのものか管理
-    Size grid_size_{ 6,4 }; // 盤面サイズ（セル数）
+    Sequencing::Reconciler<Board, Operation> moves_; // ホストの確定順にそろえる盤面とルール
+    Size grid_size_{ 6,4 }; // 開始時の盤面サイズ（セル数）
     int32 cell_size_ = 100; // セルの描画サイズ
     int32 dot_radius_ = 8; // ドットの半径
     int32 line_thickness_ = 10; // セル周りの線の太さ
     Point board_offset_; // 描画のオフセット
-    HashTable<LineColor, int32> scores_; // 各プレイヤーの得点
     LineColor player_color_ = LineColor::None; // このプレイヤーの色
+    Array<LocalPlayerID> player_ids_; // [0] が赤, [1] が青のプレイヤー（スナップショットで引き継ぐ）
     bool is_started_ = false;
-    bool is_turn_ = false;
-    bool is_finished_ = false;
-    Optional<LineColor> winner_ = none; // ゲームの勝者、引き分け時はNone
-    Font font_ui_{ FontMethod::MSDF, 64, Typeface::Bold };
-    Font font_result_{ FontMethod::MSDF, 128, Typeface::Bold };
+    mutable std::unique_ptr<Assets> assets_;
+    const Assets& get_assets_(void) const;
+    bool is_turn_(void) const; // 自分のターンであるか
     Point get_dot_pos_(int32 y, int32 x) const;
+    void update_layout_(void);
+    /// @brief カーソルが重なっている未使用の線（カーソル位置から直接求める）
+    Optional<std::pair<Point, LineDirection>> get_hovered_line_(void) const;
     Optional<Operation> get_operation_(void) const;
-    void operate_(const Operation& op);
-    void calc_result_(void);
+    void submit_(const Operation& op);
+    void check_finished_(const bool was_finished);
     ColorF get_line_color_(const LineColor color) const;
     Quad get_grid_line_quad_(const Point& pos, const LineDirection dir) const;
   public:
+    constexpr static StringView game_id = U"DotsAndBoxes";
+    constexpr static uint8 max_players = 2;
+    /// @brief ロビーで選べるルール（"{横のボックス数}x{縦のボックス数}", 先頭が既定）
+    constexpr static std::array<StringView, 4> rules{ U"6x4", U"3x3", U"10x10", U"100x100" };
     Game() {};
-    void set_network(OnlineManager* network) override {network_ = network;}
-    String get_game_id(void) const override {return U"DotsAndBoxes";}
-    uint8 get_max_players(void) const override {return 2;}
+    /// @brief 描画用のフォントを非同期に読み込み始める（ロビーにいる間に呼ぶ）
+    static void preload_assets(void) {
+      FontCache::shared().preload(FontMethod::MSDF, ui_font_size, Typeface::Bold, U"RedBlue: 0123456789Your Turn Opponent's");
+      FontCache::shared().preload(FontMethod::MSDF, result_font_size, Typeface::Bold, U"DrawYouWinLose.");
+    }
+    void set_network(OnlineManager* network) override {network_ = network; moves_.set_network(network);}
+    String get_game_id(void) const override {return String{ game_id };}
+    uint8 get_max_players(void) const override {return max_players;}
     bool is_started(void) const override {return is_started_;}
-    bool is_finished(void) const override {return is_finished_;}
+    bool is_finished(void) const override {return moves_.get_confirmed().is_finished();}
+    StateHash get_state_hash(void) const override {
+      return { moves_.get_confirmed().get_move_count(), moves_.get_confirmed().get_hash() };
+    }
     void update(void) override;
-    void draw(void) const override;
+    void tick([[maybe_unused]] double dt) override {}
+    void draw(double alpha) const override;
     void debug(void) override {}
     void on_game_start(const Array<LocalPlayer>& players, bool is_host) override;
     void on_player_left(LocalPlayerID player_id) override;
     void on_leave_room(void) override;
+    void on_host_changed(bool is_host) override;
+    void write_snapshot(Serializer<MemoryWriter>& writer) const override;
+    bool read_snapshot(Deserializer<MemoryViewReader>& reader) override;
     void on_event_received(LocalPlayerID player_id, uint8 event_code, Deserializer<MemoryViewReader>& reader) override;
+    bool is_turn(void) const override { return is_turn_(); }
+    bool play_random_move(void) override;
+    /// @brief 自分の手番であれば op を打つ（思考ルーチンなどで選んだ手を打つボット用）
+    /// @return 手を打った場合 true
+    bool play_operation(const Operation& op);
+    /// @brief 次のゲームの盤面サイズを設定する（全員で同じ値にし、ゲーム開始前に呼ぶ）
+    void set_grid_size(const Size& grid_size) {
+      grid_size_ = Size{ Clamp(grid_size.x, 1, Board::max_grid_size), Clamp(grid_size.y, 1, Board::max_grid_size) };
+    }
+    String get_rule(void) const override { return U"{}x{}"_fmt(grid_size_.x, grid_size_.y); }
+    bool set_rule(StringView rule) override;
     void initialize(const Size& grid_size, const LineColor player_color);
     void reset(void);
+    const Board& get_board(void) const { return moves_.get_predicted(); }
   };
 
+  inline bool Game::set_rule(const StringView rule) {
+    const size_t x = rule.indexOf(U'x');
+    if (x == StringView::npos) return false;
+    const Optional<int32> width = ParseOpt<int32>(rule.substr(0, x));
+    const Optional<int32> height = ParseOpt<int32>(rule.substr(x + 1));
+    if (not width or not height or *width < 1 or *height < 1) return false;
+    if (*width > Board::max_grid_size or *height > Board::max_grid_size) return false;
+    set_grid_size(Size{ *width, *height });
+    return true;
+  }
+  inline void Board::initialize(const Size& grid_size) {
+    grid_size_ = grid_size;
+    horizontal_lines_.assign(grid_size_.x, grid_size_.y + 1, LineColor::None);
+    vertical_lines_.assign(grid_size_.x + 1, grid_size_.y, LineColor::None);
+    box_owners_.assign(grid_size_, LineColor::None);
+    scores_.fill(0);
+    turn_ = LineColor::Red;
+    winner_ = none;
+    move_count_ = 0;
+    rehash_();
+  }
+  inline void Board::clear(void) {
+    horizontal_lines_.clear();
+    vertical_lines_.clear();
+    box_owners_.clear();
+    scores_.fill(0);
+    turn_ = LineColor::Red;
+    winner_ = none;
+    move_count_ = 0;
+    rehash_();
+  }
+  inline bool Board::can_operate(const Operation& op) const {
+    if (is_finished() or op.line_color != turn_) return false;
+    const BitPacking::PackedGrid<LineColor>& lines = (op.dir == LineDirection::Top) ? horizontal_lines_ : vertical_lines_;
+    return lines.inBounds(op.pos) and (lines[op.pos] == LineColor::None);
+  }
+  inline bool Board::operate(const Operation& op) {
+    if (not can_operate(op)) return false;
+    bool box_completed_ = false;
+    // 線が接するのは上下（水平線）または左右（垂直線）のボックスだけ
+    if (op.dir == LineDirection::Top) {
+      horizontal_lines_.set(op.pos, op.line_color);
+      hash_ ^= Zobrist::key(0, op.pos.y * horizontal_lines_.width() + op.pos.x, static_cast<uint32>(op.line_color));
+      box_completed_ |= try_complete_box_(op.pos.movedBy(0, -1), op.line_color);
+      box_completed_ |= try_complete_box_(op.pos, op.line_color);
+    } else {
+      vertical_lines_.set(op.pos, op.line_color);
+      hash_ ^= Zobrist::key(1, op.pos.y * vertical_lines_.width() + op.pos.x, static_cast<uint32>(op.line_color));
+      box_completed_ |= try_complete_box_(op.pos.movedBy(-1, 0), op.line_color);
+      box_completed_ |= try_complete_box_(op.pos, op.line_color);
+    }
+    // ボックスを完成させたプレイヤーはもう一度引ける
+    if (not box_completed_) {
+      const LineColor next_turn = (turn_ == LineColor::Red) ? LineColor::Blue : LineColor::Red;
+      hash_ ^= Zobrist::key(3, 0, static_cast<uint32>(turn_)) ^ Zobrist::key(3, 0, static_cast<uint32>(next_turn));
+      turn_ = next_turn;
+    }
+    ++move_count_;
+    calc_result_();
+    return true;
+  }
+  inline bool Board::try_complete_box_(const Point& box, const LineColor color) {
+    if (not box_owners_.inBounds(box) or box_owners_[box] != LineColor::None) return false;
+    if (horizontal_lines_[box] == LineColor::None or horizontal_lines_[box.movedBy(0, 1)] == LineColor::None
+     or vertical_lines_[box] == LineColor::None or vertical_lines_[box.movedBy(1, 0)] == LineColor::None) return false;
+    box_owners_.set(box, color);
+    hash_ ^= Zobrist::key(2, box.y * box_owners_.width() + box.x, static_cast<uint32>(color));
+    ++scores_[static_cast<size_t>(color)];
+    return true;
+  }
+  inline void Board::rehash_(void) {
+    hash_ = Zobrist::key(3, 0, static_cast<uint32>(turn_));
+    const auto add_grid = [&](const uint32 table, const BitPacking::PackedGrid<LineColor>& grid) {
+      for (size_t y = 0; y < grid.height(); ++y) {
+        for (size_t x = 0; x < grid.width(); ++x) hash_ ^= Zobrist::key(table, y * grid.width() + x, static_cast<uint32>(grid.at(y, x)));
+      }
+    };
+    add_grid(0, horizontal_lines_);
+    add_grid(1, vertical_lines_);
+    add_grid(2, box_owners_);
+  }
+  inline void Board::calc_result_(void) {
+    const int32 red = get_score(LineColor::Red);
+    const int32 blue = get_score(LineColor::Blue);
+    if ((red + blue) == (grid_size_.area())) {
+      if (red > blue) {
+        winner_ = LineColor::Red;
+      } else if (red < blue) {
+        winner_ = LineColor::Blue;
+      } else {
+        winner_ = LineColor::None;
+      }
+    }
+  }
+  inline void Board::write_packed(Serializer<MemoryWriter>& writer) const {
+    writer(static_cast<uint16>(grid_size_.x), static_cast<uint16>(grid_size_.y), move_count_);
+    BitPacking::Writer bits{ writer };
+    bits.write(static_cast<uint32>(turn_), color_bits);
+    horizontal_lines_.write(bits);
+    vertical_lines_.write(bits);
+    box_owners_.write(bits);
+    bits.flush();
+  }
+  inline bool Board::read_packed(Deserializer<MemoryViewReader>& reader) {
+    uint16 width = 0, height = 0;
+    uint32 move_count = 0;
+    reader(width, height, move_count);
+    if (width > max_grid_size or height > max_grid_size) return false;
+    const size_t lines = size_t{ width } * (height + 1) + (size_t{ width } + 1) * height;
+    BitPacking::Reader bits{ reader, color_bits * (1 + lines + size_t{ width } * height) };
+    if (not bits.is_valid()) return false;
+    // 途中で失敗しても今の盤面を壊さないよう、別の盤面に読み込んで確かめてから置き換える
+    Board board;
+    board.initialize(Size{ width, height });
+    board.turn_ = static_cast<LineColor>(bits.read(color_bits));
+    if (board.turn_ != LineColor::Red and board.turn_ != LineColor::Blue) return false;
+    board.horizontal_lines_.read(bits);
+    board.vertical_lines_.read(bits);
+    board.box_owners_.read(bits);
+    if (not bits.is_valid() or not board.is_consistent_(move_count)) return false;
+    board.scores_[static_cast<size_t>(LineColor::Red)] = static_cast<int32>(board.count_boxes(LineColor::Red));
+    board.scores_[static_cast<size_t>(LineColor::Blue)] = static_cast<int32>(board.count_boxes(LineColor::Blue));
+    board.move_count_ = move_count;
+    board.calc_result_();
+    // ハッシュは受け取った値を信用せず盤面から計算し直す
+    board.rehash_();
+    *this = std::move(board);
+    return true;
+  }
+  inline bool Board::is_consistent_(const uint32 move_count) const {
+    // 2ビットで表せても LineColor ではない値（3）は受け付けない
+    constexpr LineColor invalid = static_cast<LineColor>(3);
+    if (horizontal_lines_.count(invalid) > 0 or vertical_lines_.count(invalid) > 0 or box_owners_.count(invalid) > 0) return false;
+    // 1手で引く線はちょうど1本
+    if (move_count != count_drawn_lines()) return false;
+    // ボックスは4辺が引かれたときに、そのときだけ取られる
+    for (int32 y = 0; y < grid_size_.y; ++y) {
+      for (int32 x = 0; x < grid_size_.x; ++x) {
+        const Point box{ x, y };
+        const bool is_closed = horizontal_lines_[box] != LineColor::None and horizontal_lines_[box.movedBy(0, 1)] != LineColor::None
+          and vertical_lines_[box] != LineColor::None and vertical_lines_[box.movedBy(1, 0)] != LineColor::None;
+        if (is_closed != (box_owners_[box] != LineColor::None)) return false;
+      }
+    }
+    return true;
+  }
+  inline size_t Board::count_drawn_lines(void) const {
+    return (horizontal_lines_.size_elements() - horizontal_lines_.count(LineColor::None))
+      + (vertical_lines_.size_elements() - vertical_lines_.count(LineColor::None));
+  }
+  inline Array<Point> Board::get_three_sided_boxes(void) const {
+    using Packed = BitPacking::PackedGrid<LineColor>;
+    Array<Point> boxes;
+    for (size_t y = 0; y < box_owners_.height(); ++y) {
+      for (size_t i = 0; i < box_owners_.words_per_row(); ++i) {
+        // ボックス x の上・下・左・右の辺の有無を、それぞれ要素 x の下位ビットにそろえる
+        const uint64 top = Packed::nonzero_mask(horizontal_lines_.word(y, i));
+        const uint64 bottom = Packed::nonzero_mask(horizontal_lines_.word(y + 1, i));
+        const uint64 left = Packed::nonzero_mask(vertical_lines_.word(y, i));
+        const uint64 right = (left >> Packed::bits) | (Packed::nonzero_mask(vertical_lines_.word(y, i + 1)) << (64 - Packed::bits));
+        // 4辺の有無を足し合わせ、ちょうど3になる要素を取り出す
+        const uint64 sum0 = top ^ bottom, carry0 = top & bottom;
+        const uint64 sum1 = left ^ right, carry1 = left & right;
+        uint64 three = (sum0 ^ sum1) & (carry0 ^ carry1 ^ (sum0 & sum1)) & box_owners_.valid_mask(i);
+        for (; three != 0; three &= three - 1) {
+          const size_t x = i * Packed::values_per_word + std::countr_zero(three) / Packed::bits;
+          boxes.emplace_back(static_cast<int32>(x), static_cast<int32>(y));
+        }
+      }
+    }
+    return boxes;
+  }
+  inline Array<Operation> Board::get_legal_operations(void) const {
+    Array<Operation> operations;
+    if (is_finished() or horizontal_lines_.isEmpty()) return operations;
+    for (int32 y : step(grid_size_.y + 1)) {
+      for (int32 x : step(grid_size_.x)) {
+        if (horizontal_lines_.at(y, x) == LineColor::None) operations.emplace_back(Point{ x,y }, LineDirection::Top, turn_);
+      }
+    }
+    for (int32 y : step(grid_size_.y)) {
+      for (int32 x : step(grid_size_.x + 1)) {
+        if (vertical_lines_.at(y, x) == LineColor::None) operations.emplace_back(Point{ x,y }, LineDirection::Left, turn_);
+      }
+    }
+    return operations;
+  }
+
+  inline const Game::Assets& Game::get_assets_(void) const {
+    if (not assets_) {
+      assets_.reset(new Assets{
+        FontCache::shared().get(FontMethod::MSDF, ui_font_size, Typeface::Bold),
+        FontCache::shared().get(FontMethod::MSDF, result_font_size, Typeface::Bold),
+      });
+    }
+    return *assets_;
+  }
+  inline bool Game::is_turn_(void) const {
+    const Board& board = moves_.get_predicted();
+    return is_started_ and not board.is_finished() and (board.get_turn() == player_color_);
+  }
   inline Point Game::get_dot_pos_(const int32 y, const int32 x) const {
     return Point{ x * cell_size_, y * cell_size_ } + board_offset_;
   }
@@ -91,170 +387,199 @@ namespace DotsAndBoxes {
 
   inline void Game::initialize(const Size& grid_size, const LineColor player_color) {
     grid_size_ = grid_size;
-    horizontal_lines_.assign(grid_size_.x, grid_size_.y + 1, LineColor::None);
-    vertical_lines_.assign(grid_size_.x + 1, grid_size_.y, LineColor::None);
-    box_owners_.assign(grid_size_, LineColor::None);
-    scores_[LineColor::Red] = 0;
-    scores_[LineColor::Blue] = 0;
+    Board board;
+    board.initialize(grid_size_);
+    moves_.reset(board);
     player_color_ = player_color;
-    is_turn_ = (player_color == LineColor::Red);
     is_started_ = true;
-    is_finished_ = false;
-    winner_ = none;
-    cell_size_ = (Scene::Size() / grid_size_).minComponent() * 0.65;
-    const int32 board_width = grid_size_.x * cell_size_;
-    const int32 board_height = grid_size_.y * cell_size_;
+    update_layout_();
+  }
+  inline void Game::update_layout_(void) {
+    const Size& grid_size = moves_.get_confirmed().get_grid_size();
+    if (grid_size.x == 0 or grid_size.y == 0) return;
+    cell_size_ = Max(static_cast<int32>((Scene::Size() / grid_size).minComponent() * 0.65), 2);
+    // 大きな盤面ではドットと線をセルに合わせて細くする
+    dot_radius_ = Clamp(cell_size_ / 10, 1, 8);
+    line_thickness_ = Clamp(cell_size_ / 8, 1, 10);
+    const int32 board_width = grid_size.x * cell_size_;
+    const int32 board_height = grid_size.y * cell_size_;
     board_offset_ = Scene::Center() - Point{ board_width / 2, board_height / 2 };
   }
   inline void Game::reset(void) {
-    horizontal_lines_.clear();
-    vertical_lines_.clear();
-    box_owners_.clear();
-    scores_.clear();
+    moves_.reset(Board{});
     player_color_ = LineColor::None;
+    player_ids_.clear();
     is_started_ = false;
-    is_turn_ = false;
-    is_finished_ = false;
-    winner_ = none;
   }
 
   inline void Game::on_game_start(const Array<LocalPlayer>& players, bool is_host) {
     initialize(grid_size_, is_host ? LineColor::Red : LineColor::Blue);
+    // 開始時のホストが赤
+    player_ids_.clear();
+    for (const LocalPlayer& player : players) {
+      if (player.isHost) player_ids_.push_front(player.localID);
+      else player_ids_.push_back(player.localID);
+    }
+    moves_.set_authors(player_ids_);
     if (is_host and network_) network_->set_room_visible(false);
   }
+  inline void Game::on_host_changed(const bool is_host) {
+    if (not is_started_) return;
+    moves_.on_host_changed(is_host);
+    if (not is_host or not network_) return;
+    // ルームの管理を引き継ぐ（対戦中は再参加できるよう開けたまま隠す）
+    network_->set_room_visible(false);
+    network_->set_room_open(not moves_.get_confirmed().is_finished());
+  }
+  inline void Game::write_snapshot(Serializer<MemoryWriter>& writer) const {
+    writer(snapshot_version);
+    moves_.write(writer);
+    writer(player_ids_);
+  }
+  inline bool Game::read_snapshot(Deserializer<MemoryViewReader>& reader) {
+    uint16 version = 0;
+    reader(version);
+    if (version != snapshot_version or not moves_.read(reader)) return false;
+    reader(player_ids_);
+    moves_.set_authors(player_ids_);
+    const LocalPlayerID self_id = network_ ? network_->get_local_player_id() : -1;
+    if (player_ids_.size() >= 2 and player_ids_[0] == self_id) player_color_ = LineColor::Red;
+    else if (player_ids_.size() >= 2 and player_ids_[1] == self_id) player_color_ = LineColor::Blue;
+    is_started_ = not moves_.get_confirmed().get_horizontal_lines().isEmpty();
+    update_layout_();
+    return true;
+  }
   inline void Game::on_player_left(LocalPlayerID player_id) {
-    if (is_finished_) return;
+    if (moves_.get_confirmed().is_finished()) return;
     reset();
   }
   inline void Game::on_leave_room(void) {
     reset();
   }
   inline void Game::on_event_received(LocalPlayerID player_id, uint8 event_code, Deserializer<MemoryViewReader>& reader) {
-    if (event_code == Operation::code) {
-      Operation op;
-      reader(op);
-      operate_(op);
-    }
+    if (not is_started_) return;
+    const bool was_finished = moves_.get_confirmed().is_finished();
+    if (moves_.on_event_received(player_id, event_code, reader)) check_finished_(was_finished);
   }
 
-  inline Optional<Operation> Game::get_operation_(void) const {
-    if (not (is_started_ and is_turn_ and not is_finished_)) return none;
-    for (int32 y : step(grid_size_.y+1)) {
-      for (int32 x : step(grid_size_.x)) {
-        if (horizontal_lines_.at(y,x) == LineColor::None) {
-          const Quad line_quad = get_grid_line_quad_({ x,y }, LineDirection::Top);
-          if (line_quad.mouseOver()) Cursor::RequestStyle(CursorStyle::Hand);
-          if (line_quad.leftClicked()) return Operation{ Point{x,y}, LineDirection::Top, player_color_ };
-        }
-      }
-    }
-    for (int32 y : step(grid_size_.y)) {
-      for (int32 x : step(grid_size_.x+1)) {
-        if (vertical_lines_.at(y, x) == LineColor::None) {
-          const Quad line_quad = get_grid_line_quad_({ x,y }, LineDirection::Left);
-          if (line_quad.mouseOver()) Cursor::RequestStyle(CursorStyle::Hand);
-          if (line_quad.leftClicked()) return Operation{ Point{x,y}, LineDirection::Left, player_color_ };
-        }
-      }
-    }
-    return none;
-  }
-  inline void Game::operate_(const Operation& op) {
-    if (not is_started_ or is_finished_) return;
-    bool box_completed_ = false;
-    if (op.dir == LineDirection::Top) {
-      if (not horizontal_lines_.inBounds(op.pos)) return;
-      if (horizontal_lines_.at(op.pos) != LineColor::None) return;
-      horizontal_lines_.at(op.pos) = op.line_color;
+  inline Optional<std::pair<Point, LineDirection>> Game::get_hovered_line_(void) const {
+    const Board& board = moves_.get_predicted();
+    if (board.get_horizontal_lines().isEmpty()) return none;
+    const Point local = Cursor::Pos() - board_offset_;
+    // 最も近いドットからの縦横のずれで、重なっている線を1本に絞る
+    const Point dot = Math::Round(Vec2{ local } / cell_size_).asPoint();
+    const Point from_dot = local - dot * cell_size_;
+    const int32 half_thickness = line_thickness_ / 2;
+    Point pos;
+    LineDirection dir;
+    if (Abs(from_dot.y) <= half_thickness and from_dot.x != 0) {
+      pos = (from_dot.x > 0) ? dot : dot.movedBy(-1, 0);
+      dir = LineDirection::Top;
+    } else if (Abs(from_dot.x) <= half_thickness and from_dot.y != 0) {
+      pos = (from_dot.y > 0) ? dot : dot.movedBy(0, -1);
+      dir = LineDirection::Left;
     } else {
-      if (not vertical_lines_.inBounds(op.pos)) return;
-      if (vertical_lines_.at(op.pos) != LineColor::None) return;
-      vertical_lines_.at(op.pos) = op.line_color;
+      return none;
     }
-    for (size_t y : step(grid_size_.y)) {
-      for (size_t x : step(grid_size_.x)) {
-        if (box_owners_.at(y, x) == LineColor::None) {
-          if (horizontal_lines_.at(y, x) != LineColor::None and horizontal_lines_.at(y + 1, x) != LineColor::None
-           and vertical_lines_.at(y, x) != LineColor::None and vertical_lines_.at(y, x + 1) != LineColor::None) {
-            box_owners_.at(y, x) = op.line_color;
-            scores_[op.line_color]++;
-            box_completed_ = true;
-          }
-        }
-      }
-    }
-    if (not box_completed_) is_turn_ = not is_turn_;
-    calc_result_();
+    const BitPacking::PackedGrid<LineColor>& lines = (dir == LineDirection::Top) ? board.get_horizontal_lines() : board.get_vertical_lines();
+    if (not lines.inBounds(pos) or lines[pos] != LineColor::None) return none;
+    return std::pair{ pos, dir };
   }
-  inline void Game::calc_result_(void) {
-    if ((scores_.at(LineColor::Red) + scores_.at(LineColor::Blue)) == (grid_size_.area())) {
-      is_finished_ = true;
-      if (scores_.at(LineColor::Red) > scores_.at(LineColor::Blue)) {
-        winner_ = LineColor::Red;
-      } else if (scores_.at(LineColor::Red) < scores_.at(LineColor::Blue)) {
-        winner_ = LineColor::Blue;
-      } else {
-        winner_ = LineColor::None;
-      }
-      if (network_ and network_->isHost()) {
+  inline Optional<Operation> Game::get_operation_(void) const {
+    if (not is_turn_()) return none;
+    const Optional<std::pair<Point, LineDirection>> hovered = get_hovered_line_();
+    if (not hovered) return none;
+    Cursor::RequestStyle(CursorStyle::Hand);
+    if (not MouseL.down()) return none;
+    return Operation{ hovered->first, hovered->second, player_color_ };
+  }
+  inline void Game::check_finished_(const bool was_finished) {
+    // 確定した盤面が終了状態に切り替わった瞬間、ホストだけがルームを閉じる
+    if (moves_.get_confirmed().is_finished() and not was_finished) {
+      if (network_ and network_->is_host()) {
         network_->set_room_open(false);
         network_->set_room_visible(false);
       }
     }
   }
 
+  inline void Game::submit_(const Operation& op) {
+    if (not is_started_) return;
+    // 自分の操作はすぐ盤面に反映し、ホストの確定順で後から整合させる
+    const bool was_finished = moves_.get_confirmed().is_finished();
+    moves_.submit(op);
+    check_finished_(was_finished);
+  }
   inline void Game::update(void) {
     if (Optional<Operation> op = get_operation_()) {
-      if (network_) network_->send_game_event(Operation::code, *op);
-      operate_(*op);
+      submit_(*op);
     }
   }
-  inline void Game::draw(void) const {
+  inline bool Game::play_random_move(void) {
+    if (not is_turn_()) return false;
+    const Array<Operation> operations = moves_.get_predicted().get_legal_operations();
+    if (operations.isEmpty()) return false;
+    submit_(operations.choice());
+    return true;
+  }
+  inline bool Game::play_operation(const Operation& op) {
+    if (not is_turn_() or not moves_.get_predicted().can_operate(op)) return false;
+    submit_(op);
+    return true;
+  }
+  inline void Game::draw([[maybe_unused]] const double alpha) const {
     if (not is_started_) return;
-    for (int32 y : step(grid_size_.y)) {
-      for (int32 x : step(grid_size_.x)) {
-        if (box_owners_.at(y, x) != LineColor::None) {
-          const ColorF color = (box_owners_[y][x] == LineColor::Red) ? ColorF{ 1.0, 0.5, 0.5, 0.5 } : ColorF{ 0.5, 0.5, 1.0, 0.5 };
+    const Assets& assets = get_assets_();
+    const Board& board = moves_.get_predicted();
+    const Size& grid_size = board.get_grid_size();
+    const BitPacking::PackedGrid<LineColor>& horizontal_lines = board.get_horizontal_lines();
+    const BitPacking::PackedGrid<LineColor>& vertical_lines = board.get_vertical_lines();
+    const BitPacking::PackedGrid<LineColor>& box_owners = board.get_box_owners();
+    const Optional<std::pair<Point, LineDirection>> hovered = get_hovered_line_();
+    for (int32 y : step(grid_size.y)) {
+      for (int32 x : step(grid_size.x)) {
+        if (box_owners.at(y, x) != LineColor::None) {
+          const ColorF color = (box_owners.at(y, x) == LineColor::Red) ? ColorF{ 1.0, 0.5, 0.5, 0.5 } : ColorF{ 0.5, 0.5, 1.0, 0.5 };
           Rect{ get_dot_pos_(y, x), cell_size_ }.draw(color);
         }
       }
     }
-    for (int32 y : step(grid_size_.y + 1)) {
-      for (int32 x : step(grid_size_.x)) {
-        const LineColor color_type = horizontal_lines_.at(y, x);
+    for (int32 y : step(grid_size.y + 1)) {
+      for (int32 x : step(grid_size.x)) {
+        const LineColor color_type = horizontal_lines.at(y, x);
         const ColorF line_color = get_line_color_(color_type);
         const Quad line_quad = get_grid_line_quad_({ x,y }, LineDirection::Top);
-        if (line_quad.mouseOver() and color_type == LineColor::None) line_quad.draw(line_color.gamma(0.5));
+        if (hovered == std::pair{ Point{ x,y }, LineDirection::Top }) line_quad.draw(line_color.gamma(0.5));
         else line_quad.draw(line_color.gamma(0.8));
       }
     }
-    for (int32 y : step(grid_size_.y)) {
-      for (int32 x : step(grid_size_.x + 1)) {
-        const LineColor color_type = vertical_lines_.at(y, x);
+    for (int32 y : step(grid_size.y)) {
+      for (int32 x : step(grid_size.x + 1)) {
+        const LineColor color_type = vertical_lines.at(y, x);
         const ColorF line_color = get_line_color_(color_type);
         const Quad line_quad = get_grid_line_quad_({ x,y }, LineDirection::Left);
-        if (line_quad.mouseOver() and color_type == LineColor::None) line_quad.draw(line_color.gamma(0.5));
+        if (hovered == std::pair{ Point{ x,y }, LineDirection::Left }) line_quad.draw(line_color.gamma(0.5));
         else line_quad.draw(line_color.gamma(0.8));
       }
     }
-    for (int32 y : step(grid_size_.y + 1)) {
-      for (int32 x : step(grid_size_.x + 1)) {
+    for (int32 y : step(grid_size.y + 1)) {
+      for (int32 x : step(grid_size.x + 1)) {
         Circle{ get_dot_pos_(y,x), dot_radius_ }.draw(Palette::Gray);
       }
     }
-    font_ui_(U"Red: {}"_fmt(scores_.at(LineColor::Red))).draw(Arg::topRight(Scene::CenterF().movedBy(-20,0).withY(0)), Palette::Red);
-    font_ui_(U"Blue: {}"_fmt(scores_.at(LineColor::Blue))).draw(Arg::topLeft(Scene::CenterF().movedBy(20,0).withY(0)), Palette::Blue);
-    if (not is_finished_) {
-      const String turn_text = is_turn_ ? U"Your Turn" : U"Opponent's Turn";
-      const ColorF turn_color = is_turn_ ? (player_color_ == LineColor::Red ? Palette::Red : Palette::Blue) : Palette::Dimgray;
-      font_ui_(turn_text).draw(Arg::bottomCenter(Scene::CenterF().withY(Scene::Size().y)), turn_color);
+    assets.font_ui(U"Red: {}"_fmt(board.get_score(LineColor::Red))).draw(Arg::topRight(Scene::CenterF().movedBy(-20,0).withY(0)), Palette::Red);
+    assets.font_ui(U"Blue: {}"_fmt(board.get_score(LineColor::Blue))).draw(Arg::topLeft(Scene::CenterF().movedBy(20,0).withY(0)), Palette::Blue);
+    if (not board.is_finished()) {
+      const String turn_text = is_turn_() ? U"Your Turn" : U"Opponent's Turn";
+      const ColorF turn_color = is_turn_() ? (player_color_ == LineColor::Red ? Palette::Red : Palette::Blue) : Palette::Dimgray;
+      assets.font_ui(turn_text).draw(Arg::bottomCenter(Scene::CenterF().withY(Scene::Size().y)), turn_color);
     } else {
       const RectF screen_rect = Scene::Rect();
       screen_rect.draw(ColorF{ 0.0, 0.5 });
-      if (winner_) {
-        if (*winner_ == LineColor::None) font_result_(U"Draw").drawAt(screen_rect.center());
-        else if (*winner_ == player_color_) font_result_(U"You Win!").drawAt(screen_rect.center());
-        else  font_result_(U"You Lose...").drawAt(screen_rect.center());
+      if (const Optional<LineColor> winner = board.get_winner()) {
+        if (*winner == LineColor::None) assets.font_result(U"Draw").drawAt(screen_rect.center());
+        else if (*winner == player_color_) assets.font_result(U"You Win!").drawAt(screen_rect.center());
+        else  assets.font_result(U"You Lose...").drawAt(screen_rect.center());
       }
     }
   }
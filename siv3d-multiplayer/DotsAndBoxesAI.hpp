@@ -0,0 +1,487 @@
+﻿# pragma once
+# include <Siv3D.hpp>
+# include <thread>
+# include <mutex>
+# include "IGame.hpp"
+# include "Headless.hpp"
+# include "Zobrist.hpp"
+# include "DotsAndBoxes.hpp"
+
+// ドット＆ボックスの思考ルーチン
+// 線の有無を 64 ビットに詰めた盤面で反復深化アルファベータ探索を行い、読みの末端はチェーンとループへの分解と長鎖規則で評価する
+namespace DotsAndBoxes::AI {
+
+  struct Settings {
+    Duration think_time = 0.5s; // 1手あたりの思考時間
+    uint32 max_depth = 64; // 読む手数の上限
+    size_t threads = Max<size_t>(std::thread::hardware_concurrency(), 1); // 根の手を分担するスレッド数
+    uint32 table_bits = 20; // 置換表のエントリ数（2 のべき乗の指数）
+  };
+
+  struct Stats {
+    uint64 nodes = 0; // 直近の思考で訪れた局面数
+    uint32 depth = 0; // 読み終えた手数
+    int32 value = 0; // 手番のプレイヤーが残りで得るボックスの差の見込み
+    bool is_solved = false; // 終局まで読み切ったか
+    Duration elapsed{ 0 };
+    double nodes_per_sec(void) const { return (elapsed.count() > 0) ? (nodes / elapsed.count()) : 0.0; }
+  };
+
+  /// @brief 線とボックスの対応（線は水平線 y * w + x, 垂直線 w * (h + 1) + y * (w + 1) + x の順に番号を振る）
+  struct Layout {
+    static constexpr uint32 max_lines = 64;
+    Size grid_size{ 0, 0 };
+    uint32 line_count = 0;
+    uint32 box_count = 0;
+    uint64 all_lines = 0;
+    Array<std::array<int32, 2>> line_boxes; // 線に接するボックス（盤外は -1）
+    Array<uint64> box_lines; // ボックスを囲む4本の線
+    /// @brief 線が 64 本に収まる盤面か
+    static bool fits(const Size& size) {
+      return (size.x > 0) and (size.y > 0) and (size.x * (size.y + 1) + (size.x + 1) * size.y <= static_cast<int32>(max_lines));
+    }
+    explicit Layout(const Size& size);
+    uint64 to_lines(const Board& board) const;
+    Operation to_operation(uint32 line, LineColor color) const;
+  };
+
+  inline Layout::Layout(const Size& size)
+    : grid_size(size), box_count(size.x * size.y) {
+    const uint32 horizontal = size.x * (size.y + 1);
+    line_count = horizontal + (size.x + 1) * size.y;
+    all_lines = (line_count >= 64) ? ~uint64{ 0 } : ((uint64{ 1 } << line_count) - 1);
+    line_boxes.assign(line_count, { -1, -1 });
+    box_lines.assign(box_count, 0);
+    for (int32 y = 0; y < size.y; ++y) {
+      for (int32 x = 0; x < size.x; ++x) {
+        const int32 box = y * size.x + x;
+        const uint32 top = y * size.x + x, bottom = (y + 1) * size.x + x;
+        const uint32 left = horizontal + y * (size.x + 1) + x, right = left + 1;
+        box_lines[box] = (uint64{ 1 } << top) | (uint64{ 1 } << bottom) | (uint64{ 1 } << left) | (uint64{ 1 } << right);
+        line_boxes[top][1] = box;
+        line_boxes[bottom][0] = box;
+        line_boxes[left][1] = box;
+        line_boxes[right][0] = box;
+      }
+    }
+  }
+
+  inline uint64 Layout::to_lines(const Board& board) const {
+    uint64 lines = 0;
+    const auto& horizontal_lines = board.get_horizontal_lines();
+    const auto& vertical_lines = board.get_vertical_lines();
+    for (int32 y = 0; y <= grid_size.y; ++y) {
+      for (int32 x = 0; x < grid_size.x; ++x) {
+        if (horizontal_lines.at(y, x) != LineColor::None) lines |= uint64{ 1 } << (y * grid_size.x + x);
+      }
+    }
+    const uint32 horizontal = grid_size.x * (grid_size.y + 1);
+    for (int32 y = 0; y < grid_size.y; ++y) {
+      for (int32 x = 0; x <= grid_size.x; ++x) {
+        if (vertical_lines.at(y, x) != LineColor::None) lines |= uint64{ 1 } << (horizontal + y * (grid_size.x + 1) + x);
+      }
+    }
+    return lines;
+  }
+
+  inline Operation Layout::to_operation(const uint32 line, const LineColor color) const {
+    const uint32 horizontal = grid_size.x * (grid_size.y + 1);
+    if (line < horizontal) return Operation{ Point(line % grid_size.x, line / grid_size.x), LineDirection::Top, color };
+    const uint32 index = line - horizontal;
+    return Operation{ Point(index % (grid_size.x + 1), index / (grid_size.x + 1)), LineDirection::Left, color };
+  }
+
+  /// @brief 全スレッドで共有する置換表
+  /// @remark エントリは鍵とデータの XOR を別々の atomic に書く（ロックなしで、書き込みが混ざったエントリは鍵が一致せず捨てられる）
+  class TranspositionTable {
+  public:
+    enum class Bound : uint8 { None, Exact, Lower, Upper };
+    struct Record {
+      int32 value = 0; // 手番のプレイヤーが残りで得るボックスの差
+      uint32 depth = 0;
+      Bound bound = Bound::None;
+      uint8 move = 0; // 最善手の線の番号
+    };
+    void resize(const uint32 bits) {
+      size_ = size_t{ 1 } << bits;
+      entries_.reset(new Entry[size_]);
+    }
+    void clear(void) {
+      for (size_t i = 0; i < size_; ++i) {
+        entries_[i].check.store(0, std::memory_order_relaxed);
+        entries_[i].data.store(0, std::memory_order_relaxed);
+      }
+    }
+    Optional<Record> probe(const uint64 lines) const {
+      const Entry& entry = entries_[index_(lines)];
+      const uint64 data = entry.data.load(std::memory_order_relaxed);
+      if ((entry.check.load(std::memory_order_relaxed) ^ data) != lines) return none;
+      const Record record = unpack_(data);
+      if (record.bound == Bound::None) return none;
+      return record;
+    }
+    void store(const uint64 lines, const Record& record) {
+      Entry& entry = entries_[index_(lines)];
+      // 同じ局面なら深く読んだ結果を残し、別の局面なら置き換える
+      const uint64 old_data = entry.data.load(std::memory_order_relaxed);
+      if ((entry.check.load(std::memory_order_relaxed) ^ old_data) == lines and unpack_(old_data).depth > record.depth) return;
+      const uint64 data = pack_(record);
+      entry.check.store(lines ^ data, std::memory_order_relaxed);
+      entry.data.store(data, std::memory_order_relaxed);
+    }
+  private:
+    struct Entry {
+      std::atomic<uint64> check{ 0 }; // 局面 ^ data
+      std::atomic<uint64> data{ 0 };
+    };
+    std::unique_ptr<Entry[]> entries_;
+    size_t size_ = 0;
+    size_t index_(const uint64 lines) const { return Zobrist::mix(lines) & (size_ - 1); }
+    static uint64 pack_(const Record& r) {
+      return static_cast<uint64>(static_cast<uint8>(r.value + 128)) | (uint64{ r.depth & 0xFF } << 8)
+        | (static_cast<uint64>(r.bound) << 16) | (uint64{ r.move } << 24);
+    }
+    static Record unpack_(const uint64 data) {
+      return { static_cast<int32>(data & 0xFF) - 128, static_cast<uint32>((data >> 8) & 0xFF),
+        static_cast<Bound>((data >> 16) & 0xFF), static_cast<uint8>((data >> 24) & 0xFF) };
+    }
+  };
+
+  /// @brief 1スレッド分の探索（置換表と停止フラグは Searcher と共有する）
+  class Worker {
+  public:
+    static constexpr int32 infinity = 1000;
+    static constexpr uint32 max_exact_safe_moves = 2; // 末端の評価でチェーンの値をそのまま使う、残りの安全な手の数の上限
+    Worker(const Layout& layout, TranspositionTable& table, std::atomic<bool>& stop, const uint64& deadline_ns)
+      : layout_(layout), table_(table), stop_(stop), deadline_ns_(deadline_ns) {}
+    uint64 nodes = 0; // 訪れた局面数
+    /// @brief 線 line を引いたときの、手番のプレイヤーから見た値
+    int32 score_move(uint64 lines, uint32 line, uint32 depth, int32 alpha, int32 beta);
+    /// @brief 手を有望な順（置換表の手・ボックスを取る手・相手に渡さない手・渡す手）に並べる
+    size_t order_moves(uint64 lines, Optional<uint8> first, std::array<uint8, Layout::max_lines>& moves) const;
+    /// @brief 読みの末端の評価（手番のプレイヤーが残りで得るボックスの差の見込み）
+    int32 evaluate(uint64 lines);
+  private:
+    const Layout& layout_;
+    TranspositionTable& table_;
+    std::atomic<bool>& stop_; // 時間切れになったスレッドが立て、全スレッドが読みを打ち切る
+    const uint64& deadline_ns_;
+    HashTable<uint64, int32> endgame_memo_; // チェーンとループの組み合わせごとの値
+    /// @brief チェーン（長さ * 2）とループ（長さ * 2 + 1）の並び
+    struct Components {
+      std::array<uint8, Layout::max_lines> codes{};
+      size_t count = 0;
+    };
+    bool is_stopped_(void) const { return stop_.load(std::memory_order_relaxed); }
+    int32 completed_boxes_(uint64 lines, uint32 line) const;
+    bool gives_box_(uint64 lines, uint32 line) const;
+    int32 negamax_(uint64 lines, uint32 depth, int32 alpha, int32 beta);
+    void decompose_(uint64 lines, Components& components) const;
+    int32 solve_endgame_(const Components& components);
+  };
+
+  inline int32 Worker::completed_boxes_(const uint64 lines, const uint32 line) const {
+    int32 count = 0;
+    for (const int32 box : layout_.line_boxes[line]) {
+      if (box >= 0 and (lines & layout_.box_lines[box]) == layout_.box_lines[box]) ++count;
+    }
+    return count;
+  }
+
+  inline bool Worker::gives_box_(const uint64 lines, const uint32 line) const {
+    for (const int32 box : layout_.line_boxes[line]) {
+      if (box >= 0 and std::popcount(lines & layout_.box_lines[box]) == 3) return true;
+    }
+    return false;
+  }
+
+  inline size_t Worker::order_moves(const uint64 lines, const Optional<uint8> first, std::array<uint8, Layout::max_lines>& moves) const {
+    std::array<uint8, Layout::max_lines> safe, unsafe;
+    size_t count = 0, safe_count = 0, unsafe_count = 0;
+    if (first and *first < layout_.line_count and not ((lines >> *first) & 1)) moves[count++] = *first;
+    for (uint64 open = layout_.all_lines & ~lines; open != 0; open &= open - 1) {
+      const uint8 line = static_cast<uint8>(std::countr_zero(open));
+      if (first and line == *first) continue;
+      const uint64 next = lines | (uint64{ 1 } << line);
+      if (completed_boxes_(next, line) > 0) moves[count++] = line;
+      else if (gives_box_(next, line)) unsafe[unsafe_count++] = line;
+      else safe[safe_count++] = line;
+    }
+    for (size_t i = 0; i < safe_count; ++i) moves[count++] = safe[i];
+    for (size_t i = 0; i < unsafe_count; ++i) moves[count++] = unsafe[i];
+    return count;
+  }
+
+  inline int32 Worker::score_move(const uint64 lines, const uint32 line, const uint32 depth, const int32 alpha, const int32 beta) {
+    const uint64 next = lines | (uint64{ 1 } << line);
+    // ボックスを取ったプレイヤーはもう一度引ける
+    if (const int32 gained = completed_boxes_(next, line); gained > 0) {
+      return gained + negamax_(next, depth - 1, alpha - gained, beta - gained);
+    }
+    return -negamax_(next, depth - 1, -beta, -alpha);
+  }
+
+  inline int32 Worker::negamax_(const uint64 lines, const uint32 depth, int32 alpha, int32 beta) {
+    ++nodes;
+    if ((nodes & 0xFFF) == 0 and Time::GetNanosec() >= deadline_ns_) stop_ = true;
+    if (is_stopped_()) return 0;
+    if ((layout_.all_lines & ~lines) == 0) return 0;
+    if (depth == 0) return evaluate(lines);
+    const int32 original_alpha = alpha;
+    Optional<uint8> table_move;
+    if (const Optional<TranspositionTable::Record> record = table_.probe(lines)) {
+      table_move = record->move;
+      if (record->depth >= depth) {
+        if (record->bound == TranspositionTable::Bound::Exact) return record->value;
+        if (record->bound == TranspositionTable::Bound::Lower) alpha = Max(alpha, record->value);
+        else if (record->bound == TranspositionTable::Bound::Upper) beta = Min(beta, record->value);
+        if (alpha >= beta) return record->value;
+      }
+    }
+    std::array<uint8, Layout::max_lines> moves;
+    const size_t count = order_moves(lines, table_move, moves);
+    int32 best = -infinity;
+    uint8 best_move = moves[0];
+    for (size_t i = 0; i < count; ++i) {
+      const int32 value = score_move(lines, moves[i], depth, alpha, beta);
+      if (is_stopped_()) return 0;
+      if (value > best) {
+        best = value;
+        best_move = moves[i];
+      }
+      alpha = Max(alpha, value);
+      if (alpha >= beta) break;
+    }
+    const TranspositionTable::Bound bound = (best <= original_alpha) ? TranspositionTable::Bound::Upper
+      : (best >= beta) ? TranspositionTable::Bound::Lower : TranspositionTable::Bound::Exact;
+    table_.store(lines, { best, depth, bound, best_move });
+    return best;
+  }
+
+  inline int32 Worker::evaluate(uint64 lines) {
+    int32 gained = 0;
+    // 取れるボックスはすべて取る
+    for (bool found = true; found;) {
+      found = false;
+      for (uint32 box = 0; box < layout_.box_count; ++box) {
+        const uint64 missing = layout_.box_lines[box] & ~lines;
+        if (std::popcount(missing) != 1) continue;
+        lines |= missing;
+        gained += completed_boxes_(lines, static_cast<uint32>(std::countr_zero(missing)));
+        found = true;
+      }
+    }
+    // 相手にボックスを渡さない手を引けるだけ引き、その数の偶奇で最初にチェーンを開けるプレイヤーを決める（長鎖規則）
+    uint32 safe_moves = 0;
+    for (uint64 open = layout_.all_lines & ~lines; open != 0; open &= open - 1) {
+      const uint32 line = static_cast<uint32>(std::countr_zero(open));
+      const uint64 next = lines | (uint64{ 1 } << line);
+      if (gives_box_(next, line)) continue;
+      lines = next;
+      ++safe_moves;
+    }
+    Components components;
+    decompose_(lines, components);
+    const int32 opener_value = solve_endgame_(components);
+    const int32 value = (safe_moves % 2 == 0) ? opener_value : -opener_value;
+    // 相手にボックスを渡さない手が多く残るうちは偶奇が変わりやすいので、見込みを主導権の有無程度に抑える
+    if (safe_moves > max_exact_safe_moves) return gained + Clamp(value, -1, 1);
+    return gained + value;
+  }
+
+  inline void Worker::decompose_(const uint64 lines, Components& components) const {
+    // 残り2辺のボックスを、引かれていない線でつながる同じく残り2辺のボックスとまとめる
+    // 3辺以上残るボックス（分岐点）はどのチェーンにも含めない
+    const auto degree = [&](const int32 box) { return std::popcount(layout_.box_lines[box] & ~lines); };
+    uint64 visited = 0;
+    std::array<int32, Layout::max_lines> stack;
+    for (uint32 start = 0; start < layout_.box_count; ++start) {
+      if ((visited >> start & 1) or degree(start) != 2) continue;
+      visited |= uint64{ 1 } << start;
+      size_t stack_size = 0, length = 0, inner_edges = 0;
+      stack[stack_size++] = start;
+      while (stack_size > 0) {
+        const int32 box = stack[--stack_size];
+        ++length;
+        for (uint64 open = layout_.box_lines[box] & ~lines; open != 0; open &= open - 1) {
+          const auto& boxes = layout_.line_boxes[std::countr_zero(open)];
+          const int32 other = (boxes[0] == box) ? boxes[1] : boxes[0];
+          if (other < 0 or degree(other) != 2) continue;
+          ++inner_edges;
+          if (visited >> other & 1) continue;
+          visited |= uint64{ 1 } << other;
+          stack[stack_size++] = other;
+        }
+      }
+      // 内側の線（両側から1回ずつ数える）がボックスと同じ数ならループ
+      const bool is_loop = (inner_edges / 2 == length);
+      components.codes[components.count++] = static_cast<uint8>(length * 2 + (is_loop ? 1 : 0));
+    }
+    std::sort(components.codes.begin(), components.codes.begin() + components.count);
+  }
+
+  inline int32 Worker::solve_endgame_(const Components& components) {
+    if (components.count == 0) return 0;
+    uint64 key = components.count;
+    for (size_t i = 0; i < components.count; ++i) key = Zobrist::mix(key ^ components.codes[i]);
+    if (const auto it = endgame_memo_.find(key); it != endgame_memo_.end()) return it->second;
+    // 手番のプレイヤーはどれかを開けるしかなく、相手は全部取るか、最後の 2 個（ループは 4 個）を渡して主導権を保つかを選ぶ
+    int32 best = -infinity;
+    Components rest;
+    for (size_t i = 0; i < components.count; ++i) {
+      if (i > 0 and components.codes[i] == components.codes[i - 1]) continue;
+      rest.count = 0;
+      for (size_t j = 0; j < components.count; ++j) {
+        if (j != i) rest.codes[rest.count++] = components.codes[j];
+      }
+      const int32 rest_value = solve_endgame_(rest);
+      const int32 length = components.codes[i] / 2;
+      const bool is_loop = (components.codes[i] % 2 == 1);
+      int32 taker = length + rest_value;
+      if (is_loop) taker = Max(taker, length - 8 - rest_value);
+      else if (length >= 3) taker = Max(taker, length - 4 - rest_value);
+      best = Max(best, -taker);
+    }
+    if (endgame_memo_.size() >= (size_t{ 1 } << 16)) endgame_memo_.clear();
+    endgame_memo_.emplace(key, best);
+    return best;
+  }
+
+  /// @brief 手番のプレイヤーの手を選ぶ（置換表は手をまたいで使い回す）
+  class Searcher {
+  public:
+    explicit Searcher(const Settings& settings = {}) : settings_(settings) {
+      table_.resize(settings_.table_bits);
+    }
+    const Settings& get_settings(void) const { return settings_; }
+    const Stats& get_stats(void) const { return stats_; }
+    void clear_table(void) { table_.clear(); }
+    /// @brief board の手番のプレイヤーの手を選ぶ（終局していれば none）
+    /// @remark 線が 64 本を超える盤面は読まずに、取れるボックスを取り相手に渡さない手を選ぶ
+    Optional<Operation> choose(const Board& board);
+  private:
+    Settings settings_;
+    Optional<Layout> layout_;
+    TranspositionTable table_;
+    Array<std::unique_ptr<Worker>> workers_;
+    std::atomic<bool> stop_{ false };
+    uint64 deadline_ns_ = 0;
+    Stats stats_;
+    Optional<std::pair<int32, uint8>> search_root_(uint64 lines, uint32 depth);
+    Optional<Operation> choose_without_search_(const Board& board) const;
+  };
+
+  inline Optional<Operation> Searcher::choose(const Board& board) {
+    if (board.is_finished() or board.get_horizontal_lines().isEmpty()) return none;
+    if (not Layout::fits(board.get_grid_size())) return choose_without_search_(board);
+    if (not layout_ or layout_->grid_size != board.get_grid_size()) {
+      layout_.emplace(board.get_grid_size());
+      table_.clear();
+      workers_.clear();
+      for (size_t i = 0; i < Max<size_t>(settings_.threads, 1); ++i) {
+        workers_.push_back(std::make_unique<Worker>(*layout_, table_, stop_, deadline_ns_));
+      }
+    }
+    const uint64 lines = layout_->to_lines(board);
+    const uint32 remaining = static_cast<uint32>(std::popcount(layout_->all_lines & ~lines));
+    if (remaining == 0) return none;
+    stats_ = {};
+    for (auto& worker : workers_) worker->nodes = 0;
+    const uint64 start_ns = Time::GetNanosec();
+    uint8 best_move = static_cast<uint8>(std::countr_zero(layout_->all_lines & ~lines));
+    // 1手目の深さは時間に関係なく読み終える
+    deadline_ns_ = ~uint64{ 0 };
+    for (uint32 depth = 1; depth <= Min(settings_.max_depth, remaining); ++depth) {
+      stop_ = false;
+      const Optional<std::pair<int32, uint8>> result = search_root_(lines, depth);
+      if (not result) break;
+      stats_.value = result->first;
+      stats_.depth = depth;
+      best_move = result->second;
+      if (depth == remaining) stats_.is_solved = true;
+      deadline_ns_ = start_ns + static_cast<uint64>(settings_.think_time.count() * 1e9);
+      if (Time::GetNanosec() >= deadline_ns_) break;
+    }
+    for (const auto& worker : workers_) stats_.nodes += worker->nodes;
+    stats_.elapsed = Duration{ (Time::GetNanosec() - start_ns) / 1e9 };
+    return layout_->to_operation(best_move, board.get_turn());
+  }
+
+  inline Optional<std::pair<int32, uint8>> Searcher::search_root_(const uint64 lines, const uint32 depth) {
+    Worker& main = *workers_.front();
+    std::array<uint8, Layout::max_lines> moves;
+    Optional<uint8> table_move;
+    if (const auto record = table_.probe(lines)) table_move = record->move;
+    const size_t count = main.order_moves(lines, table_move, moves);
+    // 最有力の手を全幅で読み、その値を下限にして残りの手をスレッドで分担する
+    int32 best_value = main.score_move(lines, moves[0], depth, -Worker::infinity, Worker::infinity);
+    if (stop_) return none;
+    uint8 best_move = moves[0];
+    std::atomic<int32> alpha{ best_value };
+    std::atomic<size_t> next{ 1 };
+    std::mutex mutex;
+    const auto work = [&](Worker& worker) {
+      for (size_t i = next++; i < count; i = next++) {
+        const int32 bound = alpha.load();
+        const int32 value = worker.score_move(lines, moves[i], depth, bound, Worker::infinity);
+        if (stop_) return;
+        if (value <= bound) continue;
+        const std::lock_guard lock{ mutex };
+        if (value > best_value) {
+          best_value = value;
+          best_move = moves[i];
+          alpha = value;
+        }
+      }
+    };
+    Array<std::thread> threads;
+    for (size_t t = 1; t < Min(workers_.size(), count); ++t) threads.emplace_back(work, std::ref(*workers_[t]));
+    work(main);
+    for (std::thread& thread : threads) thread.join();
+    if (stop_) return none;
+    table_.store(lines, { best_value, depth, TranspositionTable::Bound::Exact, best_move });
+    return std::pair{ best_value, best_move };
+  }
+
+  inline Optional<Operation> Searcher::choose_without_search_(const Board& board) const {
+    const LineColor turn = board.get_turn();
+    const auto& horizontal_lines = board.get_horizontal_lines();
+    const auto& vertical_lines = board.get_vertical_lines();
+    // 取れるボックスがあれば、残りの1辺を引く
+    if (const Array<Point> boxes = board.get_three_sided_boxes(); not boxes.isEmpty()) {
+      const Point box = boxes.front();
+      if (horizontal_lines[box] == LineColor::None) return Operation{ box, LineDirection::Top, turn };
+      if (horizontal_lines[box.movedBy(0, 1)] == LineColor::None) return Operation{ box.movedBy(0, 1), LineDirection::Top, turn };
+      if (vertical_lines[box] == LineColor::None) return Operation{ box, LineDirection::Left, turn };
+      return Operation{ box.movedBy(1, 0), LineDirection::Left, turn };
+    }
+    // 3辺目にならない線（相手にボックスを渡さない線）から選ぶ
+    const auto drawn_sides = [&](const Point& box) {
+      return (horizontal_lines[box] != LineColor::None) + (horizontal_lines[box.movedBy(0, 1)] != LineColor::None)
+        + (vertical_lines[box] != LineColor::None) + (vertical_lines[box.movedBy(1, 0)] != LineColor::None);
+    };
+    const auto is_safe = [&](const Operation& op) {
+      const Point other = (op.dir == LineDirection::Top) ? op.pos.movedBy(0, -1) : op.pos.movedBy(-1, 0);
+      for (const Point& box : { other, op.pos }) {
+        if (board.get_box_owners().inBounds(box) and drawn_sides(box) == 2) return false;
+      }
+      return true;
+    };
+    const Array<Operation> operations = board.get_legal_operations();
+    if (operations.isEmpty()) return none;
+    const Array<Operation> safe = operations.filter(is_safe);
+    return (safe.isEmpty() ? operations : safe).choice();
+  }
+
+  /// @brief Headless::BotClient に渡す、思考ルーチンで手を選ぶ関数（DotsAndBoxes 以外のゲームではランダムな手を打つ）
+  inline Headless::MovePicker make_bot_player(const Settings& settings = {}) {
+    const auto searcher = std::make_shared<Searcher>(settings);
+    return [searcher](IGame& game) {
+      Game* dots_and_boxes = dynamic_cast<Game*>(&game);
+      if (not dots_and_boxes) return game.play_random_move();
+      if (not dots_and_boxes->is_turn()) return false;
+      const Optional<Operation> op = searcher->choose(dots_and_boxes->get_board());
+      return op and dots_and_boxes->play_operation(*op);
+    };
+  }
+}
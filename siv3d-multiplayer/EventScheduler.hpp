@@ -0,0 +1,183 @@
+﻿# pragma once
+# include <Siv3D.hpp>
+# include "Multiplayer_Photon.hpp"
+# include "WriterPool.hpp"
+
+/// @brief 送信イベントの優先度（小さいほど優先）
+enum class EventPriority : uint8 {
+  Critical = 0, // 帯域予算を無視して必ず送る（ターンの操作など）
+  High = 1,
+  Normal = 2,
+  Low = 3, // 予算超過時に真っ先に間引かれる（カーソル位置など）
+};
+
+/// @brief 1秒あたりのバイト予算と優先度・期限に従って送信イベントを間引くスケジューラ
+class OutgoingScheduler {
+public:
+  /// @brief 1イベントあたりのヘッダなどの概算オーバーヘッド（バイト）
+  static constexpr int64 event_overhead_bytes = 16;
+  struct Stats {
+    size_t queue_depth = 0; // 現在キューにあるイベント数
+    size_t peak_queue_depth = 0; // キュー長の最大値
+    uint64 sent_events = 0; // 送信したイベント数
+    uint64 dropped_stale = 0; // 期限切れで破棄したイベント数
+    uint64 dropped_superseded = 0; // 予算超過時に新しい更新で置き換えられて破棄したイベント数
+    int64 sent_bytes = 0; // 送信したイベントの概算バイト数
+    double measured_bytes_per_sec = 0.0; // getBytesOut から計測した実際の送信レート
+  };
+private:
+  struct Entry {
+    uint8 event_code;
+    Serializer<MemoryWriter> writer;
+    Optional<Array<LocalPlayerID>> targets;
+    EventPriority priority;
+    Duration enqueued_at;
+    Duration deadline; // 積まれた時刻からの有効期限
+    uint64 order; // 同じ優先度内での送信順
+    int64 size(void) const {
+      return static_cast<int64>(writer->getBlob().size()) + event_overhead_bytes;
+    }
+  };
+  Array<Entry> queue_;
+  WriterPool* pool_ = nullptr; // 送信・破棄したバッファの返却先（nullptr なら捨てる）
+  Stopwatch clock_{ StartImmediately::Yes };
+  int32 budget_bytes_per_sec_ = 0; // 0 なら無制限
+  double tokens_ = 0.0; // 現在送信できるバイト数
+  Duration last_flush_at_{ 0 };
+  Optional<int32> last_bytes_out_; // 前回 flush 時の getBytesOut
+  int64 accounted_bytes_ = 0; // 前回 flush 以降にこのスケジューラ経由で送った概算バイト数
+  uint64 next_order_ = 0;
+  Stats stats_;
+  Duration measure_window_start_{ 0 };
+  int32 measure_window_bytes_out_ = 0;
+  void refill_(const Duration now, const int32 bytes_out);
+  void drop_expired_(const Duration now);
+  void drop_superseded_(void);
+  /// @brief 同じ種類の更新か（新しい方が古い方を置き換えてよいか）
+  static bool is_same_stream_(const Entry& a, const Entry& b) {
+    return (a.event_code == b.event_code) and (a.priority == b.priority) and (a.targets == b.targets);
+  }
+  void recycle_(Entry& entry) {
+    if (pool_) pool_->release(std::move(entry.writer));
+  }
+public:
+  OutgoingScheduler() = default;
+  explicit OutgoingScheduler(WriterPool* pool)
+    : pool_(pool) {}
+  /// @brief 1秒あたりの送信バイト予算を設定する（0 で無制限）
+  void set_budget(const int32 bytes_per_sec) {
+    budget_bytes_per_sec_ = Max(bytes_per_sec, 0);
+    tokens_ = budget_bytes_per_sec_;
+  }
+  int32 get_budget(void) const { return budget_bytes_per_sec_; }
+  const Stats& get_stats(void) const { return stats_; }
+  /// @brief イベントをキューに積む
+  void push(const uint8 event_code, Serializer<MemoryWriter>&& writer, const Optional<Array<LocalPlayerID>>& targets,
+    const EventPriority priority, const Duration deadline) {
+    queue_.push_back(Entry{ event_code, std::move(writer), targets, priority, clock_.elapsed(), deadline, next_order_++ });
+    stats_.queue_depth = queue_.size();
+    stats_.peak_queue_depth = Max(stats_.peak_queue_depth, queue_.size());
+  }
+  /// @brief キューを経由せずに送ったイベントを予算から差し引く
+  void consume(const int64 payload_bytes) {
+    const int64 bytes = payload_bytes + event_overhead_bytes;
+    tokens_ -= bytes;
+    accounted_bytes_ += bytes;
+    stats_.sent_bytes += bytes;
+    ++stats_.sent_events;
+  }
+  /// @brief 予算の範囲で優先度の高い順にイベントを送信する
+  /// @param send 送信関数 void(uint8, const Serializer<MemoryWriter>&, const Optional<Array<LocalPlayerID>>&)
+  /// @param bytes_out 現在の Multiplayer_Photon::getBytesOut()
+  template<class Send>
+  void flush(Send&& send, const int32 bytes_out);
+  /// @brief キューを空にする（ルーム退出時など）
+  void clear(void) {
+    for (Entry& entry : queue_) recycle_(entry);
+    queue_.clear();
+    stats_.queue_depth = 0;
+  }
+};
+
+inline void OutgoingScheduler::refill_(const Duration now, const int32 bytes_out) {
+  // 実際の送信量のうちスケジューラが把握していない分（他の送信やプロトコルのオーバーヘッド）も予算から引く
+  if (last_bytes_out_) {
+    const int64 delta = static_cast<int64>(bytes_out) - *last_bytes_out_;
+    if (delta > accounted_bytes_) tokens_ -= (delta - accounted_bytes_);
+    measure_window_bytes_out_ += static_cast<int32>(Max<int64>(delta, 0));
+  }
+  last_bytes_out_ = bytes_out;
+  accounted_bytes_ = 0;
+  if ((now - measure_window_start_) >= 1s) {
+    stats_.measured_bytes_per_sec = measure_window_bytes_out_ / (now - measure_window_start_).count();
+    measure_window_start_ = now;
+    measure_window_bytes_out_ = 0;
+  }
+  // 予算1秒分までバーストを許す
+  tokens_ = Min(tokens_ + budget_bytes_per_sec_ * (now - last_flush_at_).count(), static_cast<double>(budget_bytes_per_sec_));
+  last_flush_at_ = now;
+}
+
+inline void OutgoingScheduler::drop_expired_(const Duration now) {
+  const auto is_expired = [&](const Entry& entry) {
+    return (entry.priority != EventPriority::Critical) and ((now - entry.enqueued_at) > entry.deadline);
+  };
+  for (Entry& entry : queue_) {
+    if (is_expired(entry)) recycle_(entry);
+  }
+  const size_t before = queue_.size();
+  queue_.remove_if(is_expired);
+  stats_.dropped_stale += (before - queue_.size());
+}
+
+inline void OutgoingScheduler::drop_superseded_(void) {
+  // 同じイベントコード・宛先・優先度のうち最新のものだけを残す
+  // ハッシュは候補を絞るためだけに使い、衝突しても無関係なイベントを捨てないよう最後は値を比べる
+  HashTable<uint64, Array<size_t>> seen; // ハッシュ → kept のインデックス
+  Array<Entry> kept(Arg::reserve = queue_.size());
+  for (auto it = queue_.rbegin(); it != queue_.rend(); ++it) {
+    if (it->priority != EventPriority::Critical) {
+      uint64 key = (static_cast<uint64>(it->event_code) << 8) | static_cast<uint8>(it->priority);
+      if (it->targets) {
+        for (const LocalPlayerID id : *it->targets) key = key * 1000003 + static_cast<uint32>(id);
+      }
+      Array<size_t>& candidates = seen[key];
+      if (candidates.any([&](const size_t index) { return is_same_stream_(kept[index], *it); })) {
+        ++stats_.dropped_superseded;
+        recycle_(*it);
+        continue;
+      }
+      candidates << kept.size();
+    }
+    kept.push_back(std::move(*it));
+  }
+  kept.reverse();
+  queue_ = std::move(kept);
+}
+
+template<class Send>
+inline void OutgoingScheduler::flush(Send&& send, const int32 bytes_out) {
+  const Duration now = clock_.elapsed();
+  refill_(now, bytes_out);
+  drop_expired_(now);
+  if (queue_.isEmpty()) {
+    stats_.queue_depth = 0;
+    return;
+  }
+  queue_.stable_sort_by([](const Entry& a, const Entry& b) {
+    return (a.priority != b.priority) ? (a.priority < b.priority) : (a.order < b.order);
+  });
+  size_t sent = 0;
+  for (const Entry& entry : queue_) {
+    const bool unlimited = (budget_bytes_per_sec_ == 0) or (entry.priority == EventPriority::Critical);
+    if (not unlimited and tokens_ < entry.size()) break;
+    send(entry.event_code, entry.writer, entry.targets);
+    consume(entry.size() - event_overhead_bytes);
+    ++sent;
+  }
+  for (size_t i = 0; i < sent; ++i) recycle_(queue_[i]);
+  queue_.erase(queue_.begin(), queue_.begin() + sent);
+  // 予算を超えて残ったものは、新しい更新で置き換えられた古いものから捨てる
+  if (not queue_.isEmpty()) drop_superseded_();
+  stats_.queue_depth = queue_.size();
+}
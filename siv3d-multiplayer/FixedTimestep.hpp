@@ -0,0 +1,71 @@
+﻿# pragma once
+# include <Siv3D.hpp>
+
+// 描画のフレームレートに関係なく、シミュレーションを一定の間隔のティックで進める（通信は毎フレーム行う）
+namespace FixedTimestep {
+
+  struct Stats {
+    uint64 ticks = 0; // 進めたティックの累計
+    uint32 last_frame_ticks = 0; // 直近のフレームで進めたティック数
+    uint64 overrun_frames = 0; // 追いつくのに必要なティック数が上限を超えたフレーム
+    double dropped_seconds = 0.0; // 上限を超えて切り捨てた時間の累計
+    uint64 slow_ticks = 0; // 処理がティックの間隔より長くかかったティック
+    double last_tick_ms = 0.0; // 直近のティックの処理時間
+    double max_tick_ms = 0.0;
+  };
+
+  /// @brief 経過時間を蓄積し、ティックの間隔ごとに処理を呼ぶ
+  /// @remark 処理が間に合わないときは1フレームで進めるティック数を max_ticks_per_frame に制限し、残りは切り捨てる（遅れを取り戻そうとして更に遅れるのを防ぐ）
+  class Scheduler {
+  public:
+    /// @param tick_duration 1ティックの長さ
+    /// @param max_ticks_per_frame 1フレームで進める最大ティック数
+    explicit Scheduler(const Duration tick_duration = SecondsF{ 1.0 / 60 }, const uint32 max_ticks_per_frame = 5)
+      : tick_seconds_(tick_duration.count()), max_ticks_per_frame_(Max<uint32>(max_ticks_per_frame, 1)) {}
+    /// @brief フレームの経過時間 frame_dt の分だけティックを進める
+    /// @param on_tick 1ティック分の処理 void(double tick_dt)
+    /// @return このフレームで進めたティック数
+    template<class OnTick>
+    uint32 update(double frame_dt, OnTick&& on_tick);
+    /// @brief 最後のティックから次のティックまでのどこを描画しているか（0 ~ 1, 前後のティックの状態の補間に使う）
+    double get_alpha(void) const { return accumulator_ / tick_seconds_; }
+    double get_tick_seconds(void) const { return tick_seconds_; }
+    void set_tick_duration(const Duration tick_duration) { tick_seconds_ = tick_duration.count(); }
+    void set_max_ticks_per_frame(const uint32 max_ticks_per_frame) { max_ticks_per_frame_ = Max<uint32>(max_ticks_per_frame, 1); }
+    /// @brief 蓄積した時間を捨てる（シーンの切り替え時など）
+    void reset(void) { accumulator_ = 0.0; }
+    const Stats& get_stats(void) const { return stats_; }
+  private:
+    double tick_seconds_;
+    uint32 max_ticks_per_frame_;
+    double accumulator_ = 0.0;
+    Stats stats_;
+  };
+
+  template<class OnTick>
+  inline uint32 Scheduler::update(const double frame_dt, OnTick&& on_tick) {
+    accumulator_ += Max(frame_dt, 0.0);
+    uint32 ticks = 0;
+    while (accumulator_ >= tick_seconds_) {
+      if (ticks >= max_ticks_per_frame_) {
+        // 追いつけない分は捨て、端数だけを次のフレームに持ち越す
+        const double kept = std::fmod(accumulator_, tick_seconds_);
+        ++stats_.overrun_frames;
+        stats_.dropped_seconds += accumulator_ - kept;
+        accumulator_ = kept;
+        break;
+      }
+      const uint64 start_ns = Time::GetNanosec();
+      on_tick(tick_seconds_);
+      const double elapsed_ms = (Time::GetNanosec() - start_ns) / 1e6;
+      stats_.last_tick_ms = elapsed_ms;
+      stats_.max_tick_ms = Max(stats_.max_tick_ms, elapsed_ms);
+      if (elapsed_ms > tick_seconds_ * 1000) ++stats_.slow_ticks;
+      accumulator_ -= tick_seconds_;
+      ++ticks;
+    }
+    stats_.ticks += ticks;
+    stats_.last_frame_ticks = ticks;
+    return ticks;
+  }
+}
@@ -0,0 +1,99 @@
+﻿# pragma once
+# include <Siv3D.hpp>
+
+// 方式・サイズ・書体が同じフォントをシーンやゲームのインスタンスをまたいで使い回すキャッシュ
+// フォントの実体は FontAsset に登録し、ロビーにいる間に非同期で読み込んでおける
+class FontCache {
+public:
+  /// @brief キャッシュから借りたフォント（生存している間は参照数に数える）
+  class Handle {
+  public:
+    Handle(void) = default;
+    Handle(const Handle& other) : cache_(other.cache_), name_(other.name_), font_(other.font_) { retain_(); }
+    Handle& operator=(const Handle& other) {
+      if (this == &other) return *this;
+      release_();
+      cache_ = other.cache_;
+      name_ = other.name_;
+      font_ = other.font_;
+      retain_();
+      return *this;
+    }
+    ~Handle() { release_(); }
+    const Font& get(void) const { return font_; }
+    operator const Font&(void) const { return font_; }
+    /// @brief Font::operator() と同じ
+    template<class... Args>
+    DrawableText operator()(Args&&... args) const { return font_(std::forward<Args>(args)...); }
+  private:
+    friend class FontCache;
+    FontCache* cache_ = nullptr;
+    String name_;
+    Font font_;
+    Handle(FontCache& cache, const String& name)
+      : cache_(&cache), name_(name), font_(FontAsset(name)) { retain_(); }
+    void retain_(void) { if (cache_) ++cache_->references_[name_]; }
+    void release_(void) {
+      if (cache_) --cache_->references_[name_];
+      cache_ = nullptr;
+    }
+  };
+  struct Stats {
+    size_t registered = 0; // 登録したフォントの数（同じキーは1回だけ）
+    size_t lookups = 0; // get() の呼び出し回数
+    size_t released = 0; // trim() で解放したフォントの数
+  };
+  /// @brief プロセス全体で共有するキャッシュ
+  static FontCache& shared(void) {
+    static FontCache cache;
+    return cache;
+  }
+  /// @brief フォントを借りる（初めてのキーなら登録し、読み込みが済んでいなければここで読み込む）
+  Handle get(const FontMethod method, const int32 size, const Typeface typeface = Typeface::Regular) {
+    ++stats_.lookups;
+    return Handle{ *this, register_(method, size, typeface) };
+  }
+  /// @brief フォントの読み込みを非同期に始める（preload_text の字形も先に用意する）
+  void preload(const FontMethod method, const int32 size, const Typeface typeface = Typeface::Regular, const String& preload_text = U"") {
+    const String name = register_(method, size, typeface);
+    if (not FontAsset::IsReady(name)) FontAsset::LoadAsync(name, preload_text);
+  }
+  bool is_ready(const FontMethod method, const int32 size, const Typeface typeface = Typeface::Regular) const {
+    return FontAsset::IsReady(get_name_(method, size, typeface));
+  }
+  /// @brief どこからも借りられていないフォントを解放する
+  void trim(void) {
+    for (auto it = references_.begin(); it != references_.end();) {
+      if (it->second == 0) {
+        FontAsset::Unregister(it->first);
+        ++stats_.released;
+        references_.erase(it++);
+      } else {
+        ++it;
+      }
+    }
+  }
+  /// @brief 借りられているフォントの参照数の合計
+  size_t get_reference_count(void) const {
+    size_t count = 0;
+    for (const auto& [name, references] : references_) count += references;
+    return count;
+  }
+  const Stats& get_stats(void) const { return stats_; }
+private:
+  HashTable<String, size_t> references_; // 登録したフォントごとの参照数
+  Stats stats_;
+  FontCache(void) = default;
+  static String get_name_(const FontMethod method, const int32 size, const Typeface typeface) {
+    return U"FontCache/{}/{}/{}"_fmt(FromEnum(method), size, FromEnum(typeface));
+  }
+  String register_(const FontMethod method, const int32 size, const Typeface typeface) {
+    String name = get_name_(method, size, typeface);
+    if (not references_.contains(name)) {
+      FontAsset::Register(name, method, size, typeface);
+      references_.emplace(name, 0);
+      ++stats_.registered;
+    }
+    return name;
+  }
+};
@@ -0,0 +1,42 @@
+﻿# pragma once
+# include <span>
+# include <Siv3D.hpp>
+# include "IGame.hpp"
+# include "TicTacToe.hpp"
+# include "DotsAndBoxes.hpp"
+
+// 遊べるゲームの一覧（ID・最大人数・ファクトリ・ルール）をコンパイル時に決める
+// 一覧の表示やルームの人数判定のためにゲームのインスタンスを作らなくて済むよう、各ゲームは game_id と max_players を static constexpr で持つ
+namespace GameRegistry {
+
+  using Factory = std::unique_ptr<IGame>(*)(void);
+
+  struct Entry {
+    StringView game_id;
+    uint8 max_players;
+    Factory factory; // 必要になったときにだけインスタンスを作る
+    void(*preload_assets)(void); // 描画用のアセットを非同期に読み込み始める
+    std::span<const StringView> rules; // ロビーで選べるルール（先頭が既定, 空ならルールを選べない）
+  };
+
+  template<class Game>
+  constexpr Entry make_entry(void) {
+    Entry entry{ Game::game_id, Game::max_players, []() -> std::unique_ptr<IGame> { return std::make_unique<Game>(); }, &Game::preload_assets };
+    if constexpr (requires { Game::rules; }) entry.rules = Game::rules;
+    return entry;
+  }
+
+  /// @brief 登録されているゲーム（ロビーにはこの順に並べる）
+  inline constexpr std::array entries{
+    make_entry<TicTacToe::Game>(),
+    make_entry<DotsAndBoxes::Game>(),
+  };
+
+  /// @brief ゲームIDから登録を探す（見つからなければ nullptr）
+  inline const Entry* find(const StringView game_id) {
+    for (const Entry& entry : entries) {
+      if (entry.game_id == game_id) return &entry;
+    }
+    return nullptr;
+  }
+}
@@ -0,0 +1,109 @@
+﻿# pragma once
+# include <Siv3D.hpp>
+# include "OnlineManager.hpp"
+# include "IGame.hpp"
+
+// ウィンドウやフォントを使わずにゲームロジックを動かすためのユーティリティ
+namespace Headless {
+
+  /// @brief 自己対戦の結果
+  struct SelfPlayStats {
+    size_t matches = 0; // 対戦数
+    size_t moves = 0; // 総手数
+    size_t draws = 0; // 引き分け数
+    Duration elapsed{ 0 }; // 所要時間
+    double matches_per_sec(void) const {
+      return (elapsed.count() > 0) ? (matches / elapsed.count()) : 0.0;
+    }
+  };
+
+  /// @brief 盤面だけを使ってランダムな合法手同士の対戦を繰り返す
+  /// @param initialize 盤面を初期化する関数 void(Board&)
+  template<class Board, class Initialize>
+  SelfPlayStats run_self_play(const size_t matches, Initialize&& initialize) {
+    SelfPlayStats stats;
+    const Stopwatch stopwatch{ StartImmediately::Yes };
+    Board board;
+    for (size_t i = 0; i < matches; ++i) {
+      initialize(board);
+      while (not board.is_finished()) {
+        const auto operations = board.get_legal_operations();
+        if (operations.isEmpty()) break;
+        board.operate(operations.choice());
+        ++stats.moves;
+      }
+      // 各ゲームの色・記号の列挙はいずれも None = 0 が引き分け
+      if (const auto winner = board.get_winner(); winner and static_cast<int32>(*winner) == 0) {
+        ++stats.draws;
+      }
+      ++stats.matches;
+    }
+    stats.elapsed = stopwatch.elapsed();
+    return stats;
+  }
+
+  /// @brief ボットが手番で手を打つ関数（打った場合 true）
+  using MovePicker = std::function<bool(IGame&)>;
+
+  /// @brief OnlineManager（Photon またはプロセス内の中継）でランダムマッチの対戦を続けるボットクライアント
+  class BotClient {
+  private:
+    OnlineManager& manager_;
+    std::function<std::unique_ptr<IGame>()> factory_;
+    std::unique_ptr<IGame> game_;
+    Duration think_time_; // 自分の手番になってから手を打つまでの時間
+    MovePicker play_move_; // 手の選び方（未指定ならランダムな合法手）
+    Stopwatch turn_stopwatch_; // 自分の手番になってから（続けて打つ場合は前の手から）の時間
+    bool was_turn_ = false;
+    Stopwatch join_stopwatch_; // ルーム参加を要求してからの時間
+    bool was_started_ = false;
+    size_t finished_matches_ = 0;
+    void leave_(void) {
+      if (manager_.is_in_room()) manager_.leave_game_room();
+      manager_.set_game_handler(nullptr);
+      game_.reset();
+      was_started_ = false;
+      was_turn_ = false;
+    }
+  public:
+    BotClient(OnlineManager& manager, std::function<std::unique_ptr<IGame>()> factory, const Duration think_time = 0.5s, MovePicker play_move = nullptr)
+      : manager_(manager), factory_(std::move(factory)), think_time_(think_time), play_move_(std::move(play_move)) {}
+    /// @brief 毎フレーム呼ぶ
+    void update(void) {
+      manager_.update();
+      if (manager_.is_in_lobby()) {
+        // 参加に失敗したまま一定時間ロビーにいれば選び直す
+        if (game_ and join_stopwatch_.elapsed() >= 2s) leave_();
+        // ロビーにいればゲームを用意してランダムマッチに参加する
+        if (not game_) {
+          game_ = factory_();
+          manager_.set_game_handler(game_.get());
+          game_->set_network(&manager_);
+          manager_.join_random_game_room(game_->get_game_id());
+          join_stopwatch_.restart();
+        }
+        return;
+      }
+      if (not game_) return;
+      if (game_->is_started()) {
+        was_started_ = true;
+        if (game_->is_finished()) {
+          ++finished_matches_;
+          leave_();
+          return;
+        }
+        // 考える時間は相手の手番の間ではなく、自分の手番になったときから数える
+        const bool is_turn = game_->is_turn();
+        if (is_turn and not was_turn_) turn_stopwatch_.restart();
+        was_turn_ = is_turn;
+        if (is_turn and turn_stopwatch_.elapsed() >= think_time_ and (play_move_ ? play_move_(*game_) : game_->play_random_move())) {
+          turn_stopwatch_.restart();
+        }
+      } else if (was_started_) {
+        // 相手が途中で退出してゲームがリセットされた
+        leave_();
+      }
+    }
+    size_t get_finished_matches(void) const { return finished_matches_; }
+  };
+}
@@ -4,6 +4,29 @@
 
 class OnlineManager;
 
+/// @brief OnlineManager が内部のやり取りに使うイベントコード（ゲームのイベントコードは reserved_begin 未満にする）
+namespace ReservedEventCode {
+  constexpr uint8 reserved_begin = 200;
+  constexpr uint8 snapshot = 200; // ホストから送るゲーム状態のスナップショット
+  constexpr uint8 lockstep_input = 201; // ロックステップのティックごとの入力
+  constexpr uint8 rollback_input = 202; // ロールバックのフレームごとの入力
+  constexpr uint8 sequenced_proposal = 203; // ホストに確定を依頼する操作
+  constexpr uint8 sequenced_reject = 204; // ホストが棄却した操作の通知
+  constexpr uint8 state_hash = 205; // 不一致検出のための状態ハッシュの履歴
+  constexpr uint8 spectator_batch = 206; // ホストから観戦者へまとめて送る確定イベント
+  constexpr uint8 snapshot_request = 207; // 観戦者がイベントの欠落を、プレイヤーが確定の不整合を検出したときのスナップショット要求
+}
+
+/// @brief 手数とその時点の確定した状態のハッシュ
+struct StateHash {
+  uint32 moves = 0;
+  uint64 hash = 0;
+  template<class Archive>
+  void SIV3D_SERIALIZE(Archive& archive) {
+    archive(moves, hash);
+  }
+};
+
 class IGame {
 public:
   virtual ~IGame() = default;
@@ -16,12 +39,27 @@ public:
   /// @brief このゲームの最大プレイヤー数を返す 
   /// @return 最大プレイヤー数
   virtual uint8 get_max_players(void) const = 0;
-  /// @brief ゲームの更新処理
+  /// @brief 毎フレームの更新処理（クリックなどの入力を拾う）
   virtual void update(void) = 0;
+  /// @brief 一定間隔のティックごとの更新処理（フレームレートに依存させたくないシミュレーションを進める）
+  /// @param dt ティックの長さ（秒）
+  virtual void tick(double dt) = 0;
   /// @brief ゲームの描画処理
-  virtual void draw(void) const = 0;
+  /// @param alpha 最後のティックから次のティックまでのどこを描画しているか（0 ~ 1, ティックで進める状態を補間して描画するのに使う）
+  virtual void draw(double alpha) const = 0;
   /// @brief デバッグ表示
   virtual void debug(void) = 0;
+  /// @brief 自分が手を打てる状態か（手番のないリアルタイムのゲームは開始していれば true）
+  virtual bool is_turn(void) const = 0;
+  /// @brief 自分の手番であればランダムな合法手を1手打つ（ボット・ヘッドレス実行用）
+  /// @return 手を打った場合 true
+  virtual bool play_random_move(void) = 0;
+  /// @brief 次のゲームのルール（盤面の大きさなど）を文字列にする（ルームの設定に載せて全員でそろえる）
+  /// @return ルールを選べないゲームは空文字列
+  virtual String get_rule(void) const { return String{}; }
+  /// @brief get_rule() の文字列から次のゲームのルールを設定する（ゲーム開始前に呼ばれる）
+  /// @return 設定できた場合 true（形式が不正なら今のルールのまま false）
+  virtual bool set_rule([[maybe_unused]] const StringView rule) { return false; }
   /* Photonイベントに対応するハンドラ */
   /// @brief ゲーム開始条件が満たされたときに呼ばれる
   /// @param players ルームにいるプレイヤーのリスト
@@ -32,11 +70,23 @@ public:
   virtual void on_player_left(LocalPlayerID player_id) = 0;
   /// @brief 自身がルームから退出したときに呼ばれる
   virtual void on_leave_room(void) = 0;
+  /// @brief ルームのホストが交代したときに呼ばれる
+  /// @param is_host 自身が新しいホストであるか
+  virtual void on_host_changed(bool is_host) = 0;
+  /// @brief ゲーム状態のスナップショットを書き出す（新しいホストや再参加したプレイヤーへ送る）
+  /// @remark 先頭に形式のバージョン（uint16）を書き、形式を変えたらバージョンを上げる
+  virtual void write_snapshot(Serializer<MemoryWriter>& writer) const = 0;
+  /// @brief ホストから受け取ったスナップショットで自身のゲーム状態を置き換える
+  /// @return 読み込めた場合 true（バージョンが異なる・サイズが不正な場合は状態を変えずに false）
+  virtual bool read_snapshot(Deserializer<MemoryViewReader>& reader) = 0;
   /// @brief カスタムイベント受信時に呼ばれる
   /// @param player_id 送信者のローカルID
   /// @param event_code イベントコード
   /// @param reader 受信したデータ
   virtual void on_event_received(LocalPlayerID player_id, uint8 event_code, Deserializer<MemoryViewReader>& reader) = 0;
+  /// @brief 確定した状態の手数とハッシュ（同じ手数なら全クライアントで一致するはず）
+  /// @remark 毎フレーム呼ばれるので、操作ごとに差分で更新した値を返す
+  virtual StateHash get_state_hash(void) const = 0;
   /// @brief ゲームが開始されているか 
   virtual bool is_started(void) const = 0;
   /// @brief ゲームが終了状態か 
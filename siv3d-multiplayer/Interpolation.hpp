@@ -0,0 +1,118 @@
+﻿# pragma once
+# include <Siv3D.hpp>
+# include "ServerTime.hpp"
+
+// 低頻度で届く連続的な状態（カーソル位置や移動中の駒など）を、サーバー時刻基準で遅らせて補間し滑らかに描画する
+namespace Interpolation {
+
+  /// @brief a から b へ t で補間する（t > 1 は外挿）
+  /// @remark lerp を持つ型（Vec2, ColorF など）と算術型は線形に、それ以外は t < 1 の間 a を返す
+  template<class T>
+  T blend(const T& a, const T& b, const double t) {
+    if constexpr (requires { { a.lerp(b, t) } -> std::convertible_to<T>; }) return a.lerp(b, t);
+    else if constexpr (std::is_arithmetic_v<T>) return static_cast<T>(a + (b - a) * t);
+    else return (t < 1.0) ? a : b;
+  }
+
+  /// @brief 送信時刻付きの状態（送る側は get_server_time() を付けて送る）
+  template<class T>
+  struct StateMessage {
+    int32 server_time = 0;
+    T value{};
+    template<class Archive>
+    void SIV3D_SERIALIZE(Archive& archive) {
+      archive(server_time, value);
+    }
+  };
+
+  /// @brief 受信した状態をサーバー時刻順に保持し、描画時刻の値を補間して返す
+  template<class T>
+  class SnapshotBuffer {
+  public:
+    struct Stats {
+      uint64 interpolated = 0; // 前後の状態の間を補間した回数
+      uint64 extrapolated = 0; // 最新の状態より先を推測した回数
+      uint64 held = 0; // 外挿の上限で止めた回数（状態が1つしかなく最新の状態に留めた回数を含む）
+      uint64 dropped_late = 0; // 保持範囲より古くて捨てた状態
+    };
+    /// @param render_delay 描画をサーバー時刻からどれだけ遅らせるか（送信間隔の 1.5 ~ 2 倍程度）
+    /// @param max_extrapolation 状態が途切れたとき、最新の状態からどこまで先を推測するか（それより先はその位置に留める）
+    /// @param capacity 保持する状態の数
+    explicit SnapshotBuffer(const Duration render_delay = 0.1s, const Duration max_extrapolation = 0.25s, const size_t capacity = 32)
+      : render_delay_ms_(static_cast<int32>(render_delay.count() * 1000)),
+        max_extrapolation_ms_(static_cast<int32>(max_extrapolation.count() * 1000)),
+        capacity_(Max<size_t>(capacity, 2)) {
+      samples_.reserve(capacity_);
+    }
+    /// @brief 状態を追加する（順不同で届いてもサーバー時刻順に並べる）
+    void push(const int32 server_time, const T& value);
+    void push(const StateMessage<T>& message) { push(message.server_time, message.value); }
+    /// @brief 現在のサーバー時刻に対する描画用の値（まだ何も届いていなければ none）
+    Optional<T> sample(int32 server_time) const;
+    void clear(void) { samples_.clear(); }
+    bool is_empty(void) const { return samples_.isEmpty(); }
+    void set_render_delay(const Duration render_delay) { render_delay_ms_ = static_cast<int32>(render_delay.count() * 1000); }
+    void set_max_extrapolation(const Duration max_extrapolation) { max_extrapolation_ms_ = static_cast<int32>(max_extrapolation.count() * 1000); }
+    const Stats& get_stats(void) const { return stats_; }
+  private:
+    struct Sample {
+      int32 server_time;
+      T value;
+    };
+    Array<Sample> samples_; // サーバー時刻の昇順
+    int32 render_delay_ms_;
+    int32 max_extrapolation_ms_;
+    size_t capacity_;
+    mutable Stats stats_;
+  };
+
+  template<class T>
+  inline void SnapshotBuffer<T>::push(const int32 server_time, const T& value) {
+    // 後ろから挿入位置を探す（ほとんどの場合は末尾）
+    size_t index = samples_.size();
+    while (index > 0 and ServerTime::diff_ms(samples_[index - 1].server_time, server_time) > 0) --index;
+    if (index > 0 and samples_[index - 1].server_time == server_time) {
+      samples_[index - 1].value = value;
+      return;
+    }
+    if (samples_.size() >= capacity_) {
+      if (index == 0) {
+        ++stats_.dropped_late;
+        return;
+      }
+      samples_.pop_front();
+      --index;
+    }
+    samples_.insert(samples_.begin() + index, Sample{ server_time, value });
+  }
+
+  template<class T>
+  inline Optional<T> SnapshotBuffer<T>::sample(const int32 server_time) const {
+    if (samples_.isEmpty()) return none;
+    const int32 render_time = static_cast<int32>(static_cast<uint32>(server_time) - static_cast<uint32>(render_delay_ms_));
+    // 最古の状態より前なら最古の状態を使う
+    if (ServerTime::diff_ms(render_time, samples_.front().server_time) <= 0) return samples_.front().value;
+    // 描画時刻をはさむ2つの状態の間を補間する
+    for (size_t i = 1; i < samples_.size(); ++i) {
+      const Sample& to = samples_[i];
+      if (ServerTime::diff_ms(render_time, to.server_time) > 0) continue;
+      const Sample& from = samples_[i - 1];
+      const double t = static_cast<double>(ServerTime::diff_ms(render_time, from.server_time)) / ServerTime::diff_ms(to.server_time, from.server_time);
+      ++stats_.interpolated;
+      return blend(from.value, to.value, t);
+    }
+    // 状態が途切れた場合は、直近2つの変化が続くと推測する（デッドレコニング）
+    const Sample& last = samples_.back();
+    if (samples_.size() < 2) {
+      ++stats_.held;
+      return last.value;
+    }
+    // 上限を超えたら最新の状態に戻さず、上限まで推測した位置に留める（戻すと描画が跳ねる）
+    const int32 ahead_ms = Min(ServerTime::diff_ms(render_time, last.server_time), max_extrapolation_ms_);
+    if (ahead_ms == max_extrapolation_ms_) ++stats_.held;
+    else ++stats_.extrapolated;
+    const Sample& previous = samples_[samples_.size() - 2];
+    const int32 span_ms = ServerTime::diff_ms(last.server_time, previous.server_time);
+    return blend(previous.value, last.value, 1.0 + static_cast<double>(ahead_ms) / span_ms);
+  }
+}
@@ -0,0 +1,126 @@
+﻿# pragma once
+# include <Siv3D.hpp>
+# include "OnlineManager.hpp"
+# include "LocalRelay.hpp"
+# include "Headless.hpp"
+# if SIV3D_PLATFORM(WINDOWS)
+#   include <Siv3D/Windows/Windows.hpp>
+#   include <Psapi.h>
+# elif SIV3D_PLATFORM(LINUX)
+#   include <unistd.h>
+# endif
+
+// 1プロセス内で多数のクライアントを LocalRelay 経由で対戦させる負荷試験
+namespace LoadTest {
+
+  /// @brief 負荷試験の結果
+  struct Report {
+    size_t clients = 0;
+    Duration elapsed{ 0 };
+    size_t matches = 0; // 終了した対戦数
+    double matches_per_sec = 0.0;
+    uint64 events = 0; // 配送したイベント数
+    double events_per_sec = 0.0;
+    double bytes_per_sec = 0.0;
+    double delivery_p50_us = 0.0; // 送信から受信コールバックまで
+    double delivery_p99_us = 0.0;
+    double apply_p50_us = 0.0; // 受信コールバックからゲームへの適用完了まで
+    double apply_p99_us = 0.0;
+    int64 memory_per_client = 0; // クライアント1つあたりの増加メモリ（計測できない環境では 0）
+    String format(void) const {
+      return U"clients: {}, elapsed: {:.1f} s\n"
+        U"matches: {} ({:.1f} matches/s)\n"
+        U"events: {} ({:.0f} events/s, {:.0f} B/s)\n"
+        U"delivery latency: p50 {:.1f} us, p99 {:.1f} us\n"
+        U"apply latency: p50 {:.1f} us, p99 {:.1f} us\n"
+        U"memory per client: {} bytes"_fmt(
+          clients, elapsed.count(), matches, matches_per_sec, events, events_per_sec, bytes_per_sec,
+          delivery_p50_us, delivery_p99_us, apply_p50_us, apply_p99_us, memory_per_client);
+    }
+  };
+
+  /// @brief サンプルの p パーセンタイル (0.0 ~ 1.0)
+  inline double percentile(Array<double> samples, const double p) {
+    if (samples.isEmpty()) return 0.0;
+    const size_t index = Min(static_cast<size_t>(p * samples.size()), samples.size() - 1);
+    std::nth_element(samples.begin(), samples.begin() + index, samples.end());
+    return samples[index];
+  }
+
+  /// @brief プロセスの常駐メモリ量（バイト）を返す（取得できない環境では 0）
+  inline int64 get_process_memory_bytes(void) {
+# if SIV3D_PLATFORM(WINDOWS)
+    PROCESS_MEMORY_COUNTERS counters{};
+    if (::K32GetProcessMemoryInfo(::GetCurrentProcess(), &counters, sizeof(counters))) {
+      return static_cast<int64>(counters.WorkingSetSize);
+    }
+    return 0;
+# elif SIV3D_PLATFORM(LINUX)
+    TextReader reader{ U"/proc/self/statm" };
+    String line;
+    if (not reader or not reader.readLine(line)) return 0;
+    const Array<String> fields = line.split(U' ');
+    if (fields.size() < 2) return 0;
+    return ParseOr<int64>(fields[1], 0) * ::sysconf(_SC_PAGESIZE);
+# else
+    return 0;
+# endif
+  }
+
+  /// @brief N 個のボットクライアントを LocalRelay 上で対戦させ続ける
+  class Harness {
+  private:
+    LocalRelay relay_; // マネージャより先に宣言して最後に破棄する
+    Array<std::unique_ptr<OnlineManager>> managers_;
+    Array<std::unique_ptr<Headless::BotClient>> bots_;
+    uint8 players_per_match_ = 2;
+    int64 memory_per_client_ = 0;
+  public:
+    /// @param factory ボットが使うゲームのファクトリ
+    Harness(const size_t clients, const std::function<std::unique_ptr<IGame>()>& factory) {
+      players_per_match_ = Max<uint8>(factory()->get_max_players(), 1);
+      const int64 memory_before = get_process_memory_bytes();
+      managers_.reserve(clients);
+      bots_.reserve(clients);
+      for (size_t i = 0; i < clients; ++i) {
+        auto& manager = managers_.emplace_back(std::make_unique<OnlineManager>());
+        manager->connect_local(relay_, U"bot-{}"_fmt(i));
+        bots_.push_back(std::make_unique<Headless::BotClient>(*manager, factory, 0s));
+      }
+      // 全員がルームに入ってゲームを持った状態で計測する
+      for (int32 i = 0; i < 3; ++i) update();
+      if (clients > 0) memory_per_client_ = (get_process_memory_bytes() - memory_before) / static_cast<int64>(clients);
+    }
+    /// @brief 全クライアントを1回ずつ更新する
+    void update(void) {
+      for (auto& bot : bots_) bot->update();
+    }
+    /// @brief duration の間更新し続けて結果を返す
+    Report run(const Duration duration) {
+      relay_.clear_stats();
+      size_t finished_before = 0;
+      for (const auto& bot : bots_) finished_before += bot->get_finished_matches();
+      const Stopwatch stopwatch{ StartImmediately::Yes };
+      while (stopwatch.elapsed() < duration) update();
+      Report report;
+      report.clients = bots_.size();
+      report.elapsed = stopwatch.elapsed();
+      size_t finished = 0;
+      for (const auto& bot : bots_) finished += bot->get_finished_matches();
+      // 1つの対戦は参加者全員が終了として数える
+      report.matches = (finished - finished_before) / players_per_match_;
+      const LocalRelay::Stats& stats = relay_.get_stats();
+      const double seconds = Max(report.elapsed.count(), 1e-9);
+      report.matches_per_sec = report.matches / seconds;
+      report.events = stats.delivered_events;
+      report.events_per_sec = stats.delivered_events / seconds;
+      report.bytes_per_sec = stats.delivered_bytes / seconds;
+      report.delivery_p50_us = percentile(stats.delivery_latencies_us, 0.50);
+      report.delivery_p99_us = percentile(stats.delivery_latencies_us, 0.99);
+      report.apply_p50_us = percentile(stats.apply_latencies_us, 0.50);
+      report.apply_p99_us = percentile(stats.apply_latencies_us, 0.99);
+      report.memory_per_client = memory_per_client_;
+      return report;
+    }
+  };
+}
@@ -0,0 +1,312 @@
+﻿# pragma once
+# include <Siv3D.hpp>
+# include "Multiplayer_Photon.hpp"
+
+/// @brief Photon サーバーの代わりにプロセス内でルームとイベント配送を模倣するバックエンド
+/// @remark 負荷試験やテスト用。ルームの状態はその場で更新し、コールバックは Photon と同様に各クライアントの service() 中に呼ぶ
+class LocalRelay {
+public:
+  using ClientID = size_t;
+  struct Stats {
+    uint64 delivered_events = 0; // 配送したカスタムイベント数
+    uint64 delivered_bytes = 0; // 配送したペイロードのバイト数
+    Array<double> delivery_latencies_us; // 送信から受信コールバック開始までの時間（標本）
+    Array<double> apply_latencies_us; // 受信コールバック開始からゲームへの適用完了までの時間（標本）
+  };
+  /// @brief 遅延の標本の最大数（超えたら reservoir sampling で置き換える）
+  static constexpr size_t max_latency_samples = 100000;
+private:
+  enum class NoticeKind : uint8 {
+    CreateReturn,
+    JoinReturn,
+    JoinEvent,
+    LeaveEvent,
+    HostChanged,
+    LeaveReturn,
+    CustomEvent,
+  };
+  struct Notice {
+    NoticeKind kind;
+    LocalPlayerID player_id = 0;
+    LocalPlayerID old_host_id = 0; // HostChanged のときの以前のホスト
+    int32 error_code = 0;
+    uint8 event_code = 0;
+    Array<uint8> payload;
+    int64 sent_at_us = 0;
+  };
+  struct Client {
+    Multiplayer_Photon* endpoint = nullptr;
+    String user_name;
+    String lobby; // いるロビー（空なら既定のロビー）
+    Optional<String> room; // 参加中のルーム名
+    LocalPlayerID local_id = -1;
+    HashSet<uint8> groups; // 購読しているインタレストグループ
+    Array<Notice> notices; // 次の service() で通知するコールバック
+  };
+  struct Room {
+    String lobby; // 作成したロビー
+    uint8 max_players = 0;
+    bool is_open = true;
+    bool is_visible = true;
+    LocalPlayerID next_id = 1;
+    Array<ClientID> members; // 参加順
+  };
+  Array<Client> clients_;
+  HashTable<String, Room> rooms_;
+  Stopwatch clock_{ StartImmediately::Yes };
+  Stats stats_;
+  Array<Notice> servicing_; // service() 中に処理している通知（容量を使い回す）
+  Array<Array<uint8>> free_payloads_; // 配送済みのペイロードのバッファ（使い回す）
+  Room* get_room_(const ClientID client) {
+    const Optional<String>& name = clients_[client].room;
+    if (not name) return nullptr;
+    auto it = rooms_.find(*name);
+    return (it == rooms_.end()) ? nullptr : &it->second;
+  }
+  const Room* get_room_(const ClientID client) const {
+    return const_cast<LocalRelay*>(this)->get_room_(client);
+  }
+  LocalPlayer make_player_(const Room& room, const ClientID member) const {
+    const Client& c = clients_[member];
+    return LocalPlayer{ .localID = c.local_id, .userName = c.user_name, .userID = c.user_name,
+      .isHost = (member == room.members.front()), .isActive = true };
+  }
+  void enter_room_(const ClientID client, const String& room_name, const NoticeKind result_kind);
+  void deliver_(ClientID member, ClientID sender, uint8 event_code, const Blob& payload, int64 now);
+  void add_latency_sample_(const double delivery_us, const double apply_us) {
+    if (stats_.delivery_latencies_us.size() < max_latency_samples) {
+      stats_.delivery_latencies_us << delivery_us;
+      stats_.apply_latencies_us << apply_us;
+      return;
+    }
+    const uint64 index = Random<uint64>(0, stats_.delivered_events - 1);
+    if (index < max_latency_samples) {
+      stats_.delivery_latencies_us[index] = delivery_us;
+      stats_.apply_latencies_us[index] = apply_us;
+    }
+  }
+public:
+  /// @brief クライアントを接続する（接続後はロビーにいる状態になる）
+  ClientID connect(Multiplayer_Photon& endpoint, const StringView user_name) {
+    clients_.push_back(Client{ .endpoint = &endpoint, .user_name = String{ user_name } });
+    return clients_.size() - 1;
+  }
+  void disconnect(const ClientID client) {
+    leave_room(client);
+    clients_[client].notices.clear();
+    clients_[client].endpoint = nullptr;
+  }
+  bool is_connected(const ClientID client) const {
+    return clients_[client].endpoint != nullptr;
+  }
+  bool is_in_room(const ClientID client) const {
+    return get_room_(client) != nullptr;
+  }
+  bool is_in_lobby(const ClientID client) const {
+    return is_connected(client) and not clients_[client].room;
+  }
+  bool is_host(const ClientID client) const {
+    const Room* room = get_room_(client);
+    return room and room->members.front() == client;
+  }
+  /// @brief 参加中のルーム名（ルームにいなければ空）
+  String get_room_name(const ClientID client) const {
+    return clients_[client].room.value_or(String{});
+  }
+  LocalPlayerID get_local_player_id(const ClientID client) const {
+    return is_in_room(client) ? clients_[client].local_id : -1;
+  }
+  const String& get_user_name(const ClientID client) const {
+    return clients_[client].user_name;
+  }
+  Array<LocalPlayer> get_local_players(const ClientID client) const {
+    Array<LocalPlayer> players;
+    if (const Room* room = get_room_(client)) {
+      for (const ClientID member : room->members) players << make_player_(*room, member);
+    }
+    return players;
+  }
+  /// @brief ロビーを移る（以降のルーム一覧・作成はこのロビーが対象）
+  void join_lobby(const ClientID client, const StringView lobby_name) {
+    clients_[client].lobby = String{ lobby_name };
+  }
+  /// @brief client のいるロビーに見えるルーム名の一覧（満員・締め切り済みのルームは含めない）
+  Array<RoomName> get_room_names(const ClientID client) const {
+    Array<RoomName> names;
+    const String& lobby = clients_[client].lobby;
+    for (const auto& [name, room] : rooms_) {
+      if (room.lobby == lobby and room.is_visible and room.is_open and room.members.size() < room.max_players) names << name;
+    }
+    return names;
+  }
+  void set_room_open(const ClientID client, const bool is_open) {
+    if (Room* room = get_room_(client)) room->is_open = is_open;
+  }
+  void set_room_visible(const ClientID client, const bool is_visible) {
+    if (Room* room = get_room_(client)) room->is_visible = is_visible;
+  }
+  /// @brief 中継サーバーの時刻（ミリ秒）
+  int32 get_server_time(void) const {
+    return static_cast<int32>(clock_.ms());
+  }
+  void create_room(ClientID client, const StringView room_name, uint8 max_players);
+  void join_room(ClientID client, const StringView room_name);
+  void leave_room(ClientID client);
+  /// @brief ルーム内の他のプレイヤー（targets 指定時はそのプレイヤー）にイベントを送る
+  void send(ClientID client, uint8 event_code, const Blob& payload, const Optional<Array<LocalPlayerID>>& targets);
+  /// @brief ルーム内でインタレストグループ group を購読しているクライアントにイベントを送る
+  void send_to_group(ClientID client, uint8 event_code, const Blob& payload, uint8 group);
+  /// @brief 購読するインタレストグループを変更する
+  void change_groups(const ClientID client, const Array<uint8>& remove, const Array<uint8>& add) {
+    HashSet<uint8>& groups = clients_[client].groups;
+    for (const uint8 group : remove) groups.erase(group);
+    for (const uint8 group : add) groups.insert(group);
+  }
+  /// @brief client 宛てのコールバックを呼び出す（Multiplayer_Photon::update() 相当）
+  void service(ClientID client);
+  const Stats& get_stats(void) const { return stats_; }
+  void clear_stats(void) { stats_ = {}; }
+};
+
+inline void LocalRelay::enter_room_(const ClientID client, const String& room_name, const NoticeKind result_kind) {
+  Room& room = rooms_[room_name];
+  Client& self = clients_[client];
+  self.room = room_name;
+  self.local_id = room.next_id++;
+  room.members << client;
+  self.notices << Notice{ .kind = result_kind, .player_id = self.local_id };
+  // 参加者全員（自分を含む）に参加イベントを通知する
+  for (const ClientID member : room.members) {
+    clients_[member].notices << Notice{ .kind = NoticeKind::JoinEvent, .player_id = self.local_id };
+  }
+}
+
+inline void LocalRelay::create_room(const ClientID client, const StringView room_name, const uint8 max_players) {
+  if (not is_in_lobby(client)) return;
+  const String name{ room_name };
+  if (rooms_.contains(name) or max_players == 0) {
+    clients_[client].notices << Notice{ .kind = NoticeKind::CreateReturn, .error_code = 1 };
+    return;
+  }
+  Room& room = rooms_[name];
+  room.lobby = clients_[client].lobby;
+  room.max_players = max_players;
+  enter_room_(client, name, NoticeKind::CreateReturn);
+}
+
+inline void LocalRelay::join_room(const ClientID client, const StringView room_name) {
+  if (not is_in_lobby(client)) return;
+  const String name{ room_name };
+  auto it = rooms_.find(name);
+  if (it == rooms_.end() or not it->second.is_open or it->second.members.size() >= it->second.max_players) {
+    clients_[client].notices << Notice{ .kind = NoticeKind::JoinReturn, .error_code = 1 };
+    return;
+  }
+  enter_room_(client, name, NoticeKind::JoinReturn);
+}
+
+inline void LocalRelay::leave_room(const ClientID client) {
+  Room* room = get_room_(client);
+  if (not room) return;
+  Client& self = clients_[client];
+  const bool was_host = (room->members.front() == client);
+  room->members.remove(client);
+  for (const ClientID member : room->members) {
+    clients_[member].notices << Notice{ .kind = NoticeKind::LeaveEvent, .player_id = self.local_id };
+    // Photon と同様に、ホストが抜けたら最も古い参加者がホストになる
+    if (was_host) {
+      clients_[member].notices << Notice{ .kind = NoticeKind::HostChanged,
+        .player_id = clients_[room->members.front()].local_id, .old_host_id = self.local_id };
+    }
+  }
+  if (room->members.isEmpty()) rooms_.erase(*self.room);
+  self.room.reset();
+  self.local_id = -1;
+  self.groups.clear();
+  // 退出前に届いていたイベントは捨てる
+  self.notices.remove_if([](const Notice& notice) { return notice.kind == NoticeKind::CustomEvent; });
+  self.notices << Notice{ .kind = NoticeKind::LeaveReturn };
+}
+
+inline void LocalRelay::send(const ClientID client, const uint8 event_code, const Blob& payload, const Optional<Array<LocalPlayerID>>& targets) {
+  const Room* room = get_room_(client);
+  if (not room) return;
+  const int64 now = clock_.us64();
+  for (const ClientID member : room->members) {
+    if (member == client and not targets) continue;
+    if (targets and not targets->contains(clients_[member].local_id)) continue;
+    deliver_(member, client, event_code, payload, now);
+  }
+}
+
+inline void LocalRelay::send_to_group(const ClientID client, const uint8 event_code, const Blob& payload, const uint8 group) {
+  const Room* room = get_room_(client);
+  if (not room) return;
+  const int64 now = clock_.us64();
+  for (const ClientID member : room->members) {
+    if (member != client and clients_[member].groups.contains(group)) deliver_(member, client, event_code, payload, now);
+  }
+}
+
+inline void LocalRelay::deliver_(const ClientID member, const ClientID sender, const uint8 event_code, const Blob& payload, const int64 now) {
+  const uint8* data = reinterpret_cast<const uint8*>(payload.data());
+  Array<uint8> buffer;
+  if (not free_payloads_.isEmpty()) {
+    buffer = std::move(free_payloads_.back());
+    free_payloads_.pop_back();
+  }
+  buffer.assign(data, data + payload.size());
+  clients_[member].notices << Notice{ .kind = NoticeKind::CustomEvent, .player_id = clients_[sender].local_id,
+    .event_code = event_code, .payload = std::move(buffer), .sent_at_us = now };
+}
+
+inline void LocalRelay::service(const ClientID client) {
+  Client& self = clients_[client];
+  if (not self.endpoint) return;
+  // コールバック中に新しい通知が積まれても次の service() まで持ち越す
+  servicing_.clear();
+  std::swap(servicing_, self.notices);
+  for (Notice& notice : servicing_) {
+    Multiplayer_Photon& endpoint = *clients_[client].endpoint;
+    switch (notice.kind) {
+    case NoticeKind::CreateReturn:
+      endpoint.createRoomReturn(notice.player_id, notice.error_code, notice.error_code ? U"room exists" : U"");
+      break;
+    case NoticeKind::JoinReturn:
+      endpoint.joinRoomReturn(notice.player_id, notice.error_code, notice.error_code ? U"room unavailable" : U"");
+      break;
+    case NoticeKind::JoinEvent: {
+      const Room* room = get_room_(client);
+      if (not room) break;
+      Array<LocalPlayerID> ids;
+      LocalPlayer new_player;
+      for (const ClientID member : room->members) {
+        ids << clients_[member].local_id;
+        if (clients_[member].local_id == notice.player_id) new_player = make_player_(*room, member);
+      }
+      endpoint.joinRoomEventAction(new_player, ids, notice.player_id == clients_[client].local_id);
+      break;
+    }
+    case NoticeKind::LeaveEvent:
+      endpoint.leaveRoomEventAction(notice.player_id, false);
+      break;
+    case NoticeKind::HostChanged:
+      endpoint.hostChangedEventAction(notice.player_id, notice.old_host_id);
+      break;
+    case NoticeKind::LeaveReturn:
+      endpoint.leaveRoomReturn(0, U"");
+      break;
+    case NoticeKind::CustomEvent: {
+      const int64 received_at = clock_.us64();
+      Deserializer<MemoryViewReader> reader{ notice.payload.data(), notice.payload.size() };
+      endpoint.customEventAction(notice.player_id, notice.event_code, reader);
+      const int64 applied_at = clock_.us64();
+      ++stats_.delivered_events;
+      stats_.delivered_bytes += notice.payload.size();
+      add_latency_sample_(static_cast<double>(received_at - notice.sent_at_us), static_cast<double>(applied_at - received_at));
+      free_payloads_.push_back(std::move(notice.payload));
+      break;
+    }
+    }
+  }
+}
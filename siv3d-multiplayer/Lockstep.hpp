@@ -0,0 +1,179 @@
+﻿# pragma once
+# include <Siv3D.hpp>
+# include "IGame.hpp"
+# include "OnlineManager.hpp"
+
+// 入力だけを送り合い、全員の入力がそろったティックから決定的に進めるロックステップ方式
+namespace Lockstep {
+
+  /// @brief ティック番号付きの入力（ReservedEventCode::lockstep_input で送る）
+  template<class Input>
+  struct InputMessage {
+    uint32 tick = 0;
+    Input input{};
+    template<class Archive>
+    void SIV3D_SERIALIZE(Archive& archive) {
+      archive(tick, input);
+    }
+  };
+
+  /// @brief 1ティック分のあるプレイヤーの入力
+  template<class Input>
+  struct PlayerInput {
+    LocalPlayerID player_id;
+    Input input;
+  };
+
+  struct Stats {
+    uint32 tick = 0; // 次に進めるティック
+    uint64 sent_inputs = 0; // 送信した入力数
+    uint64 received_inputs = 0; // 受信した入力数
+    uint64 stalled_ticks = 0; // 入力がそろわず進められなかった回数
+    Duration stalled_time{ 0 }; // 入力待ちで止まっていた時間
+  };
+
+  /// @brief ロックステップで進める IGame の基底クラス
+  /// @tparam Input 1ティック分の入力（既定構築可能で SIV3D_SERIALIZE を持つ）
+  /// @remark simulate() は同じ入力列に対して全クライアントで同じ結果になるよう、乱数や実時間に依存させない
+  template<class Input>
+  class Game : public IGame {
+  private:
+    Duration tick_duration_;
+    uint32 input_delay_; // 入力を何ティック先に適用するか
+    static constexpr int32 max_catch_up_ticks = 4; // 入力待ちから復帰したときに1回の更新で進める最大ティック数
+    HashTable<uint32, HashTable<LocalPlayerID, Input>> pending_; // ティックごとに届いている入力
+    Array<LocalPlayerID> players_; // 入力を待つプレイヤー（ローカルID順）
+    LocalPlayerID self_id_ = 0;
+    uint32 tick_ = 0; // 次に進めるティック
+    uint32 next_input_tick_ = 0; // 次にローカル入力を割り当てるティック
+    double accumulator_ = 0.0;
+    bool is_started_ = false;
+    Stats stats_;
+    void send_input_(void);
+    bool can_step_(void) const;
+    void step_(void);
+  protected:
+    OnlineManager* network_ = nullptr;
+    /// @brief このティックのローカル入力を返す
+    virtual Input sample_input(void) = 0;
+    /// @brief 全プレイヤーの入力（ローカルID順）でシミュレーションを1ティック進める
+    virtual void simulate(const Array<PlayerInput<Input>>& inputs) = 0;
+    /// @brief シミュレーションの初期状態を作る
+    virtual void on_simulation_start(const Array<LocalPlayerID>& players, bool is_host) = 0;
+  public:
+    /// @param tick_duration 1ティックの長さ
+    /// @param input_delay 入力を適用するまでのティック数（往復の遅延を隠す）
+    explicit Game(const Duration tick_duration = SecondsF{ 1.0 / 30 }, const uint32 input_delay = 3)
+      : tick_duration_(tick_duration), input_delay_(input_delay) {}
+    void set_network(OnlineManager* network) override { network_ = network; }
+    bool is_started(void) const override { return is_started_; }
+    bool is_turn(void) const override { return is_started_; }
+    void update(void) override {}
+    void tick(const double dt) override { advance(dt); }
+    /// @brief 経過時間 dt の分だけティックを進める（ヘッドレス実行では任意の dt で呼ぶ）
+    void advance(double dt);
+    /// @brief 入力遅延を設定する（全員で同じ値にし、ゲーム開始前に呼ぶ）
+    void set_input_delay(const uint32 input_delay) {
+      if (not is_started_) input_delay_ = input_delay;
+    }
+    uint32 get_input_delay(void) const { return input_delay_; }
+    const Duration& get_tick_duration(void) const { return tick_duration_; }
+    const Stats& get_stats(void) const { return stats_; }
+    void on_game_start(const Array<LocalPlayer>& players, bool is_host) override;
+    void on_player_left(LocalPlayerID player_id) override;
+    void on_leave_room(void) override;
+    void on_host_changed([[maybe_unused]] bool is_host) override {}
+    void on_event_received(LocalPlayerID player_id, uint8 event_code, Deserializer<MemoryViewReader>& reader) override;
+  };
+
+  template<class Input>
+  inline void Game<Input>::on_game_start(const Array<LocalPlayer>& players, const bool is_host) {
+    players_.clear();
+    for (const LocalPlayer& player : players) players_ << player.localID;
+    players_.sort();
+    self_id_ = network_ ? network_->get_local_player_id() : (players_.isEmpty() ? 0 : players_.front());
+    if (players_.isEmpty()) players_ << self_id_;
+    pending_.clear();
+    tick_ = 0;
+    accumulator_ = 0.0;
+    stats_ = {};
+    // 入力遅延の間のティックは全員の既定入力で埋める
+    for (uint32 tick = 0; tick < input_delay_; ++tick) {
+      for (const LocalPlayerID id : players_) pending_[tick][id] = Input{};
+    }
+    next_input_tick_ = input_delay_;
+    is_started_ = true;
+    on_simulation_start(players_, is_host);
+  }
+
+  template<class Input>
+  inline void Game<Input>::on_player_left(const LocalPlayerID player_id) {
+    // 抜けたプレイヤーの入力は待たない
+    players_.remove(player_id);
+  }
+
+  template<class Input>
+  inline void Game<Input>::on_leave_room(void) {
+    is_started_ = false;
+    pending_.clear();
+    players_.clear();
+  }
+
+  template<class Input>
+  inline void Game<Input>::on_event_received(const LocalPlayerID player_id, const uint8 event_code, Deserializer<MemoryViewReader>& reader) {
+    if (event_code != ReservedEventCode::lockstep_input) return;
+    InputMessage<Input> message;
+    reader(message);
+    // 既に進めたティックの入力は捨てる
+    if (message.tick < tick_) return;
+    pending_[message.tick][player_id] = message.input;
+    ++stats_.received_inputs;
+  }
+
+  template<class Input>
+  inline void Game<Input>::send_input_(void) {
+    const InputMessage<Input> message{ next_input_tick_, sample_input() };
+    pending_[message.tick][self_id_] = message.input;
+    // 入力は欠けると全員が止まるので、予算超過でも捨てない優先度で送信キューに積む
+    if (network_) network_->queue_game_event(ReservedEventCode::lockstep_input, message, EventPriority::Critical);
+    ++stats_.sent_inputs;
+    ++next_input_tick_;
+  }
+
+  template<class Input>
+  inline bool Game<Input>::can_step_(void) const {
+    const auto it = pending_.find(tick_);
+    if (it == pending_.end()) return false;
+    return players_.all([&](const LocalPlayerID id) { return it->second.contains(id); });
+  }
+
+  template<class Input>
+  inline void Game<Input>::step_(void) {
+    auto it = pending_.find(tick_);
+    Array<PlayerInput<Input>> inputs(Arg::reserve = players_.size());
+    for (const LocalPlayerID id : players_) inputs.push_back({ id, it->second.at(id) });
+    pending_.erase(it);
+    simulate(inputs);
+    ++tick_;
+    stats_.tick = tick_;
+  }
+
+  template<class Input>
+  inline void Game<Input>::advance(const double dt) {
+    if (not is_started_) return;
+    const double tick_seconds = tick_duration_.count();
+    accumulator_ = Min(accumulator_ + dt, tick_seconds * max_catch_up_ticks);
+    while (accumulator_ >= tick_seconds) {
+      // ローカル入力は input_delay 先のティックまでしか先行させない
+      // ネットワークから切り離されている（記録を再生している）間は、記録された自分の入力で進める
+      if (network_ and next_input_tick_ <= tick_ + input_delay_) send_input_();
+      if (not can_step_()) {
+        ++stats_.stalled_ticks;
+        stats_.stalled_time += Duration{ dt };
+        return;
+      }
+      step_();
+      accumulator_ -= tick_seconds;
+    }
+  }
+}
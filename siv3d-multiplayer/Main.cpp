@@ -4,40 +4,58 @@
 # include "SushiGUI.hpp"
 # include "TicTacToe.hpp"
 # include "DotsAndBoxes.hpp"
+# include "DotsAndBoxesAI.hpp"
+# include "GameRegistry.hpp"
+# include "Headless.hpp"
+# include "LoadTest.hpp"
+# include "Benchmark.hpp"
+# include "FixedTimestep.hpp"
+# include "FontCache.hpp"
+# include "SelfTest.hpp"
 
-const std::string secretAppID{ SIV3D_OBFUSCATE(PHOTON_APP_ID) };
+// MULTIPLAYER_HEADLESS を定義してビルドすると、ウィンドウを開かずにゲームロジックだけを動かす
+# if defined(MULTIPLAYER_HEADLESS)
+SIV3D_SET(EngineOption::Renderer::Headless)
+# endif
 
-// インスタンス生成のファクトリ型定義
-using GameFactory = std::function<std::unique_ptr<IGame>()>;
+// MULTIPLAYER_BENCHMARK を定義してビルドすると、ヒープ確保回数を数えてベンチマークに使う
+# if defined(MULTIPLAYER_BENCHMARK)
+void* operator new(const std::size_t size) {
+  Benchmark::count_allocation();
+  if (void* p = std::malloc(size ? size : 1)) return p;
+  throw std::bad_alloc{};
+}
+void operator delete(void* p) noexcept {
+  std::free(p);
+}
+void operator delete(void* p, std::size_t) noexcept {
+  std::free(p);
+}
+# endif
 
-struct GameInfo {
-  GameFactory factory;
-  uint8 max_players;
-};
+const std::string secretAppID{ SIV3D_OBFUSCATE(PHOTON_APP_ID) };
 
 struct GameData {
   // チュートリアルに沿った新しいコンストラクタでインスタンスを生成
   OnlineManager online_manager{ secretAppID, U"1.0", Verbose::Yes };
   // ゲームロジックのインスタンスを保持するポインタ
   std::unique_ptr<IGame> current_game = nullptr;
-  // 利用するゲームIDと、そのインスタンスを生成するファクトリの対応
-  HashTable<String, GameInfo> game_infos;
   // ロビーでプレイヤーが選択しているゲームID
   Optional<String> selected_game_id;
-  // コンストラクタ
+  // ロビーでプレイヤーが選択しているルール（作るルームの名前に載せる, 空ならゲームの既定）
+  String selected_rule;
+  // 通信とゲームのシミュレーションを進める一定間隔のティック
+  FixedTimestep::Scheduler tick_scheduler{ SecondsF{ 1.0 / 60 } };
+  // 「Create Room」で作るルームの観戦枠（ランダムマッチのルームには設けない）
+  static constexpr uint8 spectator_slots = 4;
   GameData() {
-    game_infos[std::make_unique<TicTacToe::Game>()->get_game_id()] = {
-      []() { return std::make_unique<TicTacToe::Game>(); },
-      std::make_unique<TicTacToe::Game>()->get_max_players()
-    };
-    game_infos[std::make_unique<DotsAndBoxes::Game>()->get_game_id()] = {
-      []() { return std::make_unique<DotsAndBoxes::Game>(); },
-      std::make_unique<DotsAndBoxes::Game>()->get_max_players()
-    };
+    online_manager.set_spectator_slots(spectator_slots);
   }
   void create_game_instance(const String& game_id) {
-    if (not game_infos.contains(game_id)) return;
-    current_game = game_infos[game_id].factory();
+    const GameRegistry::Entry* entry = GameRegistry::find(game_id);
+    if (not entry) return;
+    current_game = entry->factory();
+    if (not selected_rule.isEmpty()) current_game->set_rule(selected_rule);
     online_manager.set_game_handler(current_game.get());
     current_game->set_network(&online_manager);
   }
@@ -45,6 +63,7 @@ struct GameData {
     current_game.reset();
     online_manager.set_game_handler(nullptr);
     selected_game_id.reset();
+    selected_rule.clear();
   }
 };
 
@@ -54,12 +73,16 @@ class NetworkScene : public App::Scene {
 private:
   TextEditState user_name{ U"UserName" };
   TextEditState room_name{ U"RoomName" };
-  Font font{ FontMethod::MSDF, 32, Typeface::Bold };
-  Font font_small{ FontMethod::MSDF, 24, Typeface::Bold };
-  Font font_title{ FontMethod::MSDF, 48, Typeface::Bold };
+  // フォントはシーンを作り直しても使い回す
+  FontCache::Handle font = FontCache::shared().get(FontMethod::MSDF, 32, Typeface::Bold);
+  FontCache::Handle font_small = FontCache::shared().get(FontMethod::MSDF, 24, Typeface::Bold);
+  FontCache::Handle font_title = FontCache::shared().get(FontMethod::MSDF, 48, Typeface::Bold);
   size_t selected_game_type_idx = 0;
 public:
-  NetworkScene(const InitData& init) : IScene{ init } {}
+  NetworkScene(const InitData& init) : IScene{ init } {
+    // ロビーにいる間に各ゲームのフォントを読み込んでおき、対戦開始時に作らずに済むようにする
+    for (const GameRegistry::Entry& entry : GameRegistry::entries) entry.preload_assets();
+  }
   void update() override {
     auto& manager = getData().online_manager;
     auto& game_data = getData();
@@ -73,12 +96,10 @@ public:
     if (manager.isInRoom() and not game_data.current_game) {
       const RoomName current_room_name = manager.getCurrentRoomName();
       if (const Optional<String> game_id = RoomNameHelper::get_game_id(current_room_name)) {
-        if (game_data.game_infos.contains(*game_id)) {
-          if (manager.getPlayerCountInCurrentRoom() == game_data.game_infos[*game_id].max_players) {
+        if (const GameRegistry::Entry* entry = GameRegistry::find(*game_id)) {
+          if (manager.getPlayerCountInCurrentRoom() == entry->max_players) {
             game_data.create_game_instance(*game_id);
-            if (game_data.current_game) {
-              game_data.current_game->on_game_start(manager.getLocalPlayers(), manager.isHost());
-            }
+            manager.start_game();
           }
         }
       }
@@ -103,8 +124,8 @@ public:
       int32 game_height = 40;
       font_title(U"Select Game").drawAt(Scene::Width() * 0.25, 60);
       Vec2 game_select_pos{ Scene::Width() * 0.25, 60 + game_height };
-      for (const auto& pair : game_data.game_infos) {
-        const String& game_id = pair.first;
+      for (const GameRegistry::Entry& entry : GameRegistry::entries) {
+        const String game_id{ entry.game_id };
         const RectF region{ Arg::topCenter(game_select_pos), { Scene::CenterF().x * 0.80, game_height } };
         if (game_data.selected_game_id and *game_data.selected_game_id == game_id) {
           region.draw(Palette::Orange);
@@ -115,12 +136,31 @@ public:
         }
         if (region.leftClicked()) {
           game_data.selected_game_id = game_id;
+          game_data.selected_rule = entry.rules.empty() ? String{} : String{ entry.rules.front() };
+          // 選んだゲームのロビーに移り、そのゲームのルームだけを受け取る
+          manager.join_game_lobby(game_id);
         }
         region.drawFrame(2);
         font(game_id).drawAt(region.center(), Palette::Black);
         game_select_pos.y += game_height;
       }
       if (not game_data.selected_game_id) return;
+      // ルール選択（参加する側はルーム名のルールにそろえるので、作るルームとランダムマッチにだけ効く）
+      if (const GameRegistry::Entry* entry = GameRegistry::find(*game_data.selected_game_id)) {
+        game_select_pos.y += game_height / 2;
+        for (const StringView rule : entry->rules) {
+          const RectF region{ Arg::topCenter(game_select_pos), { Scene::CenterF().x * 0.60, game_height } };
+          if (StringView{ game_data.selected_rule } == rule) region.draw(Palette::Orange);
+          if (region.mouseOver()) {
+            Cursor::RequestStyle(CursorStyle::Hand);
+            region.draw(ColorF{ 0.9 });
+          }
+          if (region.leftClicked()) game_data.selected_rule = String{ rule };
+          region.drawFrame(2);
+          font_small(rule).drawAt(region.center(), Palette::Black);
+          game_select_pos.y += game_height;
+        }
+      }
       // ルーム作成
       const Vec2 lobby_action_pos{ 20, Scene::Height() - 60 };
       SimpleGUI::TextBoxAt(room_name, lobby_action_pos.movedBy(180, 0), 250);
@@ -144,12 +184,22 @@ public:
       int32 room_height = 40;
       font_title(U"Room List").drawAt(Scene::Width() * 0.75, 60);
       Vec2 room_list_pos{ Scene::Width() * 0.75, 60+room_height };
-      for (const auto& room_name : manager.getRoomNameList()) {
-        const RectF region{ Arg::topCenter(room_list_pos), { Scene::CenterF().x * 0.80, room_height } };
+      for (const auto& room_name : manager.get_room_names()) {
+        const RectF row{ Arg::topCenter(room_list_pos), { Scene::CenterF().x * 0.80, room_height } };
+        // 観戦枠のあるルームは対戦中も一覧に残るので、横に観戦ボタンを置く
+        const bool can_watch = RoomNameHelper::parse_options(room_name).spectator_slots > 0;
+        const double watch_width = can_watch ? 120 : 0;
+        const RectF region{ row.pos, row.w - watch_width, row.h };
         if (SushiGUI::button4(font_title, room_name, region)) {
           if (auto game_id = RoomNameHelper::get_game_id(room_name)) {
             game_data.create_game_instance(*game_id);
-            if (game_data.current_game) manager.joinRoom(room_name);
+            if (game_data.current_game) manager.join_game_room(room_name);
+          }
+        }
+        if (can_watch and SushiGUI::button4(font_small, U"Watch", RectF{ region.tr(), watch_width, row.h })) {
+          if (auto game_id = RoomNameHelper::get_game_id(room_name)) {
+            game_data.create_game_instance(*game_id);
+            if (game_data.current_game) manager.spectate_game_room(room_name);
           }
         }
         room_list_pos.y += room_height;
@@ -162,9 +212,11 @@ public:
 // ゲーム本体のシーン
 class GameScene : public App::Scene {
 private:
-  Font font_title{ FontMethod::MSDF, 48, Typeface::Bold };
+  FontCache::Handle font_title = FontCache::shared().get(FontMethod::MSDF, 48, Typeface::Bold);
 public:
-  GameScene(const InitData& init) : IScene{ init } {}
+  GameScene(const InitData& init) : IScene{ init } {
+    getData().tick_scheduler.reset();
+  }
   void update() override {
     auto& manager = getData().online_manager;
     auto& game = getData().current_game;
@@ -172,10 +224,14 @@ public:
       changeScene(U"NetworkScene");
       return;
     }
-    // ネットワークの状態を常に更新
-    manager.update();
-    // ゲームロジックを更新
+    // 入力は毎フレーム拾う
     game->update();
+    // 通信は届いたイベントをすぐ処理できるよう毎フレーム行う
+    manager.update();
+    // ゲームロジックはフレームレートに関係なく一定間隔で進める
+    getData().tick_scheduler.update(Scene::DeltaTime(), [&](const double dt) {
+      game->tick(dt);
+    });
     // ゲームが終了したらNetworkSceneに戻る
     if (game->is_finished()) {
       if (SushiGUI::button3(font_title, U"Back to Lobby", Arg::bottomCenter_(Scene::CenterF().withY(Scene::Size().y*0.95)), { Scene::Size().x * 0.2, Scene::Size().y * 0.1 })) {
@@ -188,12 +244,294 @@ public:
   void draw() const override {
     // ゲームの描画処理を呼び出す
     if (getData().current_game) {
-      getData().current_game->draw();
+      // ティックの間のフレームは、次のティックまでの割合で補間して描く
+      getData().current_game->draw(getData().tick_scheduler.get_alpha());
     }
   }
 };
 
 
+# if defined(MULTIPLAYER_HEADLESS)
+
+# if defined(MULTIPLAYER_BENCHMARK)
+/// @brief ゲームイベント1件あたりの直列化・復元と Photon 内部の処理を計測する
+Array<Benchmark::Result> run_event_benchmarks(void) {
+  Array<Benchmark::Result> results;
+  // 操作を直列化して復元する（send_game_event と on_event_received の往復）
+  const auto roundtrip = [](const auto& op) {
+    Serializer<MemoryWriter> writer;
+    writer(op);
+    const Blob& blob = writer->getBlob();
+    Deserializer<MemoryViewReader> reader{ blob.data(), blob.size() };
+    std::remove_cvref_t<decltype(op)> decoded;
+    reader(decoded);
+    return blob.size();
+  };
+  const TicTacToe::Operation tic_tac_toe{ Point{ 1, 2 }, TicTacToe::Cell::Circle };
+  results << Benchmark::measure(U"serialize/tictactoe_operation", [&]() { return roundtrip(tic_tac_toe); });
+  const DotsAndBoxes::Operation dots_and_boxes{ Point{ 3, 2 }, DotsAndBoxes::LineDirection::Top, DotsAndBoxes::LineColor::Red };
+  results << Benchmark::measure(U"serialize/dotsandboxes_operation", [&]() { return roundtrip(dots_and_boxes); });
+  // プールしたバッファでの直列化（定常状態では 0 allocs/op になる）
+  WriterPool pool;
+  results << Benchmark::measure(U"serialize/pooled_dotsandboxes_operation", [&]() {
+    Serializer<MemoryWriter> writer = pool.acquire();
+    writer(dots_and_boxes);
+    const size_t size = writer->getBlob().size();
+    pool.release(std::move(writer));
+    return size;
+  });
+  // 座標の量子化と直列化（B/op が送信サイズ）
+  for (const auto& [mode_name, mode] : { std::pair{ U"full"_sv, Quantize::Mode::Full },
+    std::pair{ U"fixed16"_sv, Quantize::Mode::Fixed16 }, std::pair{ U"half"_sv, Quantize::Mode::Half } }) {
+    const RectF range{ 0, 0, 1280, 720 };
+    const Vec2 pos{ 640.25, 360.75 };
+    results << Benchmark::measure(U"serialize/quantized_vec2_{}"_fmt(mode_name), [&]() {
+      return roundtrip(Quantize::QuantizedVec2{ pos, mode, range });
+    });
+  }
+  // 1手ごとの勝敗判定（置いたセルを通る4本の線だけを見るので、盤面の大きさによらずほぼ一定になる, 8×8 以下で1列そろえるルールはビットボード）
+  // 空きセルをランダムな順に埋めていき、決着したら初期化し直す（初期化の時間も1手あたりに均して含む）
+  for (const auto& [size, win_length] : { std::pair{ 3, 3 }, std::pair{ 8, 8 }, std::pair{ 19, 5 }, std::pair{ 256, 5 } }) {
+    TicTacToe::Board board;
+    Array<Point> order;
+    for (const Point pos : step(Size{ size, size })) order << pos;
+    size_t index = order.size();
+    results << Benchmark::measure(U"tictactoe/random_move_{0}x{0}_k{1}"_fmt(size, win_length), [&]() {
+      if (index == order.size() or board.is_finished()) {
+        board.initialize(Size{ size, size }, win_length);
+        order.shuffle();
+        index = 0;
+      }
+      board.operate({ order[index++], board.get_turn() });
+      return size_t{ 0 };
+    });
+  }
+  // ビットボードでの勝敗判定（1局面あたりの時間, 1e9 / ns_per_op が1秒あたりに評価できる局面数）
+  for (const size_t size : { size_t{ 3 }, TicTacToe::max_bitboard_size }) {
+    Array<std::pair<uint64, uint64>> positions(1024);
+    for (auto& [circles, crosses] : positions) {
+      const uint64 occupied = RandomUint64() & TicTacToe::win_masks[size].full;
+      circles = occupied & RandomUint64();
+      crosses = occupied & ~circles;
+    }
+    size_t index = 0;
+    results << Benchmark::measure(U"tictactoe/evaluate_{0}x{0}"_fmt(size), [&]() {
+      const auto& [circles, crosses] = positions[index++ % positions.size()];
+      const Optional<TicTacToe::Cell> winner = TicTacToe::evaluate(circles, crosses, size);
+      Benchmark::sink = Benchmark::sink + (winner ? static_cast<uint64>(*winner) + 1 : 0);
+      return size_t{ 0 };
+    });
+  }
+  // 1本の線を引く時間（調べるのは線に接するボックスだけなので、盤面の大きさによらずほぼ一定になる）
+  // すべての線をランダムな順に引き、盤面が埋まったら初期化し直す
+  for (const int32 size : { 6, 100, 256 }) {
+    DotsAndBoxes::Board board;
+    Array<std::pair<Point, DotsAndBoxes::LineDirection>> order;
+    for (const Point pos : step(Size{ size, size + 1 })) order.emplace_back(pos, DotsAndBoxes::LineDirection::Top);
+    for (const Point pos : step(Size{ size + 1, size })) order.emplace_back(pos, DotsAndBoxes::LineDirection::Left);
+    size_t index = order.size();
+    results << Benchmark::measure(U"dotsandboxes/random_move_{0}x{0}"_fmt(size), [&]() {
+      if (index == order.size()) {
+        board.initialize(Size{ size, size });
+        order.shuffle();
+        index = 0;
+      }
+      const auto& [pos, dir] = order[index++];
+      board.operate({ pos, dir, board.get_turn() });
+      return size_t{ 0 };
+    });
+  }
+  // 2ビットに詰めた線の数え上げと、取れるボックスの検出（行ごとに 32 要素ずつ判定する）
+  for (const int32 size : { 6, 256 }) {
+    DotsAndBoxes::Board board;
+    board.initialize(Size{ size, size });
+    for (int32 i = 0; i < size * size; ++i) {
+      const DotsAndBoxes::LineDirection dir = RandomBool() ? DotsAndBoxes::LineDirection::Top : DotsAndBoxes::LineDirection::Left;
+      board.operate({ Point{ Random(size - 1), Random(size - 1) }, dir, board.get_turn() });
+    }
+    results << Benchmark::measure(U"dotsandboxes/count_drawn_lines_{0}x{0}"_fmt(size), [&]() {
+      Benchmark::sink = Benchmark::sink + board.count_drawn_lines();
+      return board.get_horizontal_lines().size_bytes() + board.get_vertical_lines().size_bytes();
+    });
+    results << Benchmark::measure(U"dotsandboxes/three_sided_boxes_{0}x{0}"_fmt(size), [&]() {
+      return board.get_three_sided_boxes().size();
+    });
+  }
+  // 思考ルーチンが線を 1/3 引いた局面から深さ 5 まで読む時間（1手あたり）と、1局面あたりの時間（1e9 / ns_per_op が1秒あたりの局面数）
+  for (const Size size : { Size{ 3, 3 }, Size{ 4, 3 }, Size{ 4, 4 }, Size{ 5, 4 }, Size{ 6, 4 } }) {
+    DotsAndBoxes::Board board;
+    board.initialize(size);
+    const Array<DotsAndBoxes::Operation> opening = board.get_legal_operations().shuffled();
+    for (size_t i = 0; i < opening.size() / 3; ++i) board.operate({ opening[i].pos, opening[i].dir, board.get_turn() });
+    DotsAndBoxes::AI::Searcher searcher{ { .think_time = 60s, .max_depth = 5 } };
+    uint64 nodes = 0;
+    Duration elapsed{ 0 };
+    results << Benchmark::measure(U"dotsandboxes_ai/move_{}x{}"_fmt(size.x, size.y), [&]() {
+      // 前回の読みを使わないよう置換表を空にしてから読む
+      searcher.clear_table();
+      searcher.choose(board);
+      nodes += searcher.get_stats().nodes;
+      elapsed += searcher.get_stats().elapsed;
+      return size_t{ 0 };
+    });
+    results << Benchmark::Result{
+      .name = U"dotsandboxes_ai/node_{}x{}"_fmt(size.x, size.y),
+      .iterations = nodes,
+      .ns_per_op = (nodes > 0) ? (elapsed.count() * 1e9 / nodes) : 0.0,
+    };
+  }
+  // 起動時にゲーム一覧（ID と最大人数）を用意する時間
+  // 以前のようにインスタンスを作って値を読む場合と、登録済みの定数を読むだけの場合を比べる
+  results << Benchmark::measure(U"startup/game_list_by_instances", [&]() {
+    HashTable<String, uint8> game_list;
+    game_list[std::make_unique<TicTacToe::Game>()->get_game_id()] = std::make_unique<TicTacToe::Game>()->get_max_players();
+    game_list[std::make_unique<DotsAndBoxes::Game>()->get_game_id()] = std::make_unique<DotsAndBoxes::Game>()->get_max_players();
+    return game_list.size();
+  });
+  results << Benchmark::measure(U"startup/game_list_by_registry", [&]() {
+    size_t max_players = 0;
+    for (const GameRegistry::Entry& entry : GameRegistry::entries) max_players += entry.max_players;
+    return max_players;
+  });
+  // 盤面のスナップショットの書き出しと復元（1要素2ビットに詰める）
+  const auto snapshot_roundtrip = [&](const StringView name, const auto& board) {
+    Serializer<MemoryWriter> writer;
+    results << Benchmark::measure(U"snapshot/{}_write"_fmt(name), [&]() {
+      writer->clear();
+      board.write_packed(writer);
+      return writer->getBlob().size();
+    });
+    std::remove_cvref_t<decltype(board)> restored;
+    results << Benchmark::measure(U"snapshot/{}_read"_fmt(name), [&]() {
+      const Blob& blob = writer->getBlob();
+      Deserializer<MemoryViewReader> reader{ blob.data(), blob.size() };
+      restored.read_packed(reader);
+      return blob.size();
+    });
+  };
+  for (const int32 size : { 3, 19, 256 }) {
+    TicTacToe::Board board;
+    board.initialize(Size{ size, size }, Min(size, 5));
+    for (int32 i = 0; i < size * 4; ++i) {
+      board.operate({ Point{ Random(size - 1), Random(size - 1) }, board.get_turn() });
+    }
+    snapshot_roundtrip(U"tictactoe_{0}x{0}"_fmt(size), board);
+  }
+  for (const int32 size : { 6, 64, 256 }) {
+    DotsAndBoxes::Board board;
+    board.initialize(Size{ size, size });
+    for (int32 i = 0; i < size * 4; ++i) {
+      const DotsAndBoxes::LineDirection dir = RandomBool() ? DotsAndBoxes::LineDirection::Top : DotsAndBoxes::LineDirection::Left;
+      board.operate({ Point{ Random(size - 1), Random(size - 1) }, dir, board.get_turn() });
+    }
+    snapshot_roundtrip(U"dotsandboxes_{0}x{0}"_fmt(size), board);
+  }
+  // 合成したルーム一覧からの参加先の決定（1 リクエストあたりの判断時間）
+  const Array<RoomName> synthetic_rooms = Matchmaking::make_synthetic_rooms(
+    5000, { U"TicTacToe", U"DotsAndBoxes" }, { U"jp", U"asia", U"us", U"eu" }, 0);
+  Matchmaking::Matchmaker matchmaker;
+  matchmaker.set_region_rtt(U"jp", 20);
+  matchmaker.set_region_rtt(U"asia", 60);
+  matchmaker.set_region_rtt(U"us", 130);
+  matchmaker.set_region_rtt(U"eu", 250);
+  results << Benchmark::measure(U"matchmaking/find_5000_rooms", [&]() {
+    const Matchmaking::Ticket ticket{ .game_id = U"TicTacToe", .region = U"jp", .rating = 1500, .queued_at = -5000 };
+    matchmaker.find(ticket, synthetic_rooms, 0);
+    return size_t{ 0 };
+  });
+  results << Benchmark::measure(U"matchmaking/process_64_tickets_5000_rooms", [&]() {
+    for (int32 i = 0; i < 64; ++i) {
+      matchmaker.enqueue({ .id = static_cast<uint64>(i), .game_id = U"TicTacToe", .region = U"jp", .rating = 1400 + i * 4, .queued_at = -5000 });
+    }
+    matchmaker.process(synthetic_rooms, 0);
+    return size_t{ 0 };
+  });
+  results.append(Multiplayer_Photon::RunInternalBenchmarks());
+  return results;
+}
+# endif
+
+void Main() {
+  const Array<String> args = System::GetCommandLineArgs();
+  // オプション名の次の引数を返す
+  const auto get_arg = [&](const StringView name) -> Optional<String> {
+    const auto it = std::find(args.begin(), args.end(), name);
+    if (it == args.end() or std::next(it) == args.end()) return none;
+    return *std::next(it);
+  };
+
+# if defined(MULTIPLAYER_BENCHMARK)
+  // `--benchmark [--json <path>] [--label <label>]` が指定されていればベンチマークだけを実行する
+  if (args.contains(U"--benchmark")) {
+    const Array<Benchmark::Result> results = run_event_benchmarks();
+    for (const Benchmark::Result& result : results) Console << Benchmark::format(result);
+    if (const auto path = get_arg(U"--json")) {
+      Benchmark::to_json(results, get_arg(U"--label").value_or(U"")).save(*path);
+    }
+    return;
+  }
+# endif
+
+  // `--selftest` が指定されていれば自己診断だけを実行する
+  if (args.contains(U"--selftest")) {
+    const Array<SelfTest::Check> checks = SelfTest::run_all();
+    for (const SelfTest::Check& check : checks) Console << SelfTest::format(check);
+    Console << U"{} / {} passed"_fmt(checks.count_if([](const SelfTest::Check& check) { return check.passed; }), checks.size());
+    return;
+  }
+
+  // `--selfplay [--matches N]` が指定されていれば、盤面だけを使った自己対戦で1コアあたりの処理能力を計測する
+  if (args.contains(U"--selfplay")) {
+    const size_t self_play_matches = ParseOr<size_t>(get_arg(U"--matches").value_or(U"10000"), 10000);
+    const Headless::SelfPlayStats tic_tac_toe = Headless::run_self_play<TicTacToe::Board>(
+      self_play_matches, [](TicTacToe::Board& board) { board.initialize(3); });
+    Console << U"TicTacToe: {} matches, {:.0f} matches/s, {} draws"_fmt(
+      tic_tac_toe.matches, tic_tac_toe.matches_per_sec(), tic_tac_toe.draws);
+    const Headless::SelfPlayStats gomoku = Headless::run_self_play<TicTacToe::Board>(
+      self_play_matches / 10, [](TicTacToe::Board& board) { board.initialize(Size{ 19, 19 }, 5); });
+    Console << U"TicTacToe 19x19 (5 in a row): {} matches, {:.0f} matches/s, {} draws"_fmt(
+      gomoku.matches, gomoku.matches_per_sec(), gomoku.draws);
+    const Headless::SelfPlayStats dots_and_boxes = Headless::run_self_play<DotsAndBoxes::Board>(
+      self_play_matches, [](DotsAndBoxes::Board& board) { board.initialize(Size{ 6, 4 }); });
+    Console << U"DotsAndBoxes: {} matches, {:.0f} matches/s, {} draws"_fmt(
+      dots_and_boxes.matches, dots_and_boxes.matches_per_sec(), dots_and_boxes.draws);
+    return;
+  }
+
+  const auto get_factory = [](const String& game_id) -> std::function<std::unique_ptr<IGame>()> {
+    if (const GameRegistry::Entry* entry = GameRegistry::find(game_id)) return entry->factory;
+    return nullptr;
+  };
+
+  // `--loadtest <GameID> [--clients N] [--seconds S]` が指定されていれば、プロセス内の中継で負荷試験をする
+  if (const auto game_id = get_arg(U"--loadtest")) {
+    const auto factory = get_factory(*game_id);
+    if (not factory) return;
+    const size_t clients = ParseOr<size_t>(get_arg(U"--clients").value_or(U"100"), 100);
+    const double seconds = ParseOr<double>(get_arg(U"--seconds").value_or(U"10"), 10.0);
+    LoadTest::Harness harness{ clients, factory };
+    Console << U"[LoadTest {}]\n"_fmt(*game_id) << harness.run(Duration{ seconds }).format();
+    return;
+  }
+
+  // `--bot <GameID>` が指定されていれば、Photon に接続してボットとして対戦し続ける
+  const auto game_id = get_arg(U"--bot");
+  if (not game_id) return;
+  const auto factory = get_factory(*game_id);
+  if (not factory) return;
+  OnlineManager manager{ secretAppID, U"1.0", Verbose::No };
+  manager.connect(U"bot-" + ToHex(RandomUint32()), U"jp");
+  // 思考ルーチンがあるゲームはそれで手を選ぶ（ロビーで待つ人の対戦相手になる）
+  Headless::MovePicker play_move = nullptr;
+  if (*game_id == DotsAndBoxes::Game::game_id) play_move = DotsAndBoxes::AI::make_bot_player();
+  Headless::BotClient bot{ manager, factory, 0.5s, play_move };
+  while (System::Update()) {
+    bot.update();
+  }
+}
+
+# else
+
 void Main() {
   Window::Resize(1280, 720);
 
@@ -211,3 +549,5 @@ void Main() {
     }
   }
 }
+
+# endif
@@ -0,0 +1,221 @@
+﻿# pragma once
+# include <Siv3D.hpp>
+# include "ServerTime.hpp"
+
+// リージョンの RTT・レーティング差・待ち時間でルームを選ぶマッチメイキング
+// ルームの属性はルーム一覧だけで判断できるよう、ルーム名の "[GameID]"（とルームの設定 "<...>"）の直後に "{region;rating;created_at}" として埋め込む
+namespace Matchmaking {
+
+  /// @brief ルーム名に埋め込む属性
+  struct RoomTags {
+    String region; // 作成者のリージョン
+    int32 rating = 0; // 作成者のレーティング
+    int32 created_at = 0; // 作成したサーバー時刻（ミリ秒）
+  };
+
+  /// @brief 属性をルーム名に埋め込む文字列にする
+  inline String encode_tags(const RoomTags& tags) {
+    return U"{{{};{};{}}}"_fmt(tags.region, tags.rating, tags.created_at);
+  }
+
+  /// @brief "[GameID]{...}" または "[GameID]<...>{...}" 形式のルーム名から属性を取り出す（属性がなければ none）
+  inline Optional<RoomTags> parse_tags(const StringView room_name) {
+    size_t open = room_name.indexOf(U']');
+    if (open == StringView::npos) return none;
+    // ルームの設定 "<...>" は読み飛ばす
+    if (room_name.substr(open + 1).starts_with(U'<')) {
+      open = room_name.indexOf(U'>', open);
+      if (open == StringView::npos) return none;
+    }
+    if (not room_name.substr(open + 1).starts_with(U'{')) return none;
+    const size_t close = room_name.indexOf(U'}', open);
+    if (close == StringView::npos) return none;
+    const StringView body = room_name.substr(open + 2, close - open - 2);
+    const size_t first = body.indexOf(U';');
+    const size_t second = (first == StringView::npos) ? StringView::npos : body.indexOf(U';', first + 1);
+    if (second == StringView::npos) return none;
+    const Optional<int32> rating = ParseOpt<int32>(body.substr(first + 1, second - first - 1));
+    const Optional<int32> created_at = ParseOpt<int32>(body.substr(second + 1));
+    if (not rating or not created_at) return none;
+    return RoomTags{ String{ body.substr(0, first) }, *rating, *created_at };
+  }
+
+  /// @brief 待ち時間とともに広げる採点基準
+  struct Criteria {
+    int32 rating_window = 100; // 待ち始めに許容するレーティング差
+    int32 rating_window_per_sec = 25; // 待ち時間1秒ごとに広げる幅
+    int32 max_rtt_ms = 80; // 待ち始めに許容するリージョンへの RTT
+    int32 max_rtt_ms_per_sec = 20;
+    int32 unknown_rtt_ms = 250; // RTT が未計測のリージョンとみなす値（減点にだけ使い、許容範囲では弾かない）
+    double untagged_penalty = 10000.0; // 属性のないルーム（「Create Room」で作ったルームなど）の減点（他に候補がなければ参加する）
+    double rtt_weight = 1.0; // RTT 1 ms あたりの減点
+    double rating_weight = 0.5; // レーティング差1あたりの減点
+    double room_wait_weight = 0.01; // ルームの待ち時間 1 ms あたりの加点（長く待っているルームを優先）
+  };
+
+  /// @brief マッチングを待つプレイヤー
+  struct Ticket {
+    uint64 id = 0;
+    String game_id;
+    String region;
+    int32 rating = 0;
+    int32 queued_at = 0; // 待ち始めたサーバー時刻（ミリ秒）
+  };
+
+  /// @brief チケットに対する決定
+  struct Decision {
+    uint64 ticket_id = 0;
+    Optional<RoomName> room; // 参加するルーム（none ならこの属性でルームを作成する）
+  };
+
+  struct Stats {
+    uint64 decisions = 0;
+    uint64 joined = 0; // 既存のルームに割り当てた数
+    uint64 created = 0; // ルーム作成を指示した数
+    uint64 deferred = 0; // 同じバッチの別のプレイヤーが作るルームを待たせた数
+    size_t last_room_count = 0; // 直近に評価したルーム数
+  };
+
+  class Matchmaker {
+  public:
+    void set_criteria(const Criteria& criteria) { criteria_ = criteria; }
+    const Criteria& get_criteria(void) const { return criteria_; }
+    /// @brief 自分からリージョンへの RTT を設定する
+    void set_region_rtt(const StringView region, const int32 rtt_ms) { region_rtt_ms_[String{ region }] = rtt_ms; }
+    int32 get_region_rtt(const StringView region) const {
+      return find_region_rtt(region).value_or(criteria_.unknown_rtt_ms);
+    }
+    /// @brief 計測済みのリージョンへの RTT（未計測なら none）
+    Optional<int32> find_region_rtt(const StringView region) const {
+      const auto it = region_rtt_ms_.find(String{ region });
+      return (it == region_rtt_ms_.end()) ? none : Optional<int32>{ it->second };
+    }
+    /// @brief ルームの点数（待ち時間で広げた基準を満たさなければ none, 高いほど良い）
+    /// @remark RTT の許容範囲で弾くのは計測済みのリージョンだけ（自分と同じリージョンは未計測なら 0 ms, 他は unknown_rtt_ms で減点する）
+    Optional<double> score(const Ticket& ticket, const RoomTags& tags, int32 now) const;
+    /// @brief 1人分の参加先を rooms から選ぶ（none ならルームを作成する）
+    Optional<RoomName> find(const Ticket& ticket, const Array<RoomName>& rooms, int32 now);
+    /// @brief マッチングを待つプレイヤーを積む
+    void enqueue(const Ticket& ticket) { queue_ << ticket; }
+    size_t get_queue_size(void) const { return queue_.size(); }
+    /// @brief 待っているプレイヤー全員の参加先をまとめて決める
+    /// @remark ルーム一覧の解析は1回だけ行い、1つのルームには1人だけ割り当てる。
+    ///         条件の合う未割り当てのプレイヤーが複数いれば1人だけがルームを作り、残りは次の呼び出しまで待つ
+    Array<Decision> process(const Array<RoomName>& rooms, int32 now);
+    const Stats& get_stats(void) const { return stats_; }
+  private:
+    struct Candidate {
+      RoomName name;
+      Optional<RoomTags> tags; // none なら属性のないルーム
+      bool is_taken = false;
+    };
+    Criteria criteria_;
+    HashTable<String, int32> region_rtt_ms_;
+    Array<Ticket> queue_;
+    Array<Candidate> candidates_; // 解析済みのルーム（使い回す）
+    Stats stats_;
+    void parse_rooms_(const Array<RoomName>& rooms, const StringView game_id);
+    Optional<size_t> best_candidate_(const Ticket& ticket, int32 now) const;
+  };
+
+  inline Optional<double> Matchmaker::score(const Ticket& ticket, const RoomTags& tags, const int32 now) const {
+    const double waited_sec = Max(ServerTime::diff_ms(now, ticket.queued_at), 0) / 1000.0;
+    const int32 rating_gap = Abs(ticket.rating - tags.rating);
+    if (rating_gap > criteria_.rating_window + criteria_.rating_window_per_sec * waited_sec) return none;
+    const Optional<int32> measured_rtt = find_region_rtt(tags.region);
+    if (measured_rtt and *measured_rtt > criteria_.max_rtt_ms + criteria_.max_rtt_ms_per_sec * waited_sec) return none;
+    const int32 rtt = measured_rtt ? *measured_rtt : (tags.region == ticket.region) ? 0 : criteria_.unknown_rtt_ms;
+    const int32 room_wait = Max(ServerTime::diff_ms(now, tags.created_at), 0);
+    return criteria_.room_wait_weight * room_wait - criteria_.rtt_weight * rtt - criteria_.rating_weight * rating_gap;
+  }
+
+  inline void Matchmaker::parse_rooms_(const Array<RoomName>& rooms, const StringView game_id) {
+    candidates_.clear();
+    const String prefix = U"[" + game_id + U"]";
+    for (const RoomName& room : rooms) {
+      if (not room.starts_with(prefix)) continue;
+      // 属性のないルームも、点数を下げて候補に残す
+      candidates_.push_back({ room, parse_tags(room) });
+    }
+    stats_.last_room_count = rooms.size();
+  }
+
+  inline Optional<size_t> Matchmaker::best_candidate_(const Ticket& ticket, const int32 now) const {
+    Optional<size_t> best;
+    double best_score = 0.0;
+    for (size_t i = 0; i < candidates_.size(); ++i) {
+      if (candidates_[i].is_taken) continue;
+      const Optional<RoomTags>& tags = candidates_[i].tags;
+      const Optional<double> s = tags ? score(ticket, *tags, now) : Optional<double>{ -criteria_.untagged_penalty };
+      if (s and (not best or *s > best_score)) {
+        best = i;
+        best_score = *s;
+      }
+    }
+    return best;
+  }
+
+  inline Optional<RoomName> Matchmaker::find(const Ticket& ticket, const Array<RoomName>& rooms, const int32 now) {
+    parse_rooms_(rooms, ticket.game_id);
+    ++stats_.decisions;
+    if (const Optional<size_t> best = best_candidate_(ticket, now)) {
+      ++stats_.joined;
+      return candidates_[*best].name;
+    }
+    ++stats_.created;
+    return none;
+  }
+
+  inline Array<Decision> Matchmaker::process(const Array<RoomName>& rooms, const int32 now) {
+    Array<Decision> decisions;
+    if (queue_.isEmpty()) return decisions;
+    // ゲームごとに、長く待っているプレイヤーから割り当てる
+    queue_.stable_sort_by([](const Ticket& a, const Ticket& b) {
+      if (a.game_id != b.game_id) return a.game_id < b.game_id;
+      return ServerTime::diff_ms(a.queued_at, b.queued_at) < 0;
+    });
+    Array<Ticket> waiting;
+    Array<const Ticket*> creators; // このバッチでルームを作るプレイヤー
+    String parsed_game_id;
+    bool is_parsed = false;
+    for (const Ticket& ticket : queue_) {
+      if (not is_parsed or ticket.game_id != parsed_game_id) {
+        parse_rooms_(rooms, ticket.game_id);
+        parsed_game_id = ticket.game_id;
+        is_parsed = true;
+      }
+      ++stats_.decisions;
+      if (const Optional<size_t> best = best_candidate_(ticket, now)) {
+        candidates_[*best].is_taken = true;
+        decisions.push_back({ ticket.id, candidates_[*best].name });
+        ++stats_.joined;
+        continue;
+      }
+      // 同じバッチで条件の合うプレイヤーがルームを作るなら、それに参加できるよう待たせる
+      const bool has_creator = creators.any([&](const Ticket* creator) {
+        return creator->game_id == ticket.game_id
+          and score(ticket, RoomTags{ creator->region, creator->rating, now }, now).has_value();
+      });
+      if (has_creator) {
+        waiting.push_back(ticket);
+        ++stats_.deferred;
+        continue;
+      }
+      creators.push_back(&ticket);
+      decisions.push_back({ ticket.id, none });
+      ++stats_.created;
+    }
+    queue_ = std::move(waiting);
+    return decisions;
+  }
+
+  /// @brief 負荷試験・ベンチマーク用に、ランダムな属性のルーム名を count 個作る
+  inline Array<RoomName> make_synthetic_rooms(const size_t count, const Array<String>& game_ids, const Array<String>& regions, const int32 now) {
+    Array<RoomName> rooms(Arg::reserve = count);
+    for (size_t i = 0; i < count; ++i) {
+      const RoomTags tags{ regions.choice(), static_cast<int32>(Random(800, 2200)), now - static_cast<int32>(Random(0, 60000)) };
+      rooms << (U"[" + game_ids.choice() + U"]" + encode_tags(tags) + U"room-{}"_fmt(i));
+    }
+    return rooms;
+  }
+}
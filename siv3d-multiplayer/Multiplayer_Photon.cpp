@@ -279,6 +279,12 @@ namespace s3d
 			m_context.leaveRoomEventAction(playerID, isInactive);
 		}
 
+		// ルームのホスト（マスタークライアント）が交代したら呼ばれるコールバック
+		void onMasterClientChanged(const int id, const int oldID) override
+		{
+			m_context.hostChangedEventAction(id, oldID);
+		}
+
 		// ルームで他人が sendEvent したら呼ばれるコールバック
 		void customEventAction(const int playerID, const nByte eventCode, const ExitGames::Common::Object& _data) override
 		{
@@ -291,8 +297,9 @@ namespace s3d
 			}
 			else if (type == ExitGames::Common::TypeCode::HASHTABLE)
 			{
-				const ExitGames::Common::Hashtable eventDataContent = ExitGames::Common::ValueObject<ExitGames::Common::Hashtable>(_data).getDataCopy();
-				const ExitGames::Common::JString mainType = ExitGames::Common::ValueObject<ExitGames::Common::JString>(eventDataContent.getValue(L"Type")).getDataCopy();
+				// 受信データをコピーせずに参照する
+				const ExitGames::Common::Hashtable& eventDataContent = *static_cast<const ExitGames::Common::Hashtable*>(_data.getData());
+				const ExitGames::Common::JString& mainType = *static_cast<const ExitGames::Common::JString*>(eventDataContent.getValue(L"Type")->getData());
 
 				if (mainType == L"Array")
 				{
@@ -369,9 +376,10 @@ namespace s3d
 					{
 					case ExitGames::Common::TypeCode::BYTE:
 						{
-							const auto values = ExitGames::Common::ValueObject<uint8*>(eventDataContent.getValue(L"values")).getDataCopy();
-							const auto length = *(ExitGames::Common::ValueObject<uint8*>(eventDataContent.getValue(L"values"))).getSizes();
-							Deserializer<MemoryViewReader> reader{ values, length };
+							// Blob は Deserializer で読むだけなので、コピーせずに受信バッファを直接参照する
+							const ExitGames::Common::Object* values = eventDataContent.getValue(L"values");
+							const auto length = *values->getSizes();
+							Deserializer<MemoryViewReader> reader{ values->getData(), static_cast<size_t>(length) };
 							m_context.customEventAction(playerID, eventCode, reader);
 							break;
 						}
@@ -434,9 +442,25 @@ namespace s3d
 
 		void leaveRoomReturn(const int errorCode, const ExitGames::Common::JString& errorString) override
 		{
+			// ルームから退出すると既定のロビーに戻る
+			m_context.m_joinedLobbyName.reset();
 			m_context.leaveRoomReturn(errorCode, detail::ToString(errorString));
 		}
 
+		void joinLobbyReturn() override
+		{
+			// 接続直後・ルーム退出後は既定のロビーに自動で入るので、joinLobby() で指定したロビーに移り直す
+			if (m_context.m_joinedLobbyName != m_context.m_lobbyName)
+			{
+				m_context.m_joinedLobbyName = m_context.m_lobbyName;
+
+				if (not m_context.m_lobbyName.isEmpty())
+				{
+					m_context.m_client->opJoinLobby(detail::ToJString(m_context.m_lobbyName));
+				}
+			}
+		}
+
 		void joinRoomReturn(const int playerID, [[maybe_unused]] const ExitGames::Common::Hashtable& roomProperties, [[maybe_unused]] const ExitGames::Common::Hashtable& playerProperties, const int errorCode, const ExitGames::Common::JString& errorString) override
 		{
 			m_context.joinRoomReturn(playerID, errorCode, detail::ToString(errorString));
@@ -525,6 +549,7 @@ namespace s3d
 		}
 
 		m_client->fetchServerTimestamp();
+		m_joinedLobbyName.reset();
 		m_isActive = true;
 	}
 
@@ -600,6 +625,30 @@ namespace s3d
 		return m_client->getBytesOut();
 	}
 
+	void Multiplayer_Photon::joinLobby(const StringView lobbyName)
+	{
+		m_lobbyName = String{ lobbyName };
+
+		if (not m_client)
+		{
+			return;
+		}
+
+		// ロビーにいなければ、次にロビーに入ったとき（joinLobbyReturn）に移る
+		if ((not m_client->getIsInLobby()) or (m_joinedLobbyName == m_lobbyName))
+		{
+			return;
+		}
+
+		m_joinedLobbyName = m_lobbyName;
+		m_client->opJoinLobby(detail::ToJString(m_lobbyName));
+	}
+
+	const String& Multiplayer_Photon::getLobbyName() const noexcept
+	{
+		return m_lobbyName;
+	}
+
 	void Multiplayer_Photon::joinRandomRoom(const int32 maxPlayers)
 	{
 		if (not m_client)
@@ -612,7 +661,7 @@ namespace s3d
 			return;
 		}
 
-		m_client->opJoinRandomRoom({}, static_cast<uint8>(maxPlayers));
+		m_client->opJoinRandomRoom({}, static_cast<uint8>(maxPlayers), ExitGames::LoadBalancing::MatchmakingMode::FILL_ROOM, detail::ToJString(m_lobbyName));
 	}
 
 	void Multiplayer_Photon::joinRandomOrCreateRoom(const int32 maxPlayers, const RoomNameView roomName)
@@ -627,7 +676,10 @@ namespace s3d
 			return;
 		}
 
-		m_client->opJoinRandomOrCreateRoom(detail::ToJString(roomName), {}, {}, static_cast<uint8>(maxPlayers));
+		const auto roomOption = ExitGames::LoadBalancing::RoomOptions()
+			.setLobbyName(detail::ToJString(m_lobbyName));
+
+		m_client->opJoinRandomOrCreateRoom(detail::ToJString(roomName), roomOption, {}, static_cast<uint8>(maxPlayers), ExitGames::LoadBalancing::MatchmakingMode::FILL_ROOM, detail::ToJString(m_lobbyName));
 	}
 
 	void Multiplayer_Photon::joinRoom(const RoomNameView roomName)
@@ -641,7 +693,18 @@ namespace s3d
 		m_client->opJoinRoom(detail::ToJString(roomName), Rejoin);
 	}
 
-	void Multiplayer_Photon::createRoom(const RoomNameView roomName, const int32 maxPlayers)
+	void Multiplayer_Photon::rejoinRoom(const RoomNameView roomName)
+	{
+		if (not m_client)
+		{
+			return;
+		}
+
+		constexpr bool Rejoin = true;
+		m_client->opJoinRoom(detail::ToJString(roomName), Rejoin);
+	}
+
+	void Multiplayer_Photon::createRoom(const RoomNameView roomName, const int32 maxPlayers, const int32 playerTTLMillisec)
 	{
 		if (not m_client)
 		{
@@ -655,7 +718,9 @@ namespace s3d
 
 		const auto roomOption = ExitGames::LoadBalancing::RoomOptions()
 			.setMaxPlayers(static_cast<uint8>(maxPlayers))
-			.setPublishUserID(true);
+			.setPublishUserID(true)
+			.setPlayerTtl(Max(playerTTLMillisec, 0))
+			.setLobbyName(detail::ToJString(m_lobbyName));
 
 		m_client->opCreateRoom(detail::ToJString(roomName), roomOption);
 	}
@@ -1117,6 +1182,46 @@ namespace s3d
 		m_client->opRaiseEvent(Reliable, ev, eventCode, detail::MakeRaiseEventOptions(targets));
 	}
 
+	void Multiplayer_Photon::sendEventToGroup(const uint8 eventCode, const Serializer<MemoryWriter>& writer, const uint8 interestGroup)
+	{
+		if (not m_client)
+		{
+			return;
+		}
+
+		const auto& blob = writer->getBlob();
+		const uint8* src = static_cast<const uint8*>(static_cast<const void*>(blob.data()));
+		const size_t size = blob.size();
+
+		ExitGames::Common::Hashtable ev;
+		ev.put(L"Type", L"Blob");
+		ev.put(L"values", src, static_cast<int16>(size));
+		m_client->opRaiseEvent(Reliable, ev, eventCode, ExitGames::LoadBalancing::RaiseEventOptions{}.setInterestGroup(interestGroup));
+	}
+
+	void Multiplayer_Photon::changeInterestGroups(const Array<uint8>& remove, const Array<uint8>& add)
+	{
+		if (not m_client)
+		{
+			return;
+		}
+
+		ExitGames::Common::JVector<nByte> groupsToRemove;
+		ExitGames::Common::JVector<nByte> groupsToAdd;
+
+		for (const uint8 group : remove)
+		{
+			groupsToRemove.addElement(group);
+		}
+
+		for (const uint8 group : add)
+		{
+			groupsToAdd.addElement(group);
+		}
+
+		m_client->opChangeGroups(&groupsToRemove, &groupsToAdd);
+	}
+
 	String Multiplayer_Photon::getUserName() const
 	{
 		if (not m_client)
@@ -1455,6 +1560,16 @@ namespace s3d
 		}
 	}
 
+	void Multiplayer_Photon::hostChangedEventAction(const LocalPlayerID newHostPlayerID, const LocalPlayerID oldHostPlayerID)
+	{
+		if (m_verbose)
+		{
+			Print << U"[Multiplayer_Photon] Multiplayer_Photon::hostChangedEventAction() [ルームのホストが交代したときに呼ばれる]";
+			Print << U"- [Multiplayer_Photon] newHostPlayerID: " << newHostPlayerID;
+			Print << U"- [Multiplayer_Photon] oldHostPlayerID: " << oldHostPlayerID;
+		}
+	}
+
 	void Multiplayer_Photon::createRoomReturn(const LocalPlayerID playerID, const int32 errorCode, const String& errorString)
 	{
 		if (m_verbose)
@@ -1771,3 +1886,142 @@ namespace s3d
 		return GETTIMEMS();
 	}
 }
+
+# if defined(MULTIPLAYER_BENCHMARK)
+
+namespace s3d
+{
+	namespace detail
+	{
+		// 受信したイベントを読み捨てるだけの受信側
+		class BenchmarkReceiver : public Multiplayer_Photon
+		{
+		public:
+
+			using Multiplayer_Photon::customEventAction;
+
+			BenchmarkReceiver()
+			{
+				m_verbose = false;
+			}
+
+			void customEventAction([[maybe_unused]] const LocalPlayerID playerID, [[maybe_unused]] const uint8 eventCode, const int32 data) override
+			{
+				received += static_cast<uint64>(data);
+			}
+
+			void customEventAction([[maybe_unused]] const LocalPlayerID playerID, [[maybe_unused]] const uint8 eventCode, const Vec2& data) override
+			{
+				received += static_cast<uint64>(data.x);
+			}
+
+			void customEventAction([[maybe_unused]] const LocalPlayerID playerID, [[maybe_unused]] const uint8 eventCode, Deserializer<MemoryViewReader>& reader) override
+			{
+				received += static_cast<uint64>(reader->size());
+			}
+
+			uint64 received = 0;
+		};
+	}
+
+	Array<Benchmark::Result> Multiplayer_Photon::RunInternalBenchmarks(const Duration& minTime)
+	{
+		RegisterTypes();
+
+		Array<Benchmark::Result> results;
+
+		// ゲームの操作と同程度の大きさのペイロード
+		Serializer<MemoryWriter> writer;
+		writer(Point{ 3, 2 }, uint8{ 1 }, uint8{ 2 });
+		const auto& blob = writer->getBlob();
+		const uint8* src = static_cast<const uint8*>(static_cast<const void*>(blob.data()));
+		const size_t size = blob.size();
+
+		// sendEvent(Serializer) と同じ Hashtable への格納
+		results << Benchmark::measure(U"photon/send_blob_hashtable", [&]()
+			{
+				ExitGames::Common::Hashtable ev;
+				ev.put(L"Type", L"Blob");
+				ev.put(L"values", src, static_cast<int16>(size));
+				return size;
+			}, minTime);
+
+		detail::BenchmarkReceiver receiver;
+		PhotonDetail listener{ receiver };
+
+		// 受信時の型分岐、Hashtable と Blob の getDataCopy
+		{
+			ExitGames::Common::Hashtable ev;
+			ev.put(L"Type", L"Blob");
+			ev.put(L"values", src, static_cast<int16>(size));
+			const ExitGames::Common::ValueObject<ExitGames::Common::Hashtable> data{ ev };
+			results << Benchmark::measure(U"photon/receive_blob_dispatch", [&]()
+				{
+					listener.customEventAction(1, 42, data);
+					return size;
+				}, minTime);
+		}
+
+		{
+			const ExitGames::Common::ValueObject<int32> data{ 12345 };
+			results << Benchmark::measure(U"photon/receive_int32_dispatch", [&]()
+				{
+					listener.customEventAction(1, 42, data);
+					return sizeof(int32);
+				}, minTime);
+		}
+
+		{
+			const ExitGames::Common::ValueObject<PhotonVec2> data{ PhotonVec2{ Vec2{ 12.5, 34.5 } } };
+			results << Benchmark::measure(U"photon/receive_custom_vec2_dispatch", [&]()
+				{
+					listener.customEventAction(1, 42, data);
+					return sizeof(Vec2);
+				}, minTime);
+		}
+
+		// ユーザ名などに使う文字列変換
+		{
+			const String name = U"player-0123456789abcdef";
+			results << Benchmark::measure(U"photon/to_jstring", [&]()
+				{
+					return static_cast<size_t>(detail::ToJString(name).length());
+				}, minTime);
+
+			const ExitGames::Common::JString jname = detail::ToJString(name);
+			results << Benchmark::measure(U"photon/to_string", [&]()
+				{
+					return detail::ToString(jname).size();
+				}, minTime);
+		}
+
+		// カスタム型の直列化の往復
+		{
+			const PhotonVec2 source{ Vec2{ 12.5, 34.5 } };
+			PhotonVec2 destination;
+			nByte buffer[sizeof(Vec2)];
+			results << Benchmark::measure(U"photon/custom_vec2_roundtrip", [&]()
+				{
+					const short length = source.serialize(buffer);
+					destination.deserialize(buffer, length);
+					return static_cast<size_t>(length);
+				}, minTime);
+
+			const PhotonRect rectSource{ Rect{ 1, 2, 3, 4 } };
+			PhotonRect rectDestination;
+			nByte rectBuffer[sizeof(Rect)];
+			results << Benchmark::measure(U"photon/custom_rect_roundtrip", [&]()
+				{
+					const short length = rectSource.serialize(rectBuffer);
+					rectDestination.deserialize(rectBuffer, length);
+					return static_cast<size_t>(length);
+				}, minTime);
+		}
+
+		Benchmark::sink = Benchmark::sink + receiver.received;
+
+		return results;
+	}
+}
+
+# endif
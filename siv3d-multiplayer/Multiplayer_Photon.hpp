@@ -31,6 +31,10 @@
 #	endif
 # endif
 
+# if defined(MULTIPLAYER_BENCHMARK)
+#	include "Benchmark.hpp"
+# endif
+
 // Photono SDK クラスの前方宣言
 namespace ExitGames::LoadBalancing
 {
@@ -134,6 +138,17 @@ namespace s3d
 		[[nodiscard]]
 		int32 getBytesOut() const;
 
+		/// @brief 指定した名前のロビーに移動します。
+		/// @param lobbyName ロビー名（空の場合は既定のロビー）
+		/// @remark 以降のルーム一覧・ルームの作成・ランダムなルームへの参加はこのロビーのルームが対象になります。
+		/// @remark ルームから退出したときや接続直後も、このロビーに戻ります。
+		void joinLobby(StringView lobbyName);
+
+		/// @brief joinLobby() で指定したロビー名を返します。
+		/// @return ロビー名（既定のロビーの場合は空）
+		[[nodiscard]]
+		const String& getLobbyName() const noexcept;
+
 		/// @brief ランダムなルームに参加を試みます。
 		/// @param maxPlayers ルームの最大人数
 		/// @remark maxPlayers は 最大 255, 無料の Photon アカウントの場合は 20
@@ -148,11 +163,17 @@ namespace s3d
 		/// @param roomName ルーム名
 		void joinRoom(RoomNameView roomName);
 
+		/// @brief 切断などで非アクティブになったルームへの再参加を試みます。
+		/// @param roomName ルーム名
+		/// @remark ルーム作成時に playerTTLMillisec を指定している必要があります。
+		void rejoinRoom(RoomNameView roomName);
+
 		/// @brief ルームの作成を試みます。
 		/// @param roomName ルーム名
 		/// @param maxPlayers ルームの最大人数
+		/// @param playerTTLMillisec 切断したプレイヤーが再参加できる時間（ミリ秒）。0 の場合は切断と同時に退出します
 		/// @remark maxPlayers は 最大 255, 無料の Photon アカウントの場合は 20
-		void createRoom(RoomNameView roomName, int32 maxPlayers);
+		void createRoom(RoomNameView roomName, int32 maxPlayers, int32 playerTTLMillisec = 0);
 
 		/// @brief ルームからの退出を試みます。
 		void leaveRoom();
@@ -386,6 +407,18 @@ namespace s3d
 		/// @remark ユーザ定義型を送信する際に利用します。
 		void sendEvent(uint8 eventCode, const Serializer<MemoryWriter>& writer, const Optional<Array<LocalPlayerID>>& targets = unspecified);
 
+		/// @brief インタレストグループにイベントを送信します。
+		/// @param eventCode イベントコード
+		/// @param writer 送信するデータ
+		/// @param interestGroup 送信先のインタレストグループ（1 以上）
+		/// @remark グループを購読しているプレイヤーにだけ届きます。送信者の負荷は受信者の数によらず一定です。
+		void sendEventToGroup(uint8 eventCode, const Serializer<MemoryWriter>& writer, uint8 interestGroup);
+
+		/// @brief 受信するインタレストグループを変更します。
+		/// @param remove 購読をやめるグループ
+		/// @param add 購読するグループ
+		void changeInterestGroups(const Array<uint8>& remove, const Array<uint8>& add);
+
 		/// @brief 自身のユーザ名を返します。
 		/// @return 自身のユーザ名
 		[[nodiscard]]
@@ -526,6 +559,11 @@ namespace s3d
 		/// @param isInactive 退出者が再参加できる場合 true, それ以外の場合は false
 		virtual void leaveRoomEventAction(LocalPlayerID playerID, bool isInactive);
 
+		/// @brief 現在参加しているルームのホストが交代したときに呼ばれます。
+		/// @param newHostPlayerID 新しいホストのローカルプレイヤー ID
+		/// @param oldHostPlayerID 以前のホストのローカルプレイヤー ID
+		virtual void hostChangedEventAction(LocalPlayerID newHostPlayerID, LocalPlayerID oldHostPlayerID);
+
 		/// @brief ルームの作成を試みた結果が通知されるときに呼ばれます。
 		/// @param playerID 自身のローカルプレイヤー ID
 		/// @param errorCode エラーコード
@@ -761,6 +799,16 @@ namespace s3d
 		[[nodiscard]]
 		static int32 GetSystemTimeMillisec();
 
+# if defined(MULTIPLAYER_BENCHMARK)
+
+		/// @brief イベント送受信経路の内部処理（Blob の Hashtable 格納、受信時の型分岐と getDataCopy、文字列変換、カスタム型の直列化）を計測します。
+		/// @param minTime 1 ケースあたりの最小計測時間
+		/// @return 計測結果
+		[[nodiscard]]
+		static Array<Benchmark::Result> RunInternalBenchmarks(const Duration& minTime = SecondsF{ 0.2 });
+
+# endif
+
 	protected:
 
 		/// @brief 既存のランダムマッチが見つからなかった時のエラーコード
@@ -784,6 +832,10 @@ namespace s3d
 
 		Optional<String> m_requestedRegion;
 
+		String m_lobbyName;
+
+		Optional<String> m_joinedLobbyName;
+
 		bool m_isActive = false;
 	};
 }
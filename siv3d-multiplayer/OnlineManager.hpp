@@ -2,10 +2,48 @@
 # include <Siv3D.hpp>
 # include "Multiplayer_Photon.hpp"
 # include "IGame.hpp"
+# include "EventScheduler.hpp"
+# include "WriterPool.hpp"
+# include "SessionRecorder.hpp"
+# include "LocalRelay.hpp"
+# include "DesyncDetector.hpp"
+# include "Matchmaking.hpp"
+# include "SpectatorBatch.hpp"
+
+/// @brief ルーム名の "[GameID]" の直後に "<key=value;...>" として埋め込むルームの設定
+/// @remark ルームプロパティの代わりに、ロビーのルーム一覧だけで参加前に読めるようにする
+struct RoomOptions {
+  uint8 spectator_slots = 0; // 観戦枠（1 以上なら対戦中もルーム一覧に残す）
+  String rule; // ゲームのルール（IGame::get_rule(), 空ならゲームの既定）
+};
 
 namespace RoomNameHelper {
-  inline String create(const String& base_name, const String& game_id) {
-    return U"[{}]"_fmt(game_id) + base_name;
+  /// @brief 設定をルーム名に埋め込む文字列にする（既定の設定なら空）
+  inline String encode_options(const RoomOptions& options) {
+    Array<String> fields;
+    if (options.spectator_slots > 0) fields << U"spectate={}"_fmt(options.spectator_slots);
+    if (not options.rule.isEmpty()) fields << U"rule={}"_fmt(options.rule);
+    return fields.isEmpty() ? String{} : fields.join(U";", U"<", U">");
+  }
+  /// @brief "[GameID]<...>" 形式のルーム名から設定を取り出す（設定がなければ既定の設定）
+  inline RoomOptions parse_options(const StringView room_name) {
+    RoomOptions options;
+    const size_t open = room_name.indexOf(U"]<");
+    if (not room_name.starts_with(U'[') or open == StringView::npos) return options;
+    const size_t close = room_name.indexOf(U'>', open);
+    if (close == StringView::npos) return options;
+    for (const String& field : String{ room_name.substr(open + 2, close - open - 2) }.split(U';')) {
+      const size_t separator = field.indexOf(U'=');
+      if (separator == String::npos) continue;
+      const StringView key = StringView{ field }.substr(0, separator);
+      const StringView value = StringView{ field }.substr(separator + 1);
+      if (key == U"spectate") options.spectator_slots = ParseOr<uint8>(value, 0);
+      else if (key == U"rule") options.rule = String{ value };
+    }
+    return options;
+  }
+  inline String create(const String& base_name, const String& game_id, const RoomOptions& options = {}) {
+    return U"[{}]"_fmt(game_id) + encode_options(options) + base_name;
   }
   inline Optional<String> get_game_id(const String& room_name) {
     if(room_name.starts_with(U'[') and room_name.contains(U']')) {
@@ -15,7 +53,11 @@ namespace RoomNameHelper {
   }
   inline String get_base_name(const String& room_name) {
     if (room_name.starts_with(U'[') and room_name.contains(U']')) {
-      return room_name.substr(room_name.indexOf(U']') + 1);
+      String base_name = room_name.substr(room_name.indexOf(U']') + 1);
+      // ルームの設定 "<...>" とマッチメイキングの属性 "{...}" は表示しない
+      if (base_name.starts_with(U'<') and base_name.contains(U'>')) base_name = base_name.substr(base_name.indexOf(U'>') + 1);
+      if (base_name.starts_with(U'{') and base_name.contains(U'}')) base_name = base_name.substr(base_name.indexOf(U'}') + 1);
+      return base_name;
     }
     return room_name;
   }
@@ -25,6 +67,50 @@ class OnlineManager : public Multiplayer_Photon {
 private:
   IGame* game_handler_ = nullptr;
   Array<LocalPlayer> local_players_;
+  WriterPool writer_pool_; // 送信バッファのプール（scheduler_ より先に宣言する）
+  OutgoingScheduler scheduler_{ &writer_pool_ }; // 優先度付き送信キュー
+  Array<uint8> receive_buffer_; // 受信イベントを記録するときのバッファ（使い回す）
+  Session::Recorder recorder_; // イベントの記録先（記録しない場合は閉じたまま）
+  LocalRelay* relay_ = nullptr; // Photon の代わりに使うプロセス内の中継（nullptr なら Photon）
+  LocalRelay::ClientID relay_client_ = 0;
+  /* ホストの移行 */
+  LocalPlayerID host_id_ = -1; // 現在のホストのローカルID
+  static constexpr int32 default_player_ttl_ms = 10000;
+  int32 player_ttl_ms_ = default_player_ttl_ms; // 切断したプレイヤーが再参加できる時間（作成するルームに設定する, 0 ならホストを移行しない）
+  Optional<RoomName> last_room_name_; // 最後に参加したルーム（再参加用）
+  Stopwatch failover_stopwatch_; // ホストが抜けてから引き継ぎが終わるまで
+  Optional<Duration> last_failover_latency_;
+  /* 状態の不一致検出 */
+  DesyncDetector desync_;
+  std::function<void(const DesyncDetector::Desync&)> desync_handler_;
+  /* 観戦 */
+  static constexpr uint8 spectator_group = 1; // 観戦者が購読するインタレストグループ
+  uint8 spectator_slots_ = 0; // 作成するルームに加える観戦枠
+  RoomOptions room_options_; // 参加中のルームの設定
+  bool is_room_open_ = true; // 参加中のルームの参加可否（最後に設定した値）
+  Array<LocalPlayerID> player_ids_; // 対戦しているプレイヤー（ルームのそれ以外のメンバーは観戦者）
+  bool is_spectating_ = false;
+  SpectatorBatch::Encoder spectator_batch_; // 観戦者へ次にまとめて送る確定イベント
+  Duration spectator_batch_interval_ = 0.2s;
+  Stopwatch spectator_batch_stopwatch_;
+  Array<uint8> batch_buffer_; // 受信したまとめの1件分（差分の基準を兼ね、使い回す）
+  Stopwatch snapshot_request_stopwatch_; // スナップショットを要求してからの時間
+  /* マッチメイキング */
+  Matchmaking::Matchmaker matchmaker_;
+  String matchmaking_region_; // 自分のリージョン（未設定なら接続したリージョン）
+  int32 matchmaking_rating_ = 1500;
+  Optional<int32> matchmaking_since_; // ランダムマッチを待ち始めたサーバー時刻（ルームに入るか、ルームや接続から抜けたら探し直す）
+  void send_event_(uint8 event_code, const Serializer<MemoryWriter>& writer, const Optional<Array<LocalPlayerID>>& targets);
+  void send_snapshot_(const Optional<Array<LocalPlayerID>>& targets);
+  void finish_failover_(void);
+  void check_state_hash_(void);
+  Array<LocalPlayerID> get_player_ids_(void) const;
+  void create_room_(const String& room_name, uint8 max_players, const String& game_id, const RoomOptions& options);
+  String get_rule_(void) const { return game_handler_ ? game_handler_->get_rule() : String{}; }
+  void flush_spectator_batch_(void);
+  void receive_spectator_batch_(LocalPlayerID host_id, Deserializer<MemoryViewReader>& reader);
+  void request_snapshot_(LocalPlayerID host_id);
+  void update_host_id_(void);
   /* Photonのオーバーライド */
   void connectReturn(int32 errorCode, const String& errorString, const String& region, const String& cluster) override;
   void disconnectReturn() override;
@@ -32,31 +118,215 @@ private:
   void createRoomReturn(LocalPlayerID playerID, int32 errorCode, const String& errorString) override;
   void joinRoomEventAction(const LocalPlayer& newPlayer, const Array<LocalPlayerID>& playerIDs, bool isSelf) override;
   void leaveRoomEventAction(LocalPlayerID playerID, bool isInactive) override;
+  void hostChangedEventAction(LocalPlayerID newHostPlayerID, LocalPlayerID oldHostPlayerID) override;
   void leaveRoomReturn(int32 errorCode, const String& errorString) override;
   void customEventAction(LocalPlayerID playerID, uint8 eventCode, Deserializer<MemoryViewReader>& reader) override;
 public:
   using Multiplayer_Photon::Multiplayer_Photon;
+  /// @brief Photon の代わりにプロセス内の中継に接続する（負荷試験用）
+  /// @remark relay はこのマネージャより長く生存している必要がある
+  void connect_local(LocalRelay& relay, const StringView user_name, const Verbose verbose = Verbose::No) {
+    relay_ = &relay;
+    relay_client_ = relay.connect(*this, user_name);
+    m_verbose = verbose.getBool();
+  }
+  /* 以下のラッパーは中継に接続していれば中継を、そうでなければ Photon を使う */
+  bool is_host(void) const {
+    return relay_ ? relay_->is_host(relay_client_) : isHost();
+  }
+  bool is_in_room(void) const {
+    return relay_ ? relay_->is_in_room(relay_client_) : isInRoom();
+  }
+  bool is_in_lobby(void) const {
+    return relay_ ? relay_->is_in_lobby(relay_client_) : isInLobby();
+  }
+  String get_current_room_name(void) const {
+    return relay_ ? relay_->get_room_name(relay_client_) : getCurrentRoomName();
+  }
+  LocalPlayerID get_local_player_id(void) const {
+    return relay_ ? relay_->get_local_player_id(relay_client_) : getLocalPlayerID();
+  }
+  Array<LocalPlayer> get_local_players(void) const {
+    return relay_ ? relay_->get_local_players(relay_client_) : getLocalPlayers();
+  }
+  /// @brief 現在のホストのローカルID（ゲーム開始前は -1）
+  LocalPlayerID get_host_id(void) const {
+    return host_id_;
+  }
+  int32 get_server_time(void) const {
+    return relay_ ? relay_->get_server_time() : getServerTimeMillisec();
+  }
+  /// @brief ゲームIDごとのロビーに移る（ルーム一覧はそのゲームのルームだけになる）
+  void join_game_lobby(const StringView game_id) {
+    if (relay_) relay_->join_lobby(relay_client_, game_id);
+    else joinLobby(game_id);
+  }
+  /// @brief 今いるロビーのルーム名一覧を取得するラッパー
+  Array<RoomName> get_room_names(void) const {
+    return relay_ ? relay_->get_room_names(relay_client_) : getRoomNameList();
+  }
+  /// @brief ルームに参加するラッパー
+  void join_game_room(const RoomNameView room_name) {
+    if (relay_) relay_->join_room(relay_client_, room_name);
+    else joinRoom(room_name);
+  }
+  /// @brief 切断などで抜けたルームに再参加する（ルームに playerTTL が設定されている場合のみ）
+  void rejoin_game_room(void) {
+    if (not last_room_name_ or relay_) return;
+    rejoinRoom(*last_room_name_);
+  }
+  /// @brief ルームから退出するラッパー
+  void leave_game_room(void) {
+    if (relay_) relay_->leave_room(relay_client_);
+    else leaveRoom();
+  }
   /// @brief ルームの公開状態を設定するラッパー
+  /// @remark 観戦枠のあるルームは、対戦中も観戦者が見つけられるよう参加を締め切るまで一覧に残す
   void set_room_visible(bool is_visible) {
-    if (isInRoom()) setIsVisibleInCurrentRoom(is_visible);
+    if (not is_visible and room_options_.spectator_slots > 0 and is_room_open_) return;
+    if (relay_) relay_->set_room_visible(relay_client_, is_visible);
+    else if (isInRoom()) setIsVisibleInCurrentRoom(is_visible);
   }
-  /// @brief ルームの参加可否を設定するラッパー
+  /// @brief ルームの参加可否を設定するラッパー（観戦枠のあるルームは締め切ると一覧から隠す）
   void set_room_open(bool is_open) {
-    if (isInRoom()) setIsOpenInCurrentRoom(is_open);
+    is_room_open_ = is_open;
+    if (relay_) relay_->set_room_open(relay_client_, is_open);
+    else if (isInRoom()) setIsOpenInCurrentRoom(is_open);
+    if (not is_open and room_options_.spectator_slots > 0) set_room_visible(false);
+  }
+  /// @brief 参加中のルームの設定
+  const RoomOptions& get_room_options(void) const {
+    return room_options_;
   }
   /// @brief このネットワークマネージャが通知を送る先のゲームハンドラを設定
   void set_game_handler(IGame* handler) {
     game_handler_ = handler;
   }
-  /// @brief ゲームイベントを送信する
+  /// @brief サーバーと同期する（送信キューを予算の範囲で送り出してから同期）
+  void update(void) {
+    scheduler_.flush([this](const uint8 event_code, const Serializer<MemoryWriter>& writer, const Optional<Array<LocalPlayerID>>& targets) {
+      send_event_(event_code, writer, targets);
+    }, getBytesOut());
+    flush_spectator_batch_();
+    if (relay_) relay_->service(relay_client_);
+    else Multiplayer_Photon::update();
+    check_state_hash_();
+    recorder_.flush();
+  }
+  /// @brief ゲームイベントを即座に送信する（帯域予算を無視し、送った分は予算から差し引く）
+  /// @remark ゲームの操作や入力は queue_game_event() で送信キューに積み、update() でまとめて送る
+  /// @param targets 送信先のローカルID（unspecified なら自分以外の全員）
   template<class T>
-  void send_game_event(const uint8 event_code, const T& data) {
-    sendEvent(event_code, Serializer<MemoryWriter>{}(data));
+  void send_game_event(const uint8 event_code, const T& data, const Optional<Array<LocalPlayerID>>& targets = unspecified) {
+    Serializer<MemoryWriter> writer = writer_pool_.acquire();
+    writer(data);
+    send_event_(event_code, writer, targets);
+    scheduler_.consume(writer->getBlob().size());
+    writer_pool_.release(std::move(writer));
+  }
+  /// @brief ゲームイベントを優先度と期限付きで送信キューに積む
+  /// @param deadline 積んでからこの時間内に送れなければ破棄する（Critical は破棄しない）
+  template<class T>
+  void queue_game_event(const uint8 event_code, const T& data, const EventPriority priority = EventPriority::Normal,
+    const Duration deadline = 0.25s, const Optional<Array<LocalPlayerID>>& targets = unspecified) {
+    Serializer<MemoryWriter> writer = writer_pool_.acquire();
+    writer(data);
+    scheduler_.push(event_code, std::move(writer), targets, priority, deadline);
+  }
+  /// @brief 1秒あたりの送信バイト予算を設定する（0 で無制限）
+  void set_bandwidth_budget(const int32 bytes_per_sec) {
+    scheduler_.set_budget(bytes_per_sec);
   }
-  /// @brief ゲームIDを付与してルームを作成する
+  /// @brief 送信キューの統計情報
+  const OutgoingScheduler::Stats& get_scheduler_stats(void) const {
+    return scheduler_.get_stats();
+  }
+  /// @brief 送信バッファのプールの統計情報
+  const WriterPool::Stats& get_writer_pool_stats(void) const {
+    return writer_pool_.get_stats();
+  }
+  /// @brief 作成するルームで、切断したプレイヤーが再参加できる時間を設定する（0 なら再参加しない）
+  /// @remark 再参加を待つ間はホストが抜けてもゲームを続け、新しいホストがスナップショットで状態を引き継ぐ
+  void set_player_ttl(const Duration ttl) {
+    player_ttl_ms_ = static_cast<int32>(ttl.count() * 1000);
+  }
+  /// @brief 直近のホスト移行にかかった時間（ホスト退出から、新ホストの昇格またはスナップショットの適用まで）
+  const Optional<Duration>& get_last_failover_latency(void) const {
+    return last_failover_latency_;
+  }
+  /// @brief 何手ごとに状態ハッシュを交換するか
+  void set_desync_check_interval(const uint32 moves) {
+    desync_.set_interval(moves);
+  }
+  /// @brief 状態の不一致を検出したときに呼ぶ関数を設定する
+  void set_desync_handler(std::function<void(const DesyncDetector::Desync&)> handler) {
+    desync_handler_ = std::move(handler);
+  }
+  /// @brief 不一致を検出した相手の数
+  size_t get_desync_count(void) const {
+    return desync_.get_desync_count();
+  }
+  /// @brief create_game_room() で作成するルームに観戦枠を加える（観戦者はゲーム開始の人数に数えない）
+  /// @remark 観戦枠はルーム名に埋め込み、ロビーから観戦できるルームを見分けられるようにする
+  void set_spectator_slots(const uint8 slots) {
+    spectator_slots_ = slots;
+  }
+  /// @brief 観戦者へ確定イベントをまとめて送る間隔
+  void set_spectator_batch_interval(const Duration interval) {
+    spectator_batch_interval_ = interval;
+  }
+  /// @brief 自身が観戦者としてルームにいるか
+  bool is_spectator(void) const {
+    return is_spectating_;
+  }
+  /// @brief 対戦中のルームに観戦者として参加する（対戦が始まった後に参加したメンバーは観戦者になる）
+  void spectate_game_room(const RoomNameView room_name) {
+    join_game_room(room_name);
+  }
+  /// @brief ホストに現在の状態のスナップショットを送ってもらう（確定した操作を適用できなかったときなど）
+  /// @remark 応答を待つ間に何度呼ばれても、要求は1秒に1回までにする
+  void request_snapshot(void) {
+    if (not is_host() and host_id_ >= 0) request_snapshot_(host_id_);
+  }
+  /// @brief ランダムマッチで使う自分のリージョンとレーティングを設定する
+  void set_matchmaking_profile(const StringView region, const int32 rating) {
+    matchmaking_region_ = region;
+    matchmaking_rating_ = rating;
+  }
+  /// @brief リージョンごとの RTT や採点基準を設定するためのマッチメイカー
+  Matchmaking::Matchmaker& get_matchmaker(void) {
+    return matchmaker_;
+  }
+  /// @brief 送受信イベントとルームのコールバックのファイルへの記録を開始する
+  bool start_recording(const FilePathView path) {
+    return recorder_.open(path);
+  }
+  /// @brief 記録を終了する
+  void stop_recording(void) {
+    recorder_.close();
+  }
+  bool is_recording(void) const {
+    return recorder_.is_open();
+  }
+  /// @brief 現在のルームのプレイヤーでゲームハンドラにゲーム開始を通知する
+  void start_game(void) {
+    if (not game_handler_) return;
+    local_players_ = get_local_players();
+    update_host_id_();
+    // 先に参加した人数分だけが対戦し、残りは観戦者になる
+    player_ids_ = get_player_ids_();
+    const Array<LocalPlayer> players = local_players_.filter([&](const LocalPlayer& player) { return player_ids_.contains(player.localID); });
+    desync_.reset();
+    // 参加した側もルーム名のルールにそろえてから開始する
+    if (not room_options_.rule.isEmpty() and not game_handler_->set_rule(room_options_.rule)) {
+      if (m_verbose) Print << U"[エラー] ルールを設定できません: " << room_options_.rule;
+    }
+    recorder_.write_game_start(get_local_player_id(), players, is_host(), get_server_time());
+    game_handler_->on_game_start(players, is_host());
+  }
+  /// @brief ゲームIDと設定（観戦枠・ゲームハンドラのルール）を付与してルームを作成する
   void create_game_room(const String& room_name, uint8 max_players, const String& game_id) {
-    const String prefixed_room_name = RoomNameHelper::create(room_name, game_id);
-    Multiplayer_Photon::createRoom(prefixed_room_name, max_players);
+    create_room_(room_name, max_players, game_id, RoomOptions{ .spectator_slots = spectator_slots_, .rule = get_rule_() });
   }
   /// @brief ゲームIDを指定してランダムなルールに参加、無ければ作成
   void join_random_game_room(const String& game_id) {
@@ -64,22 +334,40 @@ public:
       if (m_verbose) Print << U"[エラー] GameHandlerが未設定";
       return;
     }
-    const Array<RoomName> room_list = getRoomNameList();
-    Array<String> candidate_rooms;
-    for (const RoomName& room : room_list) {
-      if (RoomNameHelper::get_game_id(room) == game_id) {
-        candidate_rooms.push_back(room);
-      }
-    }
-    if (candidate_rooms.empty()) {
-      if (m_verbose) Print << U"[参加可能なルームが見つからず、新規作成します]";
-      const RoomName new_room_name = (getUserName() + U"'s room-" + ToHex(RandomUint32()));
-      create_game_room(new_room_name, game_handler_->get_max_players(), game_id);
+    join_game_lobby(game_id);
+    // ルールが違うルームには入らない
+    const String rule = get_rule_();
+    const Array<RoomName> room_list = get_room_names().filter([&](const RoomName& room) { return RoomNameHelper::parse_options(room).rule == rule; });
+    // 待ち時間が長くなるほど、レーティング差と RTT の許容範囲を広げる
+    const int32 now = get_server_time();
+    if (not matchmaking_since_) matchmaking_since_ = now;
+    const Matchmaking::Ticket ticket{ .game_id = game_id, .region = matchmaking_region_,
+      .rating = matchmaking_rating_, .queued_at = *matchmaking_since_ };
+    if (const Optional<RoomName> room = matchmaker_.find(ticket, room_list, now)) {
+      join_game_room(*room);
     } else {
-      joinRoom(candidate_rooms.choice());
+      if (m_verbose) Print << U"[参加可能なルームが見つからず、新規作成します]";
+      const String& user_name = relay_ ? relay_->get_user_name(relay_client_) : getUserName();
+      const Matchmaking::RoomTags tags{ matchmaking_region_, matchmaking_rating_, now };
+      const RoomName new_room_name = Matchmaking::encode_tags(tags) + user_name + U"'s room-" + ToHex(RandomUint32());
+      // ランダムマッチのルームは対戦中に一覧から隠すので、観戦枠を設けない
+      create_room_(new_room_name, game_handler_->get_max_players(), game_id, RoomOptions{ .rule = rule });
     }
   }
-  void debug(void) const {};
+  void debug(void) const {
+    const OutgoingScheduler::Stats& stats = scheduler_.get_stats();
+    Print << U"queue: {} (peak {}), sent: {}, dropped: {} stale / {} superseded"_fmt(
+      stats.queue_depth, stats.peak_queue_depth, stats.sent_events, stats.dropped_stale, stats.dropped_superseded);
+    Print << U"out: {:.0f} B/s (budget {} B/s)"_fmt(stats.measured_bytes_per_sec, scheduler_.get_budget());
+    const WriterPool::Stats& pool = writer_pool_.get_stats();
+    Print << U"writers: {} in use (high water {}), {} created, largest {} B"_fmt(
+      pool.in_use, pool.high_water, pool.created, pool.largest_buffer);
+    if (last_failover_latency_) Print << U"failover: {:.1f} ms"_fmt(last_failover_latency_->count() * 1000);
+    const SpectatorBatch::Stats& batch = spectator_batch_.get_stats();
+    if (batch.events > 0) Print << U"spectator batches: {} events, {} B -> {} B"_fmt(batch.events, batch.raw_bytes, batch.encoded_bytes);
+    if (is_spectating_) Print << U"spectating";
+    else if (not player_ids_.isEmpty() and local_players_.size() > player_ids_.size()) Print << U"spectators: {}"_fmt(local_players_.size() - player_ids_.size());
+  }
 };
 
 inline void OnlineManager::connectReturn(
@@ -91,6 +379,7 @@ inline void OnlineManager::connectReturn(
     if (m_verbose) Print << U"[サーバへの接続に失敗] " << errorString;
     return;
   }
+  if (matchmaking_region_.isEmpty()) matchmaking_region_ = region;
   if (m_verbose) {
     Print << U"[サーバへの接続に成功] region: " << region;
     Print << U"ユーザ名: {}, ユーザ ID: {}"_fmt(getUserName(), getUserID());
@@ -100,6 +389,8 @@ inline void OnlineManager::connectReturn(
 inline void OnlineManager::disconnectReturn() {
   if (m_verbose) Print << U"OnlineManager::disconnectReturn()";
   local_players_.clear();
+  scheduler_.clear();
+  matchmaking_since_.reset();
 }
 
 inline void OnlineManager::joinRandomRoomReturn(
@@ -136,29 +427,87 @@ inline void OnlineManager::joinRoomEventAction(
   const LocalPlayer& newPlayer, [[maybe_unused]] const Array<LocalPlayerID>& playerIDs, const bool isSelf) {
 
   if (m_verbose) Print << U"OnlineManager::joinRoomEventAction()";
-  local_players_ = getLocalPlayers();
-  // プレイヤーが揃ったら、ゲームハンドラにゲーム開始を通知
-  if (game_handler_ and local_players_.size() == game_handler_->get_max_players()) {
-    game_handler_->on_game_start(local_players_, isHost());
+  local_players_ = get_local_players();
+  if (isSelf) {
+    // ルームに入ったのでランダムマッチの待ち時間を数え終える
+    matchmaking_since_.reset();
+    // 参加したルームの設定（観戦枠）はルーム名から読む
+    room_options_ = RoomNameHelper::parse_options(get_current_room_name());
+    is_room_open_ = true;
+    if (not relay_) last_room_name_ = getCurrentRoomName();
+  }
+  if (not game_handler_) return;
+  if (isSelf and local_players_.size() > game_handler_->get_max_players()
+    and not get_player_ids_().contains(newPlayer.localID)) {
+    // 対戦が始まった後に参加したので観戦者になり、ホストからのスナップショットとまとめを待つ
+    is_spectating_ = true;
+    player_ids_ = get_player_ids_();
+    // start_game() を通らないので、まとめやスナップショットの送り主をここで覚える
+    update_host_id_();
+    if (relay_) relay_->change_groups(relay_client_, {}, { spectator_group });
+    else changeInterestGroups({}, { spectator_group });
+    return;
+  }
+  if (is_spectating_) return;
+  if (game_handler_->is_started()) {
+    // 対戦中に再参加したプレイヤーや観戦者には、ホストが現在の状態を送る
+    if (not isSelf and is_host()) send_snapshot_(Array<LocalPlayerID>{ newPlayer.localID });
+    return;
+  }
+  // プレイヤーが揃ったら、ゲームハンドラにゲーム開始を通知（観戦者は人数に数えない）
+  if (local_players_.size() >= game_handler_->get_max_players()) {
+    start_game();
   }
 }
 
-inline void OnlineManager::leaveRoomEventAction(const LocalPlayerID playerID, [[maybe_unused]] const bool isInactive) {
+inline void OnlineManager::leaveRoomEventAction(const LocalPlayerID playerID, const bool isInactive) {
   if (m_verbose) Print << U"OnlineManager::leaveRoomEventAction()";
-  local_players_ = getLocalPlayers();
+  local_players_ = get_local_players();
+  if (playerID == host_id_) failover_stopwatch_.restart();
+  // 再参加を待っている間はゲームを続ける
+  if (isInactive) return;
+  // 観戦者の退出はゲームに関係しない
+  if (not player_ids_.isEmpty() and not player_ids_.contains(playerID)) return;
   // ゲームハンドラにプレイヤーの退出を通知
   if (game_handler_) {
+    recorder_.write(Session::RecordKind::PlayerLeft, playerID, 0, get_server_time(), nullptr, 0);
     game_handler_->on_player_left(playerID);
   }
 }
 
+inline void OnlineManager::hostChangedEventAction(const LocalPlayerID newHostPlayerID, const LocalPlayerID oldHostPlayerID) {
+  if (m_verbose) Print << U"OnlineManager::hostChangedEventAction()";
+  if (not failover_stopwatch_.isRunning() and oldHostPlayerID == host_id_) failover_stopwatch_.restart();
+  host_id_ = newHostPlayerID;
+  if (not game_handler_) return;
+  const uint8 self_is_host = is_host();
+  recorder_.write(Session::RecordKind::HostChanged, newHostPlayerID, 0, get_server_time(), &self_is_host, 1);
+  // ゲームハンドラにルームの管理を引き継がせる
+  game_handler_->on_host_changed(self_is_host);
+  if (self_is_host and game_handler_->is_started()) {
+    // 新しいホストの状態を正として全員にそろえる
+    send_snapshot_(unspecified);
+    finish_failover_();
+  } else if (not game_handler_->is_started()) {
+    failover_stopwatch_.reset(); // 引き継ぐゲームがない
+  }
+}
+
 inline void OnlineManager::leaveRoomReturn(
   [[maybe_unused]] int32 errorCode, [[maybe_unused]] const String& errorString) {
 
   if (m_verbose) Print << U"OnlineManager::leaveRoomReturn()";
   local_players_.clear();
+  scheduler_.clear();
+  player_ids_.clear();
+  is_spectating_ = false;
+  matchmaking_since_.reset();
+  spectator_batch_.clear();
+  room_options_ = {};
+  is_room_open_ = true;
   // ゲームハンドラに自身が退出したことを通知
   if (game_handler_) {
+    recorder_.write(Session::RecordKind::LeaveRoom, get_local_player_id(), 0, get_server_time(), nullptr, 0);
     game_handler_->on_leave_room();
   }
 }
@@ -166,10 +515,158 @@ inline void OnlineManager::leaveRoomReturn(
 inline void OnlineManager::customEventAction(
   const LocalPlayerID playerID, const uint8 eventCode, Deserializer<MemoryViewReader>& reader) {
 
+  if (not game_handler_) return;
+  if (recorder_.is_open()) {
+    // 読み出し位置を進めずにペイロードを記録する
+    receive_buffer_.resize(static_cast<size_t>(reader->size()));
+    reader->lookahead(receive_buffer_.data(), receive_buffer_.size());
+    recorder_.write(Session::RecordKind::Incoming, playerID, eventCode, get_server_time(), receive_buffer_.data(), receive_buffer_.size());
+  }
+  // ホストからのスナップショットで状態を置き換える
+  if (eventCode == ReservedEventCode::snapshot) {
+    // 正となる状態を持つのはホストだけなので、ホスト以外からのスナップショットや自分がホストのときは適用しない
+    if (playerID != host_id_ or is_host()) {
+      if (m_verbose) Print << U"[エラー] ホスト以外からのスナップショットを無視します";
+      return;
+    }
+    if (not game_handler_->read_snapshot(reader)) {
+      // 形式の異なるクライアントからのスナップショットは適用しない
+      if (m_verbose) Print << U"[エラー] スナップショットを読み込めません";
+      return;
+    }
+    snapshot_request_stopwatch_.reset();
+    finish_failover_();
+    check_state_hash_();
+    return;
+  }
+  // ホストがまとめて送った確定イベントを順に適用する
+  if (eventCode == ReservedEventCode::spectator_batch) {
+    receive_spectator_batch_(playerID, reader);
+    return;
+  }
+  // 欠落を検出した観戦者や、確定を適用できなかったプレイヤーにスナップショットを送り直す
+  if (eventCode == ReservedEventCode::snapshot_request) {
+    if (is_host()) send_snapshot_(Array<LocalPlayerID>{ playerID });
+    return;
+  }
+  // 相手の状態ハッシュは照合待ちにする
+  if (eventCode == ReservedEventCode::state_hash) {
+    DesyncDetector::HashReport report;
+    reader(report);
+    desync_.receive(playerID, std::move(report));
+    check_state_hash_();
+    return;
+  }
   // ゲームハンドラにイベント受信をそのまま通知
-  if (game_handler_) {
-    game_handler_->on_event_received(playerID, eventCode, reader);
+  game_handler_->on_event_received(playerID, eventCode, reader);
+  check_state_hash_();
+}
+
+inline void OnlineManager::send_event_(
+  const uint8 event_code, const Serializer<MemoryWriter>& writer, const Optional<Array<LocalPlayerID>>& targets) {
+
+  Optional<Array<LocalPlayerID>> resolved_targets = targets;
+  if (not targets and not player_ids_.isEmpty() and local_players_.size() > player_ids_.size()) {
+    // 全員宛てのイベントは対戦相手にだけ送り、観戦者にはホストがまとめて送る
+    const LocalPlayerID self_id = get_local_player_id();
+    resolved_targets = player_ids_.filter([&](const LocalPlayerID id) { return id != self_id; });
+    if (is_host() and event_code < ReservedEventCode::reserved_begin) {
+      const Blob& blob = writer->getBlob();
+      spectator_batch_.append(event_code, reinterpret_cast<const uint8*>(blob.data()), blob.size());
+    }
+  }
+  if (relay_) relay_->send(relay_client_, event_code, writer->getBlob(), resolved_targets);
+  else sendEvent(event_code, writer, resolved_targets);
+  if (recorder_.is_open()) {
+    const Blob& blob = writer->getBlob();
+    recorder_.write(Session::RecordKind::Outgoing, get_local_player_id(), event_code, get_server_time(), blob.data(), blob.size());
+  }
+}
+
+inline void OnlineManager::send_snapshot_(const Optional<Array<LocalPlayerID>>& targets) {
+  if (not game_handler_) return;
+  Serializer<MemoryWriter> writer = writer_pool_.acquire();
+  game_handler_->write_snapshot(writer);
+  send_event_(ReservedEventCode::snapshot, writer, targets);
+  scheduler_.consume(writer->getBlob().size());
+  writer_pool_.release(std::move(writer));
+}
+
+inline void OnlineManager::check_state_hash_(void) {
+  if (not game_handler_ or not game_handler_->is_started() or is_spectating_) return;
+  if (const Optional<DesyncDetector::HashReport> report = desync_.record(game_handler_->get_state_hash())) {
+    // 報告は取りこぼしても次の報告で照合できるので、予算超過時に間引かれる優先度で送る
+    queue_game_event(ReservedEventCode::state_hash, *report, EventPriority::Low, 1s);
+  }
+  for (const DesyncDetector::Desync& desync : desync_.check()) {
+    if (m_verbose) Print << U"[状態の不一致] player: {}, move: {}"_fmt(desync.player_id, desync.move);
+    if (desync_handler_) desync_handler_(desync);
   }
 }
 
+inline Array<LocalPlayerID> OnlineManager::get_player_ids_(void) const {
+  // ローカルIDは参加順に振られるので、小さい順に最大人数までが対戦するプレイヤー
+  Array<LocalPlayerID> ids = local_players_.map([](const LocalPlayer& player) { return player.localID; });
+  ids.sort();
+  if (game_handler_ and ids.size() > game_handler_->get_max_players()) ids.resize(game_handler_->get_max_players());
+  return ids;
+}
 
+inline void OnlineManager::create_room_(const String& room_name, const uint8 max_players, const String& game_id, const RoomOptions& options) {
+  join_game_lobby(game_id);
+  const String prefixed_room_name = RoomNameHelper::create(room_name, game_id, options);
+  const uint8 capacity = static_cast<uint8>(Min(max_players + options.spectator_slots, 255));
+  if (relay_) relay_->create_room(relay_client_, prefixed_room_name, capacity);
+  else Multiplayer_Photon::createRoom(prefixed_room_name, capacity, player_ttl_ms_);
+}
+
+inline void OnlineManager::flush_spectator_batch_(void) {
+  if (spectator_batch_.get_count() == 0 or not game_handler_) return;
+  if (spectator_batch_stopwatch_.isRunning() and spectator_batch_stopwatch_.elapsed() < spectator_batch_interval_) return;
+  spectator_batch_stopwatch_.restart();
+  // 観戦者は何人いてもグループ宛てに1回だけ送る
+  Serializer<MemoryWriter> writer = writer_pool_.acquire();
+  writer(game_handler_->get_state_hash(), spectator_batch_.get_count());
+  const Blob& batch = spectator_batch_.get_blob();
+  writer->write(batch.data(), batch.size());
+  if (relay_) relay_->send_to_group(relay_client_, ReservedEventCode::spectator_batch, writer->getBlob(), spectator_group);
+  else sendEventToGroup(ReservedEventCode::spectator_batch, writer, spectator_group);
+  scheduler_.consume(writer->getBlob().size());
+  writer_pool_.release(std::move(writer));
+  spectator_batch_.clear();
+}
+
+inline void OnlineManager::receive_spectator_batch_(const LocalPlayerID host_id, Deserializer<MemoryViewReader>& reader) {
+  if (not is_spectating_) return;
+  StateHash expected;
+  uint16 events = 0;
+  reader(expected, events);
+  const bool is_complete = SpectatorBatch::decode(reader, events, batch_buffer_, [&](const uint8 event_code, Deserializer<MemoryViewReader>& event_reader) {
+    game_handler_->on_event_received(host_id, event_code, event_reader);
+  });
+  if (not is_complete and m_verbose) Print << U"[エラー] 観戦のまとめを読み切れません";
+  // スナップショットより前のまとめを取りこぼしていたら、ホストに送り直してもらう
+  const StateHash actual = game_handler_->get_state_hash();
+  if (actual.moves == expected.moves and actual.hash == expected.hash) return;
+  request_snapshot_(host_id);
+}
+
+inline void OnlineManager::request_snapshot_(const LocalPlayerID host_id) {
+  if (snapshot_request_stopwatch_.isRunning() and snapshot_request_stopwatch_.elapsed() < 1s) return;
+  snapshot_request_stopwatch_.restart();
+  send_game_event(ReservedEventCode::snapshot_request, uint8{ 0 }, Array<LocalPlayerID>{ host_id });
+}
+
+inline void OnlineManager::update_host_id_(void) {
+  host_id_ = -1;
+  for (const LocalPlayer& player : local_players_) {
+    if (player.isHost) host_id_ = player.localID;
+  }
+}
+
+inline void OnlineManager::finish_failover_(void) {
+  if (not failover_stopwatch_.isRunning()) return;
+  last_failover_latency_ = failover_stopwatch_.elapsed();
+  failover_stopwatch_.reset();
+  if (m_verbose) Print << U"[ホスト移行] {:.1f} ms"_fmt(last_failover_latency_->count() * 1000);
+}
@@ -0,0 +1,129 @@
+﻿# pragma once
+# include <Siv3D.hpp>
+# include "BitPacking.hpp"
+
+namespace BitPacking {
+
+  /// @brief 0 ~ 3 の値をとる要素を1要素2ビットに詰めて保持する2次元配列
+  /// @tparam T 値が 0 ~ 3 の列挙型または整数型
+  /// @remark 各行は 64 ビットの語の境界から始まり、行末の余りのビットは常に 0 にしておく。
+  ///         そのため数え上げや行単位の判定は、語ごとのビット演算と popcount で 32 要素ずつ行える
+  template<class T>
+  class PackedGrid {
+  public:
+    static constexpr uint32 bits = 2; // 1要素のビット数
+    static constexpr size_t values_per_word = 64 / bits; // 1語に入る要素数
+    static constexpr uint64 low_bits = 0x5555555555555555ull; // 各要素の下位ビット
+    PackedGrid() = default;
+    PackedGrid(const size_t width, const size_t height, const T value = T{}) { assign(width, height, value); }
+    void assign(size_t width, size_t height, T value);
+    void assign(const Size& size, const T value) { assign(size.x, size.y, value); }
+    void clear(void) {
+      words_.clear();
+      width_ = height_ = words_per_row_ = 0;
+    }
+    size_t width(void) const { return width_; }
+    size_t height(void) const { return height_; }
+    Size size(void) const { return Size{ static_cast<int32>(width_), static_cast<int32>(height_) }; }
+    size_t size_elements(void) const { return width_ * height_; }
+    bool isEmpty(void) const { return size_elements() == 0; }
+    bool inBounds(const Point& pos) const {
+      return (0 <= pos.x) and (0 <= pos.y) and (static_cast<size_t>(pos.x) < width_) and (static_cast<size_t>(pos.y) < height_);
+    }
+    /// @brief 要素の値（範囲外は未定義）
+    T at(const size_t y, const size_t x) const {
+      return static_cast<T>((words_[y * words_per_row_ + x / values_per_word] >> (x % values_per_word * bits)) & 0b11);
+    }
+    T operator[](const Point& pos) const { return at(pos.y, pos.x); }
+    void set(const Point& pos, T value);
+    /// @brief 値が value の要素の数
+    size_t count(T value) const;
+    /// @brief 保持しているビット列のバイト数
+    size_t size_bytes(void) const { return words_.size() * sizeof(uint64); }
+    /// @brief 1行あたりの語の数
+    size_t words_per_row(void) const { return words_per_row_; }
+    /// @brief y 行目の i 番目の語（要素 x は i = x / values_per_word 語目の 2 * (x % values_per_word) ビット目から。行の外は 0）
+    uint64 word(const size_t y, const size_t i) const { return (i < words_per_row_) ? words_[y * words_per_row_ + i] : 0; }
+    /// @brief 値が 0 でない要素の下位ビットだけを立てた語
+    static constexpr uint64 nonzero_mask(const uint64 word) { return (word | (word >> 1)) & low_bits; }
+    /// @brief 値が value の要素の下位ビットだけを立てた語（行末の余りは value == 0 なら立つので、呼び出し側で除く）
+    static constexpr uint64 match_mask(const uint64 word, const T value) {
+      return ~nonzero_mask(word ^ (low_bits * static_cast<uint64>(value))) & low_bits;
+    }
+    /// @brief 各行の i 番目の語のうち、行の中にある要素の下位ビットを立てた語
+    uint64 valid_mask(const size_t i) const {
+      const size_t begin = i * values_per_word;
+      if (begin >= width_) return 0;
+      const size_t count = Min(width_ - begin, values_per_word);
+      return (count == values_per_word) ? low_bits : (low_bits & ((uint64{ 1 } << (count * bits)) - 1));
+    }
+    /// @brief 要素を行優先で1つずつ bits ビットとして書き込む（Writer::write_grid と同じ並び）
+    void write(Writer& writer) const;
+    /// @brief write() で書き込んだ要素を読み出す（読み出す大きさに確保しておく）
+    void read(Reader& reader);
+  private:
+    Array<uint64> words_;
+    size_t width_ = 0;
+    size_t height_ = 0;
+    size_t words_per_row_ = 0;
+  };
+
+  template<class T>
+  inline void PackedGrid<T>::assign(const size_t width, const size_t height, const T value) {
+    width_ = width;
+    height_ = height;
+    words_per_row_ = (width + values_per_word - 1) / values_per_word;
+    words_.assign(words_per_row_ * height, 0);
+    if (static_cast<uint64>(value) == 0) return;
+    const uint64 pattern = low_bits * static_cast<uint64>(value);
+    for (size_t y = 0; y < height_; ++y) {
+      for (size_t i = 0; i < words_per_row_; ++i) {
+        const uint64 mask = valid_mask(i);
+        words_[y * words_per_row_ + i] = pattern & (mask | (mask << 1));
+      }
+    }
+  }
+
+  template<class T>
+  inline void PackedGrid<T>::set(const Point& pos, const T value) {
+    uint64& word = words_[pos.y * words_per_row_ + pos.x / values_per_word];
+    const uint32 shift = static_cast<uint32>(pos.x % values_per_word * bits);
+    word = (word & ~(uint64{ 0b11 } << shift)) | (static_cast<uint64>(value) << shift);
+  }
+
+  template<class T>
+  inline size_t PackedGrid<T>::count(const T value) const {
+    size_t result = 0;
+    for (size_t y = 0; y < height_; ++y) {
+      for (size_t i = 0; i < words_per_row_; ++i) {
+        result += std::popcount(match_mask(words_[y * words_per_row_ + i], value) & valid_mask(i));
+      }
+    }
+    return result;
+  }
+
+  template<class T>
+  inline void PackedGrid<T>::write(Writer& writer) const {
+    for (size_t y = 0; y < height_; ++y) {
+      // 1語を 16 要素（32 ビット）ずつ書き込み、行末は残りの要素の分だけ書く
+      for (size_t x = 0; x < width_; x += values_per_word / 2) {
+        const uint64 word = words_[y * words_per_row_ + x / values_per_word] >> (x % values_per_word * bits);
+        const size_t count = Min(width_ - x, values_per_word / 2);
+        writer.write(static_cast<uint32>(word), static_cast<uint32>(count * bits));
+      }
+    }
+  }
+
+  template<class T>
+  inline void PackedGrid<T>::read(Reader& reader) {
+    for (size_t y = 0; y < height_; ++y) {
+      for (size_t x = 0; x < width_; x += values_per_word / 2) {
+        const size_t count = Min(width_ - x, values_per_word / 2);
+        const uint64 chunk = reader.read(static_cast<uint32>(count * bits));
+        uint64& word = words_[y * words_per_row_ + x / values_per_word];
+        const uint32 shift = static_cast<uint32>(x % values_per_word * bits);
+        word = (word & ~(uint64{ 0xFFFFFFFF } << shift)) | (chunk << shift);
+      }
+    }
+  }
+}
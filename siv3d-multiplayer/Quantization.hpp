@@ -0,0 +1,232 @@
+﻿# pragma once
+# include <Siv3D.hpp>
+
+// 位置・回転などの連続値をネットワーク送信用に量子化するユーティリティ
+namespace Quantize {
+
+  /// @brief 量子化の方式
+  enum class Mode : uint8 {
+    Full = 0, // 無圧縮（float32）
+    Fixed16 = 1, // 範囲を指定した16bit固定小数点
+    Half = 2, // 16bit半精度浮動小数点
+  };
+
+  /// @brief 範囲 [min, max] を Bits ビットの固定小数点で表現する
+  template<uint32 Bits>
+  struct FixedPoint {
+    static_assert(2 <= Bits and Bits <= 32);
+    static constexpr uint32 max_code = static_cast<uint32>((uint64{ 1 } << Bits) - 1);
+    /// @brief 値を符号化する（範囲外の値は範囲内に丸める）
+    static constexpr uint32 encode(const double value, const double min, const double max) {
+      if (not (min < max)) return 0;
+      const double t = Clamp((value - min) / (max - min), 0.0, 1.0);
+      return static_cast<uint32>(t * max_code + 0.5);
+    }
+    /// @brief 符号を値に復号する
+    static constexpr double decode(const uint32 code, const double min, const double max) {
+      return min + (max - min) * (static_cast<double>(code) / max_code);
+    }
+    /// @brief 範囲内の値を往復させたときの最大誤差
+    static constexpr double max_error(const double min, const double max) {
+      return (max - min) / max_code / 2;
+    }
+  };
+
+  using Fixed16 = FixedPoint<16>;
+
+  /// @brief float を IEEE 754 半精度のビット列に変換する（最近接偶数丸め）
+  inline constexpr uint16 to_half(const float value) {
+    const uint32 bits = std::bit_cast<uint32>(value);
+    const uint32 sign = (bits >> 16) & 0x8000;
+    const uint32 exponent = (bits >> 23) & 0xFF;
+    uint32 mantissa = bits & 0x7FFFFF;
+    // NaN / 無限大
+    if (exponent == 0xFF) {
+      return static_cast<uint16>(sign | 0x7C00 | (mantissa ? 0x200 : 0));
+    }
+    const int32 half_exponent = static_cast<int32>(exponent) - 127 + 15;
+    // オーバーフローは無限大
+    if (half_exponent >= 0x1F) {
+      return static_cast<uint16>(sign | 0x7C00);
+    }
+    // 非正規化数またはゼロ
+    if (half_exponent <= 0) {
+      if (half_exponent < -10) return static_cast<uint16>(sign);
+      mantissa |= 0x800000;
+      const uint32 shift = static_cast<uint32>(14 - half_exponent);
+      uint32 half_mantissa = mantissa >> shift;
+      const uint32 rest = mantissa & ((1u << shift) - 1);
+      const uint32 halfway = 1u << (shift - 1);
+      if (rest > halfway or (rest == halfway and (half_mantissa & 1))) ++half_mantissa;
+      return static_cast<uint16>(sign | half_mantissa);
+    }
+    uint32 half = sign | (static_cast<uint32>(half_exponent) << 10) | (mantissa >> 13);
+    const uint32 rest = mantissa & 0x1FFF;
+    // 繰り上がりで指数部に溢れても正しい値（または無限大）になる
+    if (rest > 0x1000 or (rest == 0x1000 and (half & 1))) ++half;
+    return static_cast<uint16>(half);
+  }
+
+  /// @brief IEEE 754 半精度のビット列を float に変換する
+  inline constexpr float from_half(const uint16 half) {
+    const uint32 sign = static_cast<uint32>(half & 0x8000) << 16;
+    const uint32 exponent = (half >> 10) & 0x1F;
+    uint32 mantissa = half & 0x3FF;
+    if (exponent == 0x1F) {
+      return std::bit_cast<float>(sign | 0x7F800000 | (mantissa << 13));
+    }
+    if (exponent == 0) {
+      if (mantissa == 0) return std::bit_cast<float>(sign);
+      // 非正規化数を正規化する
+      int32 e = -1;
+      do {
+        ++e;
+        mantissa <<= 1;
+      } while ((mantissa & 0x400) == 0);
+      return std::bit_cast<float>(sign | (static_cast<uint32>(127 - 15 - e) << 23) | ((mantissa & 0x3FF) << 13));
+    }
+    return std::bit_cast<float>(sign | ((exponent - 15 + 127) << 23) | (mantissa << 13));
+  }
+
+  /// @brief 半精度で表せる有限の最大値
+  constexpr double half_max = 65504.0;
+
+  /// @brief 絶対値が max_abs 以下の値を半精度で往復させたときの最大誤差
+  /// @remark half_max を超える値は無限大になるので、誤差も無限大を返す
+  inline double half_max_error(const double max_abs) {
+    if (max_abs <= 0.0) return 0.0;
+    if (max_abs > half_max) return std::numeric_limits<double>::infinity();
+    // 仮数部10bit, 丸めで半ulp（先に float へ丸める分も含める）
+    const int32 exponent = Max(static_cast<int32>(std::floor(std::log2(max_abs))), -14);
+    return std::ldexp(1.0, exponent - 11) + max_abs * std::ldexp(1.0, -24);
+  }
+
+  /// @brief 範囲 range 内の座標をモード mode で往復させたときの各成分の最大誤差
+  inline double max_error(const Mode mode, const RectF& range) {
+    switch (mode) {
+    case Mode::Fixed16:
+      return Max(Fixed16::max_error(range.x, range.x + range.w), Fixed16::max_error(range.y, range.y + range.h));
+    case Mode::Half: {
+      const double max_abs = Max({ Abs(range.x), Abs(range.x + range.w), Abs(range.y), Abs(range.y + range.h) });
+      return half_max_error(max_abs);
+    }
+    default:
+      // float32 の丸め誤差
+      return Max({ Abs(range.x), Abs(range.x + range.w), Abs(range.y), Abs(range.y + range.h) }) * std::ldexp(1.0, -24);
+    }
+  }
+
+  /// @brief 量子化された2次元座標
+  /// @remark range は送信側と受信側で同じもの（例: Scene::Rect()）を使う
+  struct QuantizedVec2 {
+    Mode mode = Mode::Full;
+    uint32 x = 0; // Full は float のビット列, それ以外は下位16bitを使う
+    uint32 y = 0;
+    QuantizedVec2() = default;
+    QuantizedVec2(const Vec2& pos, const Mode mode, const RectF& range)
+      : mode(mode) {
+      switch (mode) {
+      case Mode::Fixed16:
+        x = Fixed16::encode(pos.x, range.x, range.x + range.w);
+        y = Fixed16::encode(pos.y, range.y, range.y + range.h);
+        break;
+      case Mode::Half:
+        x = to_half(static_cast<float>(pos.x));
+        y = to_half(static_cast<float>(pos.y));
+        break;
+      default:
+        x = std::bit_cast<uint32>(static_cast<float>(pos.x));
+        y = std::bit_cast<uint32>(static_cast<float>(pos.y));
+        break;
+      }
+# if SIV3D_BUILD(DEBUG)
+      // 範囲内の値は最大誤差以内で復元できることを確認（double の計算誤差の分だけ余裕を持たせる）
+      if (range.contains(pos)) {
+        const Vec2 decoded = decode(range);
+        const double bound = max_error(mode, range) * (1 + 1e-9);
+        assert(Abs(decoded.x - pos.x) <= bound and Abs(decoded.y - pos.y) <= bound);
+      }
+# endif
+    }
+    /// @brief 座標を復号する
+    Vec2 decode(const RectF& range) const {
+      switch (mode) {
+      case Mode::Fixed16:
+        return { Fixed16::decode(x, range.x, range.x + range.w), Fixed16::decode(y, range.y, range.y + range.h) };
+      case Mode::Half:
+        return { from_half(static_cast<uint16>(x)), from_half(static_cast<uint16>(y)) };
+      default:
+        return { std::bit_cast<float>(x), std::bit_cast<float>(y) };
+      }
+    }
+    template<class Archive>
+    void SIV3D_SERIALIZE(Archive& archive) {
+      // 方式を先に読み書きし、方式ごとに必要なビット幅だけ送る
+      archive(mode);
+      if (mode == Mode::Full) {
+        archive(x, y);
+      } else {
+        uint16 x16 = static_cast<uint16>(x), y16 = static_cast<uint16>(y);
+        archive(x16, y16);
+        x = x16;
+        y = y16;
+      }
+    }
+  };
+
+  /// @brief 2次元の回転角を16bitに量子化する
+  inline uint16 encode_angle(const double radian) {
+    const double t = std::fmod(radian, Math::TwoPi);
+    return static_cast<uint16>(FixedPoint<16>::encode(t < 0 ? t + Math::TwoPi : t, 0.0, Math::TwoPi));
+  }
+  inline double decode_angle(const uint16 code) {
+    return FixedPoint<16>::decode(code, 0.0, Math::TwoPi);
+  }
+  /// @brief 角度の最大誤差（ラジアン）
+  inline constexpr double angle_max_error(void) {
+    return FixedPoint<16>::max_error(0.0, Math::TwoPi);
+  }
+
+  /// @brief 単位クォータニオン (x, y, z, w) を smallest-three 方式で32bitに量子化する
+  /// @remark 絶対値最大の成分を捨て、残り3成分を各10bitで送る
+  struct SmallestThree {
+    static constexpr double component_range = Math::InvSqrt2;
+    using Component = FixedPoint<10>;
+    static uint32 encode(const Float4& q) {
+      const std::array<float, 4> v{ q.x, q.y, q.z, q.w };
+      uint32 largest = 0;
+      for (uint32 i = 1; i < 4; ++i) {
+        if (Abs(v[i]) > Abs(v[largest])) largest = i;
+      }
+      // q と -q は同じ回転なので、捨てる成分を正にそろえる
+      const float sign = (v[largest] < 0) ? -1.0f : 1.0f;
+      uint32 packed = largest << 30;
+      uint32 shift = 20;
+      for (uint32 i = 0; i < 4; ++i) {
+        if (i == largest) continue;
+        packed |= Component::encode(v[i] * sign, -component_range, component_range) << shift;
+        shift -= 10;
+      }
+      return packed;
+    }
+    static Float4 decode(const uint32 packed) {
+      const uint32 largest = packed >> 30;
+      std::array<float, 4> v{};
+      double sum = 0.0;
+      uint32 shift = 20;
+      for (uint32 i = 0; i < 4; ++i) {
+        if (i == largest) continue;
+        const double c = Component::decode((packed >> shift) & Component::max_code, -component_range, component_range);
+        v[i] = static_cast<float>(c);
+        sum += c * c;
+        shift -= 10;
+      }
+      v[largest] = static_cast<float>(std::sqrt(Max(0.0, 1.0 - sum)));
+      return { v[0], v[1], v[2], v[3] };
+    }
+    /// @brief 送信する3成分それぞれの最大誤差
+    static constexpr double max_error(void) {
+      return Component::max_error(-component_range, component_range);
+    }
+  };
+}
@@ -0,0 +1,251 @@
+﻿# pragma once
+# include <Siv3D.hpp>
+# include "IGame.hpp"
+# include "OnlineManager.hpp"
+# include "Lockstep.hpp"
+
+// ローカル入力を即座に適用し、相手の入力は予測して進め、予測が外れたら確定フレームから再シミュレーションする方式
+namespace Rollback {
+
+  using Lockstep::InputMessage;
+  using Lockstep::PlayerInput;
+
+  struct Stats {
+    uint32 frame = 0; // 次に進めるフレーム
+    uint32 confirmed_frame = 0; // 全員の入力が確定しているフレーム数
+    uint64 mispredictions = 0; // 予測が外れた入力の数
+    uint64 rollbacks = 0; // 巻き戻した回数
+    uint32 last_rollback_depth = 0; // 直近に巻き戻したフレーム数
+    uint32 max_rollback_depth = 0;
+    uint64 resimulated_frames = 0; // 再シミュレーションしたフレームの累計
+    double last_resimulation_us = 0.0; // 直近の再シミュレーションにかかった時間
+    double max_resimulation_us = 0.0;
+    uint64 stalled_frames = 0; // 予測できる範囲を超えて止まった回数
+  };
+
+  /// @brief ロールバックで進める IGame の基底クラス
+  /// @tparam State save_state / load_state でやり取りするゲーム状態（コピー可能）
+  /// @tparam Input 1フレーム分の入力（既定構築可能・== で比較可能で SIV3D_SERIALIZE を持つ）
+  /// @remark 相手の入力は最後に確定した入力が続くと予測する
+  template<class State, class Input>
+  class Game : public IGame {
+  private:
+    struct InputHistory {
+      Array<Input> confirmed; // 確定した入力（フレーム % window_ のリングバッファ）
+      Array<Input> used; // シミュレーションに使った入力（予測を含む）
+      int64 confirmed_until = -1; // ここまでのフレームは入力が確定している
+    };
+    Duration tick_duration_;
+    uint32 input_delay_;
+    uint32 max_rollback_frames_; // 確定フレームより先に予測で進めてよいフレーム数
+    size_t window_ = 0;
+    Array<State> states_; // states_[f % window_] はフレーム f を進める前の状態（事前に確保して使い回す）
+    Array<LocalPlayerID> players_; // ローカルID順
+    HashTable<LocalPlayerID, InputHistory> histories_;
+    Array<PlayerInput<Input>> frame_inputs_; // 毎フレーム使い回す
+    LocalPlayerID self_id_ = 0;
+    uint32 frame_ = 0; // 次に進めるフレーム
+    uint32 next_input_frame_ = 0; // 次にローカル入力を割り当てるフレーム
+    Optional<uint32> rollback_to_; // 予測が外れた最も古いフレーム
+    double accumulator_ = 0.0;
+    bool is_started_ = false;
+    Stats stats_;
+    void resize_window_(void);
+    void confirm_(LocalPlayerID player_id, uint32 frame, const Input& input);
+    const Input& input_for_(const InputHistory& history, uint32 frame) const;
+    int64 min_confirmed_(void) const;
+    void send_input_(void);
+    void simulate_frame_(void);
+    void rollback_(void);
+  protected:
+    OnlineManager* network_ = nullptr;
+    /// @brief このフレームのローカル入力を返す
+    virtual Input sample_input(void) = 0;
+    /// @brief 現在のゲーム状態を state に書き出す（既存の領域を使い回せるよう上書きで渡す）
+    virtual void save_state(State& state) const = 0;
+    /// @brief ゲーム状態を state に戻す
+    virtual void load_state(const State& state) = 0;
+    /// @brief 全プレイヤーの入力（ローカルID順）でゲームを1フレーム進める（描画や効果音は行わない）
+    virtual void advance_frame(const Array<PlayerInput<Input>>& inputs) = 0;
+    /// @brief ゲームの初期状態を作る
+    virtual void on_simulation_start(const Array<LocalPlayerID>& players, bool is_host) = 0;
+  public:
+    /// @param tick_duration 1フレームの長さ
+    /// @param max_rollback_frames 巻き戻せる最大フレーム数（60 fps で 8 フレームなら片道 130 ms 程度まで遅延なしで動く）
+    /// @param input_delay ローカル入力を適用するまでのフレーム数（0 で即時）
+    explicit Game(const Duration tick_duration = SecondsF{ 1.0 / 60 }, const uint32 max_rollback_frames = 8, const uint32 input_delay = 0)
+      : tick_duration_(tick_duration), input_delay_(input_delay), max_rollback_frames_(Max<uint32>(max_rollback_frames, 1)) {
+      resize_window_();
+    }
+    void set_network(OnlineManager* network) override { network_ = network; }
+    bool is_started(void) const override { return is_started_; }
+    bool is_turn(void) const override { return is_started_; }
+    void update(void) override {}
+    void tick(const double dt) override { advance(dt); }
+    /// @brief 経過時間 dt の分だけフレームを進める（ヘッドレス実行では任意の dt で呼ぶ）
+    void advance(double dt);
+    /// @brief 入力遅延と巻き戻し幅を設定する（全員で同じ値にし、ゲーム開始前に呼ぶ）
+    void set_window(const uint32 max_rollback_frames, const uint32 input_delay) {
+      if (is_started_) return;
+      max_rollback_frames_ = Max<uint32>(max_rollback_frames, 1);
+      input_delay_ = input_delay;
+      resize_window_();
+    }
+    const Stats& get_stats(void) const { return stats_; }
+    void on_game_start(const Array<LocalPlayer>& players, bool is_host) override;
+    void on_player_left(LocalPlayerID player_id) override;
+    void on_leave_room(void) override;
+    void on_host_changed([[maybe_unused]] bool is_host) override {}
+    void on_event_received(LocalPlayerID player_id, uint8 event_code, Deserializer<MemoryViewReader>& reader) override;
+  };
+
+  template<class State, class Input>
+  inline void Game<State, Input>::resize_window_(void) {
+    // 相手は自分より最大で max_rollback_frames_ + input_delay_ + 1 フレーム先まで入力を送ってくる
+    window_ = 2 * (max_rollback_frames_ + input_delay_) + 2;
+    states_.resize(window_);
+  }
+
+  template<class State, class Input>
+  inline void Game<State, Input>::on_game_start(const Array<LocalPlayer>& players, const bool is_host) {
+    players_.clear();
+    for (const LocalPlayer& player : players) players_ << player.localID;
+    players_.sort();
+    self_id_ = network_ ? network_->get_local_player_id() : (players_.isEmpty() ? 0 : players_.front());
+    if (players_.isEmpty()) players_ << self_id_;
+    histories_.clear();
+    // 入力遅延の間のフレームは全員の既定入力で確定させておく
+    for (const LocalPlayerID id : players_) {
+      InputHistory& history = histories_[id];
+      history.confirmed.assign(window_, Input{});
+      history.used.assign(window_, Input{});
+      history.confirmed_until = static_cast<int64>(input_delay_) - 1;
+    }
+    frame_inputs_.clear();
+    frame_inputs_.reserve(players_.size());
+    frame_ = 0;
+    next_input_frame_ = input_delay_;
+    rollback_to_.reset();
+    accumulator_ = 0.0;
+    stats_ = {};
+    is_started_ = true;
+    on_simulation_start(players_, is_host);
+  }
+
+  template<class State, class Input>
+  inline void Game<State, Input>::on_player_left(const LocalPlayerID player_id) {
+    // 抜けたプレイヤーの入力は予測も待ちもしない
+    players_.remove(player_id);
+    histories_.erase(player_id);
+  }
+
+  template<class State, class Input>
+  inline void Game<State, Input>::on_leave_room(void) {
+    is_started_ = false;
+    players_.clear();
+    histories_.clear();
+    rollback_to_.reset();
+  }
+
+  template<class State, class Input>
+  inline void Game<State, Input>::on_event_received(const LocalPlayerID player_id, const uint8 event_code, Deserializer<MemoryViewReader>& reader) {
+    if (event_code != ReservedEventCode::rollback_input) return;
+    InputMessage<Input> message;
+    reader(message);
+    confirm_(player_id, message.tick, message.input);
+  }
+
+  template<class State, class Input>
+  inline void Game<State, Input>::confirm_(const LocalPlayerID player_id, const uint32 frame, const Input& input) {
+    const auto it = histories_.find(player_id);
+    if (it == histories_.end()) return;
+    InputHistory& history = it->second;
+    // 送信者ごとに順序どおり届くので、連続していない入力（重複など）は捨てる
+    if (static_cast<int64>(frame) != history.confirmed_until + 1) return;
+    history.confirmed[frame % window_] = input;
+    history.confirmed_until = frame;
+    // 既に予測で進めたフレームなら、使った入力と比べて外れていれば巻き戻す
+    if (frame < frame_ and not (history.used[frame % window_] == input)) {
+      ++stats_.mispredictions;
+      rollback_to_ = rollback_to_ ? Min(*rollback_to_, frame) : frame;
+    }
+  }
+
+  template<class State, class Input>
+  inline const Input& Game<State, Input>::input_for_(const InputHistory& history, const uint32 frame) const {
+    if (static_cast<int64>(frame) <= history.confirmed_until) return history.confirmed[frame % window_];
+    // 未確定のフレームは最後に確定した入力が続くと予測する
+    if (history.confirmed_until >= 0) return history.confirmed[history.confirmed_until % window_];
+    static const Input default_input{};
+    return default_input;
+  }
+
+  template<class State, class Input>
+  inline int64 Game<State, Input>::min_confirmed_(void) const {
+    int64 result = static_cast<int64>(frame_) + input_delay_;
+    for (const auto& [id, history] : histories_) result = Min(result, history.confirmed_until);
+    return result;
+  }
+
+  template<class State, class Input>
+  inline void Game<State, Input>::send_input_(void) {
+    const InputMessage<Input> message{ next_input_frame_, sample_input() };
+    ++next_input_frame_;
+    confirm_(self_id_, message.tick, message.input);
+    if (network_) network_->queue_game_event(ReservedEventCode::rollback_input, message, EventPriority::Critical);
+  }
+
+  template<class State, class Input>
+  inline void Game<State, Input>::simulate_frame_(void) {
+    save_state(states_[frame_ % window_]);
+    frame_inputs_.clear();
+    for (const LocalPlayerID id : players_) {
+      InputHistory& history = histories_[id];
+      const Input& input = input_for_(history, frame_);
+      history.used[frame_ % window_] = input;
+      frame_inputs_.push_back({ id, input });
+    }
+    advance_frame(frame_inputs_);
+    ++frame_;
+  }
+
+  template<class State, class Input>
+  inline void Game<State, Input>::rollback_(void) {
+    const uint32 target = frame_;
+    const uint32 from = *rollback_to_;
+    rollback_to_.reset();
+    const uint64 start_ns = Time::GetNanosec();
+    load_state(states_[from % window_]);
+    frame_ = from;
+    while (frame_ < target) simulate_frame_();
+    const double elapsed_us = (Time::GetNanosec() - start_ns) / 1000.0;
+    ++stats_.rollbacks;
+    stats_.last_rollback_depth = target - from;
+    stats_.max_rollback_depth = Max(stats_.max_rollback_depth, stats_.last_rollback_depth);
+    stats_.resimulated_frames += target - from;
+    stats_.last_resimulation_us = elapsed_us;
+    stats_.max_resimulation_us = Max(stats_.max_resimulation_us, elapsed_us);
+  }
+
+  template<class State, class Input>
+  inline void Game<State, Input>::advance(const double dt) {
+    if (not is_started_) return;
+    const double tick_seconds = tick_duration_.count();
+    accumulator_ = Min(accumulator_ + dt, tick_seconds * max_rollback_frames_);
+    // 遅れて届いた入力で予測が外れていれば、まず正しい入力でやり直す
+    if (rollback_to_) rollback_();
+    while (accumulator_ >= tick_seconds) {
+      // ネットワークから切り離されている（記録を再生している）間は、記録された自分の入力で確定させる
+      if (network_ and next_input_frame_ <= frame_ + input_delay_) send_input_();
+      // 確定フレームから max_rollback_frames_ より先へは予測で進めない
+      if (frame_ >= min_confirmed_() + 1 + max_rollback_frames_) {
+        ++stats_.stalled_frames;
+        break;
+      }
+      simulate_frame_();
+      accumulator_ -= tick_seconds;
+    }
+    stats_.frame = frame_;
+    stats_.confirmed_frame = static_cast<uint32>(Max<int64>(min_confirmed_() + 1, 0));
+  }
+}
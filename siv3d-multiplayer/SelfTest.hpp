@@ -0,0 +1,544 @@
+﻿# pragma once
+# include <Siv3D.hpp>
+# include "Quantization.hpp"
+# include "SpectatorBatch.hpp"
+# include "Interpolation.hpp"
+# include "DotsAndBoxes.hpp"
+# include "LocalRelay.hpp"
+# include "OnlineManager.hpp"
+# include "Lockstep.hpp"
+# include "Rollback.hpp"
+# include "SessionRecorder.hpp"
+
+// 実行環境でロジックの性質（往復の誤差・決定性など）を確かめる自己診断（ヘッドレス実行の `--selftest` で実行する）
+namespace SelfTest {
+
+  /// @brief 1 項目の診断結果
+  struct Check {
+    String name;
+    bool passed = false;
+    String detail; // 不合格のときの内容
+  };
+
+  inline Check make_check(const StringView name, const bool passed, const String& detail = U"") {
+    return { String{ name }, passed, passed ? String{} : detail };
+  }
+
+  inline String format(const Check& check) {
+    return U"{:<48} {}"_fmt(check.name, check.passed ? U"ok" : (U"FAILED " + check.detail));
+  }
+
+  /// @brief double の計算誤差の分だけ余裕を持たせて誤差の上限と比べる
+  inline bool within(const double error, const double bound) {
+    return error <= bound * (1 + 1e-9);
+  }
+
+  /// @brief 量子化した値を直列化して往復させ、誤差が各方式の max_error 以内に収まるかを確かめる
+  inline Array<Check> check_quantization(void) {
+    Array<Check> checks;
+    constexpr int32 samples = 10000;
+    const auto check_vec2 = [&](const Quantize::Mode mode, const StringView mode_name, const StringView range_name,
+      const RectF& range, const size_t expected_bytes) {
+      const double bound = Quantize::max_error(mode, range);
+      double worst = 0.0;
+      size_t bytes = 0;
+      Serializer<MemoryWriter> writer;
+      for (int32 i = 0; i < samples; ++i) {
+        const Vec2 pos = RandomVec2(range);
+        writer->clear();
+        writer(Quantize::QuantizedVec2{ pos, mode, range });
+        const Blob& blob = writer->getBlob();
+        bytes = blob.size();
+        Deserializer<MemoryViewReader> reader{ blob.data(), blob.size() };
+        Quantize::QuantizedVec2 decoded;
+        reader(decoded);
+        const Vec2 result = decoded.decode(range);
+        worst = Max({ worst, Abs(result.x - pos.x), Abs(result.y - pos.y) });
+      }
+      checks << make_check(U"quantize/vec2_{}_{}_error"_fmt(mode_name, range_name), within(worst, bound),
+        U"worst {} > bound {}"_fmt(worst, bound));
+      checks << make_check(U"quantize/vec2_{}_{}_bytes"_fmt(mode_name, range_name), bytes == expected_bytes,
+        U"{} bytes, expected {}"_fmt(bytes, expected_bytes));
+    };
+    const RectF screen{ 0, 0, 1280, 720 };
+    const RectF half_range{ -Quantize::half_max, -Quantize::half_max, 2 * Quantize::half_max, 2 * Quantize::half_max };
+    for (const auto& [range_name, range] : { std::pair{ U"screen"_sv, screen }, std::pair{ U"half_range"_sv, half_range } }) {
+      check_vec2(Quantize::Mode::Full, U"full", range_name, range, 9);
+      check_vec2(Quantize::Mode::Fixed16, U"fixed16", range_name, range, 5);
+      check_vec2(Quantize::Mode::Half, U"half", range_name, range, 5);
+    }
+    // 半精度で表せない範囲は誤差を有限と見なさない（符号化しても assert しない）
+    const RectF beyond_half{ 0, 0, 100000, 100 };
+    const Quantize::QuantizedVec2 overflow{ Vec2{ 70000, 50 }, Quantize::Mode::Half, beyond_half };
+    checks << make_check(U"quantize/vec2_half_beyond_range_bound", std::isinf(Quantize::max_error(Quantize::Mode::Half, beyond_half))
+      and std::isinf(overflow.decode(beyond_half).x), U"finite bound beyond {}"_fmt(Quantize::half_max));
+    // 角度は 2π の周期で比べる
+    double worst_angle = 0.0;
+    for (int32 i = 0; i < samples; ++i) {
+      const double angle = Random(-4 * Math::Pi, 4 * Math::Pi);
+      const double decoded = Quantize::decode_angle(Quantize::encode_angle(angle));
+      worst_angle = Max(worst_angle, Abs(std::remainder(decoded - angle, Math::TwoPi)));
+    }
+    checks << make_check(U"quantize/angle_error", within(worst_angle, Quantize::angle_max_error()),
+      U"worst {} > bound {}"_fmt(worst_angle, Quantize::angle_max_error()));
+    // クォータニオンは q と -q が同じ回転なので、内積の絶対値で比べる
+    double worst_dot = 0.0;
+    for (int32 i = 0; i < samples; ++i) {
+      const Vec4 v = Vec4{ Random(-1.0, 1.0), Random(-1.0, 1.0), Random(-1.0, 1.0), Random(-1.0, 1.0) };
+      if (v.length() < 1e-3) continue;
+      const Float4 q{ v.normalized() };
+      const Float4 decoded = Quantize::SmallestThree::decode(Quantize::SmallestThree::encode(q));
+      worst_dot = Max(worst_dot, 1.0 - Abs(static_cast<double>(q.dot(decoded))));
+    }
+    checks << make_check(U"quantize/smallest_three_error", worst_dot <= 1e-5, U"1 - |dot| = {}"_fmt(worst_dot));
+    return checks;
+  }
+
+  /// @brief 観戦のまとめの差分符号化が往復で元のイベント列に戻り、壊れたまとめを途中で止めるかを確かめる
+  inline Array<Check> check_spectator_batch(void) {
+    using Event = std::pair<uint8, Array<uint8>>;
+    Array<Check> checks;
+    const auto decode_all = [](const Blob& blob, const uint16 count, const size_t size, Array<Event>& decoded) {
+      Deserializer<MemoryViewReader> reader{ blob.data(), size };
+      Array<uint8> payload;
+      decoded.clear();
+      return SpectatorBatch::decode(reader, count, payload, [&](const uint8 event_code, Deserializer<MemoryViewReader>& event_reader) {
+        Array<uint8> bytes(static_cast<size_t>(event_reader->size()));
+        event_reader->read(bytes.data(), bytes.size());
+        decoded.emplace_back(event_code, std::move(bytes));
+      });
+    };
+    // 同じコード・同じ大きさ（差分になる）、同じコードで大きさが変わる、コードが変わる、まったく同じ、空のペイロードを並べる
+    const Array<Event> events{
+      { uint8{ 67 }, { 0, 0, 0, 0, 7, 0, 0, 0, 1, 2, 3, 4 } },
+      { uint8{ 67 }, { 1, 0, 0, 0, 7, 0, 0, 0, 1, 2, 3, 4 } },
+      { uint8{ 67 }, { 2, 0, 0, 0, 7 } },
+      { uint8{ 42 }, { 2, 0, 0, 0, 9 } },
+      { uint8{ 42 }, { 2, 0, 0, 0, 9 } },
+      { uint8{ 42 }, {} },
+    };
+    SpectatorBatch::Encoder encoder;
+    for (const auto& [code, bytes] : events) encoder.append(code, bytes.data(), bytes.size());
+    const Blob& blob = encoder.get_blob();
+    Array<Event> decoded;
+    const bool is_complete = decode_all(blob, encoder.get_count(), blob.size(), decoded);
+    checks << make_check(U"spectator_batch/round_trip", is_complete and decoded == events,
+      U"complete {}, {} of {} events decoded"_fmt(is_complete, decoded.size(), events.size()));
+    // 2件目と5件目は差分になり、生のペイロードと大きさの合計より小さくなるはず
+    const SpectatorBatch::Stats& stats = encoder.get_stats();
+    checks << make_check(U"spectator_batch/delta_smaller", stats.encoded_bytes < stats.raw_bytes + events.size() * (1 + sizeof(uint16)),
+      U"{} encoded bytes for {} raw bytes"_fmt(stats.encoded_bytes, stats.raw_bytes));
+    // 途中で切れたまとめは、読めたイベントまでを渡して false を返す
+    size_t bad_prefixes = 0;
+    for (size_t size = 0; size < blob.size(); ++size) {
+      const bool complete = decode_all(blob, encoder.get_count(), size, decoded);
+      const bool is_prefix = decoded.size() < events.size() and std::equal(decoded.begin(), decoded.end(), events.begin());
+      if (complete or not is_prefix) ++bad_prefixes;
+    }
+    checks << make_check(U"spectator_batch/truncated", bad_prefixes == 0, U"{} truncated sizes were accepted or misdecoded"_fmt(bad_prefixes));
+    // 差分の基準がない先頭のイベントが差分や同じコードを名乗っていたら読まない
+    for (const auto& [name, flags] : { std::pair{ U"first_delta"_sv, SpectatorBatch::Flag::delta }, std::pair{ U"first_same_code"_sv, SpectatorBatch::Flag::same_code } }) {
+      Serializer<MemoryWriter> writer;
+      writer(flags, uint8{ 67 }, uint8{ 0xFF }, uint8{ 1 });
+      const bool complete = decode_all(writer->getBlob(), 1, writer->getBlob().size(), decoded);
+      checks << make_check(U"spectator_batch/{}"_fmt(name), not complete and decoded.isEmpty(), U"accepted a {} first event"_fmt(name));
+    }
+    encoder.clear();
+    checks << make_check(U"spectator_batch/clear", encoder.get_count() == 0 and encoder.get_blob().isEmpty(), U"{} events left"_fmt(encoder.get_count()));
+    return checks;
+  }
+
+  /// @brief 補間バッファが、状態の間の補間・途切れたときの外挿・外挿の上限での停止を、サーバー時刻の桁あふれをまたいでも行うかを確かめる
+  inline Array<Check> check_interpolation(void) {
+    Array<Check> checks;
+    // 描画は 100 ms 遅らせ、最新の状態から 250 ms 先まで推測する
+    const auto make_buffer = [](const int32 base) {
+      Interpolation::SnapshotBuffer<double> buffer{ 0.1s, 0.25s };
+      for (uint32 i = 0; i < 3; ++i) buffer.push(static_cast<int32>(static_cast<uint32>(base) + 100 * i), 10.0 * i);
+      return buffer;
+    };
+    const auto check_value = [&](const StringView name, const Optional<double>& value, const double expected) {
+      checks << make_check(name, value and Abs(*value - expected) < 1e-9,
+        U"{}, expected {}"_fmt(value ? Format(*value) : String{ U"none" }, expected));
+    };
+    for (const auto& [name, base] : { std::pair{ U"interpolation"_sv, int32{ 1000 } }, std::pair{ U"interpolation_wrap"_sv, std::numeric_limits<int32>::max() - 150 } }) {
+      const Interpolation::SnapshotBuffer<double> buffer = make_buffer(base);
+      // render_ms は描画時刻の base からの経過（サーバー時刻は描画の遅れの分だけ先）
+      const auto at = [&](const int32 render_ms) { return buffer.sample(static_cast<int32>(static_cast<uint32>(base) + static_cast<uint32>(render_ms + 100))); };
+      check_value(U"{}/between_samples"_fmt(name), at(150), 15.0);
+      check_value(U"{}/before_first_sample"_fmt(name), at(-50), 0.0);
+      check_value(U"{}/extrapolate"_fmt(name), at(250), 25.0);
+      // 上限（最新の状態から 250 ms）を超えても、最新の状態に戻らず上限の位置に留まる
+      check_value(U"{}/hold_at_limit"_fmt(name), at(450), 45.0);
+      check_value(U"{}/hold_after_limit"_fmt(name), at(1200), 45.0);
+      const auto& stats = buffer.get_stats();
+      checks << make_check(U"{}/stats"_fmt(name), stats.interpolated == 1 and stats.extrapolated == 1 and stats.held == 2,
+        U"interpolated {}, extrapolated {}, held {}"_fmt(stats.interpolated, stats.extrapolated, stats.held));
+    }
+    // 順不同で届いても、桁あふれをまたいだ後の状態を新しいものとして後ろに並べる
+    Interpolation::SnapshotBuffer<double> reordered{ 0.1s, 0.25s };
+    const int32 base = std::numeric_limits<int32>::max() - 50;
+    reordered.push(static_cast<int32>(static_cast<uint32>(base) + 100), 10.0);
+    reordered.push(base, 0.0);
+    check_value(U"interpolation_wrap/out_of_order", reordered.sample(static_cast<int32>(static_cast<uint32>(base) + 150)), 5.0);
+    return checks;
+  }
+
+  /// @brief 2ビットに詰めた盤面を語単位で数える関数が、セルを1つずつ見る素朴な数え方と一致するかを確かめる
+  /// @remark 1語に 32 要素入るので、幅が 32 の倍数でない盤面（行末に余りのビットがある）を含める
+  inline Array<Check> check_packed_board(void) {
+    using DotsAndBoxes::LineColor;
+    Array<Check> checks;
+    constexpr int32 boards_per_size = 20;
+    for (const Size size : { Size{ 1, 1 }, Size{ 5, 3 }, Size{ 31, 4 }, Size{ 32, 3 }, Size{ 33, 5 }, Size{ 64, 2 }, Size{ 65, 3 }, Size{ 100, 7 } }) {
+      size_t mismatches = 0;
+      String detail;
+      for (int32 i = 0; i < boards_per_size; ++i) {
+        // 合法手をランダムに打ち、空から全て埋まるまでのいろいろな局面を作る
+        DotsAndBoxes::Board board;
+        board.initialize(size);
+        const size_t total_lines = static_cast<size_t>(size.x * (size.y + 1) + (size.x + 1) * size.y);
+        const size_t moves = Random<size_t>(0, total_lines);
+        for (size_t move = 0; move < moves; ++move) {
+          const Array<DotsAndBoxes::Operation> operations = board.get_legal_operations();
+          if (operations.isEmpty()) break;
+          board.operate(operations.choice());
+        }
+        const auto& horizontal = board.get_horizontal_lines();
+        const auto& vertical = board.get_vertical_lines();
+        const auto& owners = board.get_box_owners();
+        const auto is_drawn = [](const LineColor color) { return color != LineColor::None; };
+        size_t drawn_lines = 0;
+        for (size_t y = 0; y < horizontal.height(); ++y) {
+          for (size_t x = 0; x < horizontal.width(); ++x) drawn_lines += is_drawn(horizontal.at(y, x));
+        }
+        for (size_t y = 0; y < vertical.height(); ++y) {
+          for (size_t x = 0; x < vertical.width(); ++x) drawn_lines += is_drawn(vertical.at(y, x));
+        }
+        std::array<size_t, 3> boxes{};
+        Array<Point> three_sided;
+        for (int32 y = 0; y < size.y; ++y) {
+          for (int32 x = 0; x < size.x; ++x) {
+            ++boxes[static_cast<size_t>(owners.at(y, x))];
+            const int32 sides = is_drawn(horizontal.at(y, x)) + is_drawn(horizontal.at(y + 1, x)) + is_drawn(vertical.at(y, x)) + is_drawn(vertical.at(y, x + 1));
+            if (sides == 3) three_sided.emplace_back(x, y);
+          }
+        }
+        const Array<Point> actual_three_sided = board.get_three_sided_boxes();
+        const bool matched = (board.count_drawn_lines() == drawn_lines)
+          and (board.count_boxes(LineColor::Red) == boxes[static_cast<size_t>(LineColor::Red)])
+          and (board.count_boxes(LineColor::Blue) == boxes[static_cast<size_t>(LineColor::Blue)])
+          and (board.count_boxes(LineColor::None) == boxes[static_cast<size_t>(LineColor::None)])
+          and (actual_three_sided == three_sided);
+        if (not matched and mismatches++ == 0) {
+          detail = U"after {} moves: lines {}/{}, red {}/{}, blue {}/{}, three-sided {}/{}"_fmt(moves,
+            board.count_drawn_lines(), drawn_lines,
+            board.count_boxes(LineColor::Red), boxes[static_cast<size_t>(LineColor::Red)],
+            board.count_boxes(LineColor::Blue), boxes[static_cast<size_t>(LineColor::Blue)],
+            actual_three_sided.size(), three_sided.size());
+        }
+      }
+      checks << make_check(U"packed_board/dots_and_boxes_{}x{}"_fmt(size.x, size.y), mismatches == 0,
+        U"{} of {} boards differ, first {}"_fmt(mismatches, boards_per_size, detail));
+    }
+    return checks;
+  }
+
+  /// @brief 決定性の確認に使う入力（移動方向）
+  struct TestInput {
+    int8 dx = 0;
+    int8 dy = 0;
+    bool operator==(const TestInput&) const = default;
+    template<class Archive>
+    void SIV3D_SERIALIZE(Archive& archive) {
+      archive(dx, dy);
+    }
+  };
+
+  /// @brief 決定性の確認に使う状態（プレイヤーごとの位置と、進めたフレームを畳み込んだハッシュ）
+  struct TestState {
+    Array<Point> positions;
+    uint64 hash = 14695981039346656037ull;
+    uint32 frames = 0; // 進めたフレーム数
+  };
+
+  /// @brief index 番目（ローカルID順）のプレイヤーが frame に入力する値（数フレームごとに変わるので予測が外れる）
+  inline TestInput test_input(const size_t index, const uint32 frame) {
+    const uint32 phase = (frame / 3 + static_cast<uint32>(index) * 5) % 9;
+    return { static_cast<int8>(static_cast<int32>(phase % 3) - 1), static_cast<int8>(static_cast<int32>(phase / 3) - 1) };
+  }
+
+  /// @brief 入力（ローカルID順）で状態を1フレーム進める（各方式のゲームと基準のシミュレーションで共有する）
+  inline void step_test_state(TestState& state, const Array<Lockstep::PlayerInput<TestInput>>& inputs) {
+    for (size_t i = 0; i < inputs.size() and i < state.positions.size(); ++i) {
+      Point& pos = state.positions[i];
+      pos.x = (pos.x + inputs[i].input.dx + 64) % 64;
+      pos.y = (pos.y + inputs[i].input.dy + 64) % 64;
+      state.hash = (state.hash ^ static_cast<uint64>(pos.x * 64 + pos.y)) * 1099511628211ull;
+    }
+    ++state.frames;
+  }
+
+  /// @brief ネットワークを介さずに frames フレーム進めたときの、各フレームを進めた後のハッシュ
+  /// @param input_delay この数までのフレームは全員の既定入力で進める
+  inline Array<uint64> reference_hashes(const size_t players, const uint32 frames, const uint32 input_delay) {
+    TestState state{ Array<Point>(players, Point{ 0, 0 }) };
+    Array<Lockstep::PlayerInput<TestInput>> inputs(players);
+    Array<uint64> hashes(Arg::reserve = frames);
+    for (uint32 frame = 0; frame < frames; ++frame) {
+      for (size_t i = 0; i < players; ++i) {
+        inputs[i] = { static_cast<LocalPlayerID>(i), (frame < input_delay) ? TestInput{} : test_input(i, frame) };
+      }
+      step_test_state(state, inputs);
+      hashes << state.hash;
+    }
+    return hashes;
+  }
+
+  /// @brief index を sample_input() の入力に使うための、自分がローカルID順で何番目か
+  inline size_t self_index(const Array<LocalPlayerID>& players, const LocalPlayerID self_id) {
+    for (size_t i = 0; i < players.size(); ++i) {
+      if (players[i] == self_id) return i;
+    }
+    return 0;
+  }
+
+  /// @brief 決定性の確認用のロックステップのゲーム（ティックごとのハッシュを残す）
+  class LockstepTestGame : public Lockstep::Game<TestInput> {
+  private:
+    TestState state_;
+    Array<uint64> hashes_;
+    size_t self_index_ = 0;
+    uint32 next_input_tick_ = 0;
+  protected:
+    TestInput sample_input(void) override { return test_input(self_index_, next_input_tick_++); }
+    void simulate(const Array<Lockstep::PlayerInput<TestInput>>& inputs) override {
+      step_test_state(state_, inputs);
+      hashes_ << state_.hash;
+    }
+    void on_simulation_start(const Array<LocalPlayerID>& players, [[maybe_unused]] const bool is_host) override {
+      state_ = { Array<Point>(players.size(), Point{ 0, 0 }) };
+      hashes_.clear();
+      // 記録の再生中はネットワークから切り離され、自分の入力も記録から届く
+      self_index_ = network_ ? self_index(players, network_->get_local_player_id()) : 0;
+      next_input_tick_ = get_input_delay();
+    }
+  public:
+    using Lockstep::Game<TestInput>::Game;
+    String get_game_id(void) const override { return U"SelfTestLockstep"; }
+    uint8 get_max_players(void) const override { return 2; }
+    void draw([[maybe_unused]] const double alpha) const override {}
+    void debug(void) override {}
+    bool play_random_move(void) override { return false; }
+    void write_snapshot([[maybe_unused]] Serializer<MemoryWriter>& writer) const override {}
+    bool read_snapshot([[maybe_unused]] Deserializer<MemoryViewReader>& reader) override { return false; }
+    StateHash get_state_hash(void) const override { return { static_cast<uint32>(hashes_.size()), state_.hash }; }
+    bool is_finished(void) const override { return false; }
+    const Array<uint64>& get_hashes(void) const { return hashes_; }
+  };
+
+  /// @brief 決定性の確認用のロールバックのゲーム（フレームごとのハッシュを残し、巻き戻したフレームは上書きする）
+  class RollbackTestGame : public Rollback::Game<TestState, TestInput> {
+  private:
+    TestState state_;
+    Array<uint64> hashes_; // hashes_[f] はフレーム f を進めた後のハッシュ
+    size_t self_index_ = 0;
+    uint32 first_input_frame_ = 0; // 入力遅延の分だけ先のフレームから入力する
+    uint32 next_input_frame_ = 0;
+  protected:
+    TestInput sample_input(void) override { return test_input(self_index_, next_input_frame_++); }
+    void save_state(TestState& state) const override { state = state_; }
+    void load_state(const TestState& state) override { state_ = state; }
+    void advance_frame(const Array<Lockstep::PlayerInput<TestInput>>& inputs) override {
+      step_test_state(state_, inputs);
+      hashes_.resize(Max<size_t>(hashes_.size(), state_.frames));
+      hashes_[state_.frames - 1] = state_.hash;
+    }
+    void on_simulation_start(const Array<LocalPlayerID>& players, [[maybe_unused]] const bool is_host) override {
+      state_ = { Array<Point>(players.size(), Point{ 0, 0 }) };
+      hashes_.clear();
+      // 記録の再生中はネットワークから切り離され、自分の入力も記録から届く
+      self_index_ = network_ ? self_index(players, network_->get_local_player_id()) : 0;
+      next_input_frame_ = first_input_frame_;
+    }
+  public:
+    RollbackTestGame(const Duration tick_duration, const uint32 max_rollback_frames, const uint32 input_delay)
+      : Rollback::Game<TestState, TestInput>(tick_duration, max_rollback_frames, input_delay), first_input_frame_(input_delay) {}
+    String get_game_id(void) const override { return U"SelfTestRollback"; }
+    uint8 get_max_players(void) const override { return 2; }
+    void draw([[maybe_unused]] const double alpha) const override {}
+    void debug(void) override {}
+    bool play_random_move(void) override { return false; }
+    void write_snapshot([[maybe_unused]] Serializer<MemoryWriter>& writer) const override {}
+    bool read_snapshot([[maybe_unused]] Deserializer<MemoryViewReader>& reader) override { return false; }
+    /// @brief 予測で進めたフレームは相手と食い違うので、全員の入力が確定したフレームまでのハッシュを返す
+    StateHash get_state_hash(void) const override {
+      const uint32 frames = get_confirmed_frames();
+      return { frames, (frames == 0) ? 0 : hashes_[frames - 1] };
+    }
+    bool is_finished(void) const override { return false; }
+    /// @brief 全員の入力が確定したうえで進めたフレーム数（これより前のハッシュは巻き戻しで変わらない）
+    uint32 get_confirmed_frames(void) const { return Min(static_cast<uint32>(hashes_.size()), get_stats().confirmed_frame); }
+    const Array<uint64>& get_hashes(void) const { return hashes_; }
+  };
+
+  /// @brief 2つのクライアントを LocalRelay で同じルームに入れ、ゲームを frames 回ずつ dt だけ進める
+  /// @remark 相手のイベントは次の更新で送られ、その次の更新で届くので、2フレーム程度の遅延がある
+  /// @param record_path 空でなければ1つ目のクライアントのセッションをここに記録する
+  template<class Game>
+  void run_pair(std::array<Game, 2>& games, const int32 frames, const double dt, const FilePathView record_path = U"") {
+    LocalRelay relay; // マネージャより先に宣言して最後に破棄する
+    std::array<OnlineManager, 2> managers;
+    for (size_t i = 0; i < managers.size(); ++i) {
+      managers[i].connect_local(relay, U"selftest-{}"_fmt(i));
+      managers[i].set_game_handler(&games[i]);
+      games[i].set_network(&managers[i]);
+    }
+    if (not record_path.isEmpty()) managers[0].start_recording(record_path);
+    const String game_id = games[0].get_game_id();
+    managers[0].create_game_room(U"selftest", games[0].get_max_players(), game_id);
+    managers[1].join_game_lobby(game_id);
+    managers[1].join_game_room(RoomNameHelper::create(U"selftest", game_id));
+    for (int32 frame = 0; frame < frames; ++frame) {
+      for (OnlineManager& manager : managers) manager.update();
+      for (Game& game : games) game.advance(dt);
+    }
+    managers[0].stop_recording();
+    for (OnlineManager& manager : managers) manager.set_game_handler(nullptr);
+  }
+
+  /// @brief 2つのクライアントのロックステップが、ネットワークを介さないシミュレーションとティックごとに一致するかを確かめる
+  inline Array<Check> check_lockstep(void) {
+    Array<Check> checks;
+    constexpr uint32 ticks = 300;
+    constexpr uint32 input_delay = 3;
+    std::array<LockstepTestGame, 2> games{ LockstepTestGame{ SecondsF{ 1.0 / 30 }, input_delay }, LockstepTestGame{ SecondsF{ 1.0 / 30 }, input_delay } };
+    // 入力待ちで止まるティックの分だけ余分に回す
+    run_pair(games, ticks * 2, 1.0 / 30);
+    const Array<uint64> expected = reference_hashes(2, ticks, input_delay);
+    for (size_t i = 0; i < games.size(); ++i) {
+      const Array<uint64>& hashes = games[i].get_hashes();
+      checks << make_check(U"lockstep/client{}_ticks"_fmt(i), hashes.size() >= ticks, U"{} ticks, expected {}"_fmt(hashes.size(), ticks));
+      size_t mismatch = ticks;
+      for (size_t tick = 0; tick < Min<size_t>(hashes.size(), ticks); ++tick) {
+        if (hashes[tick] != expected[tick]) {
+          mismatch = tick;
+          break;
+        }
+      }
+      checks << make_check(U"lockstep/client{}_matches_reference"_fmt(i), mismatch == ticks, U"diverged at tick {}"_fmt(mismatch));
+    }
+    return checks;
+  }
+
+  /// @brief 2つのクライアントのロールバックが、予測と巻き戻しを経ても予測なしのシミュレーションと一致するかを確かめる
+  inline Array<Check> check_rollback(void) {
+    Array<Check> checks;
+    constexpr uint32 frames = 600;
+    const Duration tick_duration = SecondsF{ 1.0 / 60 };
+    std::array<RollbackTestGame, 2> games{ RollbackTestGame{ tick_duration, 8, 0 }, RollbackTestGame{ tick_duration, 8, 0 } };
+    run_pair(games, frames * 2, 1.0 / 60);
+    const Array<uint64> expected = reference_hashes(2, frames * 2, 0);
+    for (size_t i = 0; i < games.size(); ++i) {
+      const RollbackTestGame& game = games[i];
+      const uint32 confirmed = game.get_confirmed_frames();
+      checks << make_check(U"rollback/client{}_frames"_fmt(i), confirmed >= frames, U"{} confirmed frames, expected {}"_fmt(confirmed, frames));
+      // 相手の入力が遅れて届くので、予測が外れて巻き戻していなければ確認にならない
+      checks << make_check(U"rollback/client{}_rolled_back"_fmt(i), game.get_stats().rollbacks > 0, U"no rollbacks");
+      uint32 mismatch = confirmed;
+      for (uint32 frame = 0; frame < confirmed; ++frame) {
+        if (game.get_hashes()[frame] != expected[frame]) {
+          mismatch = frame;
+          break;
+        }
+      }
+      checks << make_check(U"rollback/client{}_matches_no_rollback"_fmt(i), mismatch == confirmed, U"diverged at frame {}"_fmt(mismatch));
+    }
+    return checks;
+  }
+
+  /// @brief ロックステップの対戦を記録し、記録だけから同じティック列を再生できるかを確かめる
+  /// @remark 自分の入力は送信イベントとしてしか記録されないので、それも再生しなければ input_delay のティックで止まる
+  inline Array<Check> check_replay(void) {
+    Array<Check> checks;
+    constexpr uint32 ticks = 120;
+    constexpr uint32 input_delay = 3;
+    const FilePath path = FileSystem::TemporaryDirectoryPath() + U"siv3d-multiplayer-selftest.s3mr";
+    std::array<LockstepTestGame, 2> games{ LockstepTestGame{ SecondsF{ 1.0 / 30 }, input_delay }, LockstepTestGame{ SecondsF{ 1.0 / 30 }, input_delay } };
+    run_pair(games, ticks * 2, 1.0 / 30, path);
+    {
+      Session::Replay replay;
+      const bool is_opened = replay.open(path);
+      checks << make_check(U"replay/open", is_opened, U"cannot open {}"_fmt(path));
+      if (is_opened) {
+        // 記録をすべて渡してから、届いた入力の分だけティックを進める
+        LockstepTestGame replayed{ SecondsF{ 1.0 / 30 }, input_delay };
+        replay.play_all(replayed);
+        for (uint32 i = 0; i < ticks * 2; ++i) replayed.advance(1.0 / 30);
+        const Array<uint64>& expected = games[0].get_hashes();
+        const Array<uint64>& actual = replayed.get_hashes();
+        checks << make_check(U"replay/lockstep_ticks", actual.size() >= Min<size_t>(expected.size(), ticks),
+          U"{} ticks, expected {}"_fmt(actual.size(), Min<size_t>(expected.size(), ticks)));
+        size_t mismatch = Min(actual.size(), expected.size());
+        for (size_t tick = 0; tick < mismatch; ++tick) {
+          if (actual[tick] != expected[tick]) {
+            mismatch = tick;
+            break;
+          }
+        }
+        checks << make_check(U"replay/lockstep_matches_session", mismatch == Min(actual.size(), expected.size()), U"diverged at tick {}"_fmt(mismatch));
+      }
+    }
+    FileSystem::Remove(path);
+    return checks;
+  }
+
+  /// @brief 2つのクライアントが LocalRelay でランダムマッチを呼び、同じルームに入るかを確かめる
+  /// @remark 1人目がランダムマッチで作ったルームと、「Create Room」で作った属性のないルームの両方に2人目が入れること
+  inline Array<Check> check_random_match(void) {
+    Array<Check> checks;
+    for (const bool is_first_random : { true, false }) {
+      LocalRelay relay; // マネージャより先に宣言して最後に破棄する
+      std::array<LockstepTestGame, 2> games{ LockstepTestGame{ SecondsF{ 1.0 / 30 }, 3 }, LockstepTestGame{ SecondsF{ 1.0 / 30 }, 3 } };
+      std::array<OnlineManager, 2> managers;
+      for (size_t i = 0; i < managers.size(); ++i) {
+        managers[i].connect_local(relay, U"selftest-{}"_fmt(i));
+        managers[i].set_game_handler(&games[i]);
+        games[i].set_network(&managers[i]);
+      }
+      const String game_id = games[0].get_game_id();
+      if (is_first_random) {
+        managers[0].join_random_game_room(game_id);
+      } else {
+        managers[0].join_game_lobby(game_id);
+        managers[0].create_game_room(U"selftest", games[0].get_max_players(), game_id);
+      }
+      for (OnlineManager& manager : managers) manager.update();
+      managers[1].join_random_game_room(game_id);
+      for (int32 i = 0; i < 4; ++i) {
+        for (OnlineManager& manager : managers) manager.update();
+      }
+      const String first_room = managers[0].get_current_room_name();
+      const String second_room = managers[1].get_current_room_name();
+      checks << make_check(U"matchmaking/{}_same_room"_fmt(is_first_random ? U"random_room" : U"untagged_room"),
+        managers[0].is_in_room() and managers[1].is_in_room() and first_room == second_room,
+        U"rooms \"{}\" and \"{}\""_fmt(first_room, second_room));
+      for (OnlineManager& manager : managers) manager.set_game_handler(nullptr);
+    }
+    return checks;
+  }
+
+  /// @brief すべての項目を実行する
+  inline Array<Check> run_all(void) {
+    Array<Check> checks;
+    checks.append(check_quantization());
+    checks.append(check_spectator_batch());
+    checks.append(check_interpolation());
+    checks.append(check_packed_board());
+    checks.append(check_lockstep());
+    checks.append(check_rollback());
+    checks.append(check_replay());
+    checks.append(check_random_match());
+    return checks;
+  }
+}
@@ -0,0 +1,304 @@
+﻿# pragma once
+# include <Siv3D.hpp>
+# include "IGame.hpp"
+# include "OnlineManager.hpp"
+
+// ホストが操作に通し番号を振って確定順を決め、各クライアントは未確定の自分の操作を予測として重ねて表示する
+namespace Sequencing {
+
+  /// @brief ホストに確定を依頼する操作（ReservedEventCode::sequenced_proposal）
+  template<class Operation>
+  struct Proposal {
+    uint32 client_seq = 0; // 送信者ごとの通し番号
+    Operation op;
+    template<class Archive>
+    void SIV3D_SERIALIZE(Archive& archive) {
+      archive(client_seq, op);
+    }
+  };
+
+  /// @brief ホストが確定した操作（ゲームの Operation::code で全員に送る）
+  template<class Operation>
+  struct Commit {
+    uint32 seq = 0; // 確定順の通し番号
+    LocalPlayerID author = 0; // 操作したプレイヤー
+    uint32 client_seq = 0; // author の Proposal の番号（author への確認応答を兼ねる）
+    Operation op;
+    template<class Archive>
+    void SIV3D_SERIALIZE(Archive& archive) {
+      archive(seq, author, client_seq, op);
+    }
+  };
+
+  /// @brief ホストが棄却した操作（ReservedEventCode::sequenced_reject で送信者にだけ送る）
+  struct Reject {
+    uint32 client_seq = 0;
+    template<class Archive>
+    void SIV3D_SERIALIZE(Archive& archive) {
+      archive(client_seq);
+    }
+  };
+
+  struct Stats {
+    uint64 proposed = 0; // ホストに送った操作
+    uint64 committed = 0; // 確定を適用した操作
+    uint64 rejected = 0; // ホストに棄却された自分の操作
+    uint64 reordered = 0; // 番号が飛んで届き、順番待ちにした確定
+    uint64 duplicates = 0; // 既に適用済みで捨てた確定
+    uint64 dropped_pending = 0; // 確定順では成立しなくなった自分の未確定操作
+    uint64 failed_commits = 0; // 確定盤面に適用できず、スナップショットを要求した確定
+    uint64 unauthorized = 0; // 手番の陣営を持たないプレイヤーから届き、棄却した依頼
+    uint64 foreign_commits = 0; // ホスト以外から届き、捨てた確定
+  };
+
+  /// @brief ホストの確定順で盤面をそろえつつ、自分の操作は即座に反映する
+  /// @tparam Board can_operate / operate / write_packed / read_packed と、操作の陣営（authors の添字）を返す static な side_of を持ち、コピー可能な盤面
+  /// @tparam Operation Board に適用する操作（SIV3D_SERIALIZE を持ち、Operation::code を確定の送信に使う）
+  template<class Board, class Operation>
+  class Reconciler {
+  private:
+    struct Pending {
+      uint32 client_seq;
+      Operation op;
+    };
+    OnlineManager* network_ = nullptr;
+    Board confirmed_; // ホストの確定順で適用した盤面
+    Board predicted_; // confirmed_ に未確定の自分の操作を重ねた盤面（表示用）
+    Array<Pending> pending_; // 確定待ちの自分の操作（送信順）
+    HashTable<uint32, Commit<Operation>> early_commits_; // 番号が飛んで先に届いた確定
+    uint32 next_seq_ = 0; // 次に適用する確定番号
+    uint32 next_client_seq_ = 0;
+    Array<LocalPlayerID> authors_; // [陣営] を操作できるプレイヤー（空なら送信者を確かめない）
+    bool is_predicted_stale_ = false; // predicted_ を confirmed_ から作り直す必要があるか
+    bool is_awaiting_snapshot_ = false; // 確定を適用できなかったので、スナップショットが届くまで確定を進めない
+    Stats stats_;
+    bool is_host_(void) const { return not network_ or network_->is_host(); }
+    bool is_author_(LocalPlayerID player_id, const Operation& op) const;
+    LocalPlayerID self_id_(void) const { return network_ ? network_->get_local_player_id() : 0; }
+    void propose_(const Pending& pending);
+    bool commit_(LocalPlayerID author, uint32 client_seq, const Operation& op);
+    bool apply_(const Commit<Operation>& commit);
+    void apply_early_commits_(void);
+    void follow_(const Operation& op);
+    void rebuild_(void);
+  public:
+    void set_network(OnlineManager* network) { network_ = network; }
+    /// @brief 盤面を board にして確定番号と未確定の操作、陣営のプレイヤーを捨てる
+    void reset(const Board& board);
+    /// @brief 陣営ごとに操作できるプレイヤーを設定する（ホストはこれに合わない依頼を棄却する）
+    /// @param authors [Board::side_of(op)] がその陣営のプレイヤー
+    void set_authors(const Array<LocalPlayerID>& authors) { authors_ = authors; }
+    /// @brief 確定した盤面
+    const Board& get_confirmed(void) const { return confirmed_; }
+    /// @brief 自分の未確定の操作まで反映した盤面
+    const Board& get_predicted(void) const { return predicted_; }
+    /// @brief 確定待ちの自分の操作の数
+    size_t get_pending_count(void) const { return pending_.size(); }
+    const Stats& get_stats(void) const { return stats_; }
+    /// @brief 自分の操作を適用する（ホストならその場で確定し、それ以外はホストに送って予測として重ねる）
+    /// @return 予測盤面で合法だった場合 true
+    bool submit(const Operation& op);
+    /// @brief 受信イベントを処理する
+    /// @return このクラスが扱うイベントだった場合 true
+    bool on_event_received(LocalPlayerID player_id, uint8 event_code, Deserializer<MemoryViewReader>& reader);
+    /// @brief ホストが交代したときに呼ぶ（旧ホストに届かなかった可能性のある未確定の操作を送り直す）
+    void on_host_changed(bool is_host);
+    /// @brief 確定盤面と確定番号を書き出す（スナップショット用）
+    void write(Serializer<MemoryWriter>& writer) const {
+      confirmed_.write_packed(writer);
+      writer(next_seq_);
+    }
+    /// @brief 確定盤面と確定番号を読み込み、未確定の操作を重ね直す
+    /// @return 読み込めた場合 true（読み込めなければ状態を変えない）
+    bool read(Deserializer<MemoryViewReader>& reader);
+  };
+
+  template<class Board, class Operation>
+  inline void Reconciler<Board, Operation>::reset(const Board& board) {
+    confirmed_ = board;
+    predicted_ = board;
+    pending_.clear();
+    early_commits_.clear();
+    next_seq_ = 0;
+    next_client_seq_ = 0;
+    authors_.clear();
+    is_predicted_stale_ = false;
+    is_awaiting_snapshot_ = false;
+  }
+
+  template<class Board, class Operation>
+  inline bool Reconciler<Board, Operation>::submit(const Operation& op) {
+    if (not predicted_.can_operate(op)) return false;
+    const uint32 client_seq = next_client_seq_++;
+    if (is_host_() and pending_.isEmpty()) return commit_(self_id_(), client_seq, op);
+    pending_.push_back({ client_seq, op });
+    predicted_.operate(op);
+    propose_(pending_.back());
+    return true;
+  }
+
+  template<class Board, class Operation>
+  inline bool Reconciler<Board, Operation>::on_event_received(const LocalPlayerID player_id, const uint8 event_code, Deserializer<MemoryViewReader>& reader) {
+    if (event_code == ReservedEventCode::sequenced_proposal) {
+      Proposal<Operation> proposal;
+      reader(proposal);
+      // ホスト以外に届いた依頼は無視する（ホスト不明時は全員に送られる）
+      if (not is_host_()) return true;
+      // 盤面は手番の陣営の操作かしか見ないので、その陣営を持つプレイヤーからの依頼かをここで確かめる
+      const bool is_author = is_author_(player_id, proposal.op);
+      if (not is_author) ++stats_.unauthorized;
+      if ((not is_author or not commit_(player_id, proposal.client_seq, proposal.op)) and network_) {
+        network_->queue_game_event(ReservedEventCode::sequenced_reject, Reject{ proposal.client_seq }, EventPriority::Critical, 0s, Array<LocalPlayerID>{ player_id });
+      }
+      return true;
+    }
+    if (event_code == ReservedEventCode::sequenced_reject) {
+      Reject reject;
+      reader(reject);
+      const size_t pending_count = pending_.size();
+      pending_.remove_if([&](const Pending& pending) { return pending.client_seq == reject.client_seq; });
+      // 既に取り下げた操作の棄却は数えない
+      if (pending_.size() == pending_count) return true;
+      ++stats_.rejected;
+      rebuild_();
+      return true;
+    }
+    if (event_code == Operation::code) {
+      Commit<Operation> commit;
+      reader(commit);
+      // 確定を決められるのはホストだけ
+      if (network_ and player_id != network_->get_host_id()) {
+        ++stats_.foreign_commits;
+        return true;
+      }
+      if (commit.seq < next_seq_) {
+        ++stats_.duplicates;
+        return true;
+      }
+      // スナップショットを待つ間の確定は、スナップショットの確定番号より後のものだけを後で適用する
+      if (commit.seq > next_seq_ or is_awaiting_snapshot_) {
+        if (commit.seq > next_seq_) ++stats_.reordered;
+        early_commits_[commit.seq] = commit;
+        return true;
+      }
+      if (apply_(commit)) apply_early_commits_();
+      if (is_predicted_stale_) rebuild_();
+      return true;
+    }
+    return false;
+  }
+
+  template<class Board, class Operation>
+  inline void Reconciler<Board, Operation>::on_host_changed(const bool is_host) {
+    if (is_host) {
+      // 自分がホストになったら、未確定の操作をそのまま確定順に並べる
+      Array<Pending> pending = std::move(pending_);
+      pending_.clear();
+      is_predicted_stale_ = true;
+      for (const Pending& p : pending) {
+        if (not commit_(self_id_(), p.client_seq, p.op)) ++stats_.dropped_pending;
+      }
+      rebuild_();
+      return;
+    }
+    for (const Pending& pending : pending_) propose_(pending);
+  }
+
+  template<class Board, class Operation>
+  inline bool Reconciler<Board, Operation>::read(Deserializer<MemoryViewReader>& reader) {
+    // 途中で失敗しても今の状態を壊さないよう、盤面と確定番号を読み切ってから置き換える
+    Board board;
+    if (not board.read_packed(reader)) return false;
+    uint32 next_seq = 0;
+    if (reader->size() - reader->getPos() < static_cast<int64>(sizeof(next_seq))) return false;
+    reader(next_seq);
+    confirmed_ = std::move(board);
+    next_seq_ = next_seq;
+    is_awaiting_snapshot_ = false;
+    // スナップショットに含まれる確定は捨て、それより後の確定を続けて適用する
+    for (auto it = early_commits_.begin(); it != early_commits_.end();) {
+      if (it->first < next_seq_) it = early_commits_.erase(it);
+      else ++it;
+    }
+    apply_early_commits_();
+    rebuild_();
+    return true;
+  }
+
+  template<class Board, class Operation>
+  inline bool Reconciler<Board, Operation>::is_author_(const LocalPlayerID player_id, const Operation& op) const {
+    if (authors_.isEmpty()) return true;
+    const size_t side = Board::side_of(op);
+    return (side < authors_.size()) and (authors_[side] == player_id);
+  }
+
+  template<class Board, class Operation>
+  inline void Reconciler<Board, Operation>::propose_(const Pending& pending) {
+    ++stats_.proposed;
+    if (not network_) return;
+    const LocalPlayerID host_id = network_->get_host_id();
+    network_->queue_game_event(ReservedEventCode::sequenced_proposal, Proposal<Operation>{ pending.client_seq, pending.op }, EventPriority::Critical, 0s,
+      (host_id >= 0) ? Optional<Array<LocalPlayerID>>{ Array<LocalPlayerID>{ host_id } } : unspecified);
+  }
+
+  template<class Board, class Operation>
+  inline bool Reconciler<Board, Operation>::commit_(const LocalPlayerID author, const uint32 client_seq, const Operation& op) {
+    if (not confirmed_.operate(op)) return false;
+    const Commit<Operation> commit{ next_seq_++, author, client_seq, op };
+    ++stats_.committed;
+    if (network_) network_->queue_game_event(Operation::code, commit, EventPriority::Critical);
+    follow_(op);
+    if (is_predicted_stale_) rebuild_();
+    return true;
+  }
+
+  template<class Board, class Operation>
+  inline bool Reconciler<Board, Operation>::apply_(const Commit<Operation>& commit) {
+    if (not confirmed_.operate(commit.op)) {
+      // ホストと確定盤面が食い違っているので、番号を進めずにスナップショットで合わせ直す
+      ++stats_.failed_commits;
+      is_awaiting_snapshot_ = true;
+      early_commits_[commit.seq] = commit;
+      if (network_) network_->request_snapshot();
+      return false;
+    }
+    ++next_seq_;
+    ++stats_.committed;
+    follow_(commit.op);
+    // 自分の操作の確定は、それ以前の依頼への応答も兼ねる
+    if (commit.author == self_id_()) {
+      pending_.remove_if([&](const Pending& pending) { return pending.client_seq <= commit.client_seq; });
+    }
+    return true;
+  }
+
+  template<class Board, class Operation>
+  inline void Reconciler<Board, Operation>::apply_early_commits_(void) {
+    // 順番待ちの確定を続けて適用する
+    for (auto it = early_commits_.find(next_seq_); it != early_commits_.end(); it = early_commits_.find(next_seq_)) {
+      const Commit<Operation> next = it->second;
+      early_commits_.erase(it);
+      if (not apply_(next)) return;
+    }
+  }
+
+  template<class Board, class Operation>
+  inline void Reconciler<Board, Operation>::follow_(const Operation& op) {
+    // 未確定の操作がなければ予測盤面は確定盤面と同じなので、盤面をコピーし直さずに同じ操作を重ねる
+    if (pending_.isEmpty() and not is_predicted_stale_) predicted_.operate(op);
+    else is_predicted_stale_ = true;
+  }
+
+  template<class Board, class Operation>
+  inline void Reconciler<Board, Operation>::rebuild_(void) {
+    is_predicted_stale_ = false;
+    predicted_ = confirmed_;
+    // 確定順では成立しなくなった操作は取り下げる
+    size_t kept = 0;
+    for (size_t i = 0; i < pending_.size(); ++i) {
+      if (predicted_.operate(pending_[i].op)) pending_[kept++] = pending_[i];
+      else ++stats_.dropped_pending;
+    }
+    pending_.resize(kept);
+  }
+}
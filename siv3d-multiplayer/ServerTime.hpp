@@ -0,0 +1,11 @@
+﻿# pragma once
+# include <Siv3D.hpp>
+
+// getServerTimeMillisec() の時刻（int32 のミリ秒, 約 24 日で桁あふれする）を扱う
+namespace ServerTime {
+
+  /// @brief サーバー時刻 a - b（ミリ秒, 桁あふれをまたいでも正しい差になる）
+  inline int32 diff_ms(const int32 a, const int32 b) {
+    return static_cast<int32>(static_cast<uint32>(a) - static_cast<uint32>(b));
+  }
+}
@@ -0,0 +1,219 @@
+﻿# pragma once
+# include <Siv3D.hpp>
+# include "Multiplayer_Photon.hpp"
+# include "IGame.hpp"
+# include "SpectatorBatch.hpp"
+
+// セッションの送受信イベントとルームのコールバックを記録・再生する
+namespace Session {
+
+  /// @brief 記録の種類
+  enum class RecordKind : uint8 {
+    Outgoing = 0, // 自分が送信したイベント
+    Incoming = 1, // 受信したイベント
+    GameStart = 2, // on_game_start
+    PlayerLeft = 3, // on_player_left
+    LeaveRoom = 4, // on_leave_room
+    HostChanged = 5, // on_host_changed（ペイロードは自身がホストか 1 バイト）
+  };
+
+  /// @brief ファイル先頭の識別子
+  constexpr uint32 file_magic = 0x524D3353; // "S3MR"
+  constexpr uint16 file_version = 1;
+
+  /// @brief 記録ファイル内の1レコード（ペイロードはマップされたメモリを指す）
+  struct RecordView {
+    RecordKind kind;
+    LocalPlayerID player_id;
+    uint8 event_code;
+    int32 server_time;
+    const uint8* payload;
+    uint32 size;
+  };
+
+  /// @brief 記録ファイルに書き出す（1ファイルに1セッション）
+  /// @remark レコードは kind(1) player_id(4) event_code(1) server_time(4) size(4) payload(size) のリトルエンディアン固定長ヘッダ
+  class Recorder {
+  private:
+    BinaryWriter writer_;
+    Array<uint8> buffer_; // 1レコード分の書き出しバッファ（使い回す）
+    template<class T>
+    void put_(const T& value) {
+      const uint8* p = reinterpret_cast<const uint8*>(&value);
+      buffer_.insert(buffer_.end(), p, p + sizeof(T));
+    }
+  public:
+    Recorder() = default;
+    /// @brief 記録ファイルを開く（既存のファイルは上書きし、別のセッションや形式のレコードが混ざらないようにする）
+    bool open(const FilePathView path) {
+      writer_ = BinaryWriter{ path, OpenMode::Trunc };
+      if (not writer_) return false;
+      writer_.write(file_magic);
+      writer_.write(file_version);
+      return true;
+    }
+    void close(void) {
+      writer_.close();
+    }
+    bool is_open(void) const {
+      return writer_.isOpen();
+    }
+    /// @brief 1レコードを追記する
+    void write(const RecordKind kind, const LocalPlayerID player_id, const uint8 event_code, const int32 server_time,
+      const void* payload, const size_t size) {
+      if (not writer_) return;
+      buffer_.clear();
+      put_(kind);
+      put_(player_id);
+      put_(event_code);
+      put_(server_time);
+      put_(static_cast<uint32>(size));
+      const uint8* p = static_cast<const uint8*>(payload);
+      buffer_.insert(buffer_.end(), p, p + size);
+      writer_.write(buffer_.data(), buffer_.size());
+    }
+    /// @brief ゲーム開始を記録する
+    void write_game_start(const LocalPlayerID self_id, const Array<LocalPlayer>& players, const bool is_host, const int32 server_time) {
+      Array<uint8> payload;
+      payload << static_cast<uint8>(is_host);
+      payload << static_cast<uint8>(players.size());
+      for (const LocalPlayer& player : players) {
+        const uint8* p = reinterpret_cast<const uint8*>(&player.localID);
+        payload.insert(payload.end(), p, p + sizeof(LocalPlayerID));
+        payload << static_cast<uint8>(player.isHost);
+      }
+      write(RecordKind::GameStart, self_id, 0, server_time, payload.data(), payload.size());
+    }
+    void flush(void) {
+      if (writer_) writer_.flush();
+    }
+  };
+
+  /// @brief 記録ファイルをメモリマップして読み出す
+  class Replay {
+  private:
+    MemoryMappedFileView file_;
+    MemoryMappedFileView::MappedMemory mapped_;
+    Array<RecordView> records_;
+    size_t cursor_ = 0; // 次に再生するレコード
+    Stopwatch clock_; // 実時間再生用
+    Array<uint8> batch_buffer_; // 観戦のまとめの1件分（使い回す）
+    template<class T>
+    static T get_(const uint8* p) {
+      T value;
+      std::memcpy(&value, p, sizeof(T));
+      return value;
+    }
+    void dispatch_(IGame& game, const RecordView& record);
+  public:
+    static constexpr size_t record_header_size = 14;
+    Replay() = default;
+    /// @brief 記録ファイルを開いてレコードを索引付けする
+    bool open(const FilePathView path) {
+      records_.clear();
+      cursor_ = 0;
+      file_ = MemoryMappedFileView{ path };
+      if (not file_) return false;
+      mapped_ = file_.mapAll();
+      if (mapped_.size < 6) return false;
+      const uint8* data = reinterpret_cast<const uint8*>(mapped_.data);
+      if (get_<uint32>(data) != file_magic or get_<uint16>(data + 4) != file_version) return false;
+      size_t pos = 6;
+      while (pos + record_header_size <= mapped_.size) {
+        const uint8* p = data + pos;
+        RecordView record{
+          .kind = static_cast<RecordKind>(p[0]),
+          .player_id = get_<LocalPlayerID>(p + 1),
+          .event_code = p[5],
+          .server_time = get_<int32>(p + 6),
+          .payload = p + record_header_size,
+          .size = get_<uint32>(p + 10),
+        };
+        // 書き込み途中で終わっている末尾のレコードは無視する
+        if (pos + record_header_size + record.size > mapped_.size) break;
+        records_ << record;
+        pos += record_header_size + record.size;
+      }
+      return true;
+    }
+    const Array<RecordView>& records(void) const { return records_; }
+    bool is_finished(void) const { return cursor_ >= records_.size(); }
+    /// @brief 先頭から再生し直す
+    void rewind(void) {
+      cursor_ = 0;
+      clock_.reset();
+    }
+    /// @brief 全レコードを待ち時間なしで再生する
+    void play_all(IGame& game) {
+      game.set_network(nullptr); // 再生中に送信しないよう切り離す
+      for (; cursor_ < records_.size(); ++cursor_) {
+        dispatch_(game, records_[cursor_]);
+      }
+    }
+    /// @brief 記録されたサーバー時刻の間隔どおりに再生する（毎フレーム呼ぶ）
+    void play_realtime(IGame& game) {
+      if (is_finished()) return;
+      game.set_network(nullptr);
+      if (not clock_.isStarted()) clock_.start();
+      const int32 base_time = records_.front().server_time;
+      for (; cursor_ < records_.size(); ++cursor_) {
+        const RecordView& record = records_[cursor_];
+        if ((record.server_time - base_time) > clock_.ms()) break;
+        dispatch_(game, record);
+      }
+    }
+  };
+
+  inline void Replay::dispatch_(IGame& game, const RecordView& record) {
+    switch (record.kind) {
+    case RecordKind::Outgoing:
+      // 自分の送信のうち状態に効くのは、ホストとして送った確定（ゲームのイベントコード）と、ロックステップ・ロールバックの自分の入力
+      // 確定を依頼した操作やスナップショットを適用し直すと、ホストの確定と二重になる
+      if (record.event_code >= ReservedEventCode::reserved_begin
+        and record.event_code != ReservedEventCode::lockstep_input and record.event_code != ReservedEventCode::rollback_input) break;
+      [[fallthrough]];
+    case RecordKind::Incoming: {
+      Deserializer<MemoryViewReader> reader{ record.payload, record.size };
+      if (record.event_code == ReservedEventCode::snapshot) {
+        game.read_snapshot(reader);
+      } else if (record.event_code == ReservedEventCode::spectator_batch) {
+        // 観戦中に受け取ったまとめは、OnlineManager と同じく1件ずつの確定に戻してホストから届いたものとして渡す
+        constexpr size_t header_size = sizeof(uint32) + sizeof(uint64) + sizeof(uint16); // StateHash とイベント数
+        if (record.size < header_size) break;
+        StateHash expected;
+        uint16 events = 0;
+        reader(expected, events);
+        SpectatorBatch::decode(reader, events, batch_buffer_, [&](const uint8 event_code, Deserializer<MemoryViewReader>& event_reader) {
+          game.on_event_received(record.player_id, event_code, event_reader);
+        });
+      } else {
+        game.on_event_received(record.player_id, record.event_code, reader);
+      }
+      break;
+    }
+    case RecordKind::GameStart: {
+      if (record.size < 2) break;
+      const bool is_host = (record.payload[0] != 0);
+      const size_t count = record.payload[1];
+      Array<LocalPlayer> players;
+      for (size_t i = 0; i < count and (2 + (i + 1) * 5) <= record.size; ++i) {
+        const uint8* p = record.payload + 2 + i * 5;
+        players << LocalPlayer{ .localID = get_<LocalPlayerID>(p), .isHost = (p[4] != 0), .isActive = true };
+      }
+      game.on_game_start(players, is_host);
+      break;
+    }
+    case RecordKind::PlayerLeft:
+      game.on_player_left(record.player_id);
+      break;
+    case RecordKind::LeaveRoom:
+      game.on_leave_room();
+      break;
+    case RecordKind::HostChanged:
+      if (record.size >= 1) game.on_host_changed(record.payload[0] != 0);
+      break;
+    default:
+      break;
+    }
+  }
+}
@@ -0,0 +1,116 @@
+﻿# pragma once
+# include <Siv3D.hpp>
+
+// ホストが観戦者へまとめて送る確定イベントを、直前のイベントとの差分で詰める
+// 確定イベントは通し番号が1ずつ増え、同じ形の操作が続くので、変わったバイトだけを送ると数分の一の大きさになる
+// まとめは観戦者が取りこぼしても次のまとめから読めるよう、まとめごとに差分の基準を作り直す
+namespace SpectatorBatch {
+
+  /// @brief イベントごとの先頭に書くフラグ
+  namespace Flag {
+    constexpr uint8 same_code = 1; // 直前のイベントと同じイベントコード（コードを省く）
+    constexpr uint8 delta = 2; // 直前のイベントと同じ大きさで、変わったバイトだけを書く
+  }
+
+  struct Stats {
+    uint64 events = 0;
+    uint64 raw_bytes = 0; // 差分で詰める前のペイロードの合計
+    uint64 encoded_bytes = 0; // 詰めた後の合計
+  };
+
+  /// @brief イベントを差分で詰めてまとめに積む
+  class Encoder {
+  public:
+    void append(const uint8 event_code, const uint8* data, const size_t size) {
+      const size_t begin = writer_->getBlob().size();
+      uint8 flags = 0;
+      if (count_ > 0 and event_code == last_code_) flags |= Flag::same_code;
+      // 変わったバイトとその位置のビットマスクの方が小さいときだけ差分にする
+      size_t changed = 0;
+      const bool same_size = (flags & Flag::same_code) and size == last_payload_.size();
+      if (same_size) {
+        for (size_t i = 0; i < size; ++i) changed += (data[i] != last_payload_[i]);
+        if ((size + 7) / 8 + changed < size + sizeof(uint16)) flags |= Flag::delta;
+      }
+      writer_(flags);
+      if (not (flags & Flag::same_code)) writer_(event_code);
+      if (flags & Flag::delta) {
+        mask_.assign((size + 7) / 8, 0);
+        for (size_t i = 0; i < size; ++i) {
+          if (data[i] != last_payload_[i]) mask_[i / 8] |= static_cast<uint8>(1u << (i % 8));
+        }
+        writer_->write(mask_.data(), mask_.size());
+        for (size_t i = 0; i < size; ++i) {
+          if (data[i] != last_payload_[i]) writer_->write(&data[i], 1);
+        }
+      } else {
+        writer_(static_cast<uint16>(size));
+        writer_->write(data, size);
+      }
+      last_code_ = event_code;
+      last_payload_.assign(data, data + size);
+      ++count_;
+      ++stats_.events;
+      stats_.raw_bytes += size;
+      stats_.encoded_bytes += writer_->getBlob().size() - begin;
+    }
+    /// @brief 積んだイベントを捨て、差分の基準も作り直す
+    void clear(void) {
+      writer_->clear();
+      count_ = 0;
+      last_payload_.clear();
+    }
+    uint16 get_count(void) const { return count_; }
+    const Blob& get_blob(void) const { return writer_->getBlob(); }
+    const Stats& get_stats(void) const { return stats_; }
+  private:
+    Serializer<MemoryWriter> writer_;
+    uint16 count_ = 0;
+    uint8 last_code_ = 0;
+    Array<uint8> last_payload_; // 直前のイベントのペイロード（差分の基準）
+    Array<uint8> mask_; // 使い回す
+    Stats stats_;
+  };
+
+  /// @brief Encoder で詰めた count 個のイベントを順に復元して handler(event_code, reader) に渡す
+  /// @param payload 復元したペイロードを置くバッファ（差分の基準を兼ねるので、まとめの間は他に使わない）
+  /// @return 最後まで読めた場合 true（途中で壊れていればそこで止める）
+  template<class Handler>
+  bool decode(Deserializer<MemoryViewReader>& reader, const uint16 count, Array<uint8>& payload, Handler&& handler) {
+    const auto remaining = [&]() { return static_cast<size_t>(reader->size() - reader->getPos()); };
+    uint8 event_code = 0;
+    Array<uint8> mask;
+    payload.clear();
+    for (uint16 i = 0; i < count; ++i) {
+      if (remaining() < 1) return false;
+      uint8 flags = 0;
+      reader(flags);
+      if ((flags & Flag::same_code) and i == 0) return false;
+      if (not (flags & Flag::same_code)) {
+        if (remaining() < 1) return false;
+        reader(event_code);
+      }
+      if (flags & Flag::delta) {
+        if (i == 0) return false;
+        mask.resize((payload.size() + 7) / 8);
+        if (remaining() < mask.size()) return false;
+        reader->read(mask.data(), mask.size());
+        for (size_t j = 0; j < payload.size(); ++j) {
+          if (not (mask[j / 8] & (1u << (j % 8)))) continue;
+          if (remaining() < 1) return false;
+          reader->read(&payload[j], 1);
+        }
+      } else {
+        if (remaining() < sizeof(uint16)) return false;
+        uint16 size = 0;
+        reader(size);
+        if (remaining() < size) return false;
+        payload.resize(size);
+        reader->read(payload.data(), size);
+      }
+      Deserializer<MemoryViewReader> event_reader{ payload.data(), payload.size() };
+      handler(event_code, event_reader);
+    }
+    return true;
+  }
+}
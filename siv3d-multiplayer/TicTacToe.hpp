@@ -2,6 +2,10 @@
 # include <Siv3D.hpp>
 # include "IGame.hpp"
 # include "OnlineManager.hpp" // setNetworkでポインタを保持するため
+# include "Sequencing.hpp"
+# include "Zobrist.hpp"
+# include "BitPacking.hpp"
+# include "FontCache.hpp"
 
 namespace TicTacToe {
 
@@ -24,43 +28,342 @@ namespace TicTacToe {
     }
   };
 
+  /// @brief ビットボードで判定する盤面の1辺の最大値（8×8 = 64 セル）
+  constexpr size_t max_bitboard_size = 8;
+
+  /// @brief 1辺 n の盤面で揃えば勝ちになる列（行・列・2本の対角線）のビットマスク
+  struct WinMasks {
+    std::array<uint64, 2 * max_bitboard_size + 2> masks{};
+    size_t count = 0;
+    uint64 full = 0; // 全セル
+  };
+
+  constexpr WinMasks make_win_masks(const size_t n) {
+    WinMasks result;
+    uint64 diagonal = 0, anti_diagonal = 0;
+    for (size_t i = 0; i < n; ++i) {
+      uint64 row = 0, column = 0;
+      for (size_t j = 0; j < n; ++j) {
+        row |= uint64{ 1 } << (i * n + j);
+        column |= uint64{ 1 } << (j * n + i);
+      }
+      result.masks[result.count++] = row;
+      result.masks[result.count++] = column;
+      diagonal |= uint64{ 1 } << (i * n + i);
+      anti_diagonal |= uint64{ 1 } << (i * n + (n - 1 - i));
+      result.full |= row;
+    }
+    if (n > 0) {
+      result.masks[result.count++] = diagonal;
+      result.masks[result.count++] = anti_diagonal;
+    }
+    return result;
+  }
+
+  /// @brief 盤面の1辺ごとの勝ちのビットマスク（コンパイル時に生成する）
+  inline constexpr std::array<WinMasks, max_bitboard_size + 1> win_masks = []() {
+    std::array<WinMasks, max_bitboard_size + 1> table{};
+    for (size_t n = 1; n <= max_bitboard_size; ++n) table[n] = make_win_masks(n);
+    return table;
+  }();
+  static_assert(win_masks[3].count == 8 and win_masks[3].masks[0] == 0b111 and win_masks[3].full == 0x1FF);
+
+  /// @brief 〇と×のビットボードから勝敗を求める（決着していなければ none, 引き分けは Cell::None）
+  /// @remark セル (x, y) は y * n + x ビット目
+  inline constexpr Optional<Cell> evaluate(const uint64 circles, const uint64 crosses, const size_t n) {
+    const WinMasks& table = win_masks[n];
+    for (size_t i = 0; i < table.count; ++i) {
+      const uint64 mask = table.masks[i];
+      if ((circles & mask) == mask) return Cell::Circle;
+      if ((crosses & mask) == mask) return Cell::Cross;
+    }
+    if ((circles | crosses) == table.full) return Cell::None; // 引き分け
+    return none;
+  }
+
+  /// @brief 描画やアセットに依存しない盤面とルール（ヘッドレス実行でもそのまま使う）
+  /// @remark N×M の盤面で k 個並べたら勝ち（3×3 で k = 3 なら通常の三目並べ, 19×19 で k = 5 なら五目並べ）
+  ///         1辺 max_bitboard_size 以下の正方形で1列そろえたら勝ちの盤面は、ビットボードとマスクで判定する
+  class Board {
+  private:
+    Grid<Cell> grid_; // 盤面情報
+    uint64 circles_ = 0; // 〇が置かれたセルのビットボード（uses_bitboard_ のときだけ使う）
+    uint64 crosses_ = 0; // ×が置かれたセルのビットボード
+    bool uses_bitboard_ = false;
+    uint32 win_length_ = 3; // 勝ちになる並びの長さ
+    size_t empty_count_ = 0; // 空きセルの数（0 になれば引き分け）
+    Cell turn_ = Cell::Circle; // 次に置かれる記号
+    Optional<Cell> winner_ = none; // ゲームの勝者、引き分け時はNone
+    uint32 move_count_ = 0; // 適用した手数
+    uint64 hash_ = 0; // 盤面と手番の Zobrist ハッシュ
+    bool is_winning_move_(const Point& pos) const;
+    void calc_result_(void);
+    void rehash_(void);
+    void sync_bitboard_(void);
+  public:
+    /// @brief grid_size × grid_size の盤面で1列そろえたら勝ちにする
+    void initialize(const size_t grid_size) { initialize(Size{ static_cast<int32>(grid_size), static_cast<int32>(grid_size) }, static_cast<uint32>(grid_size)); }
+    /// @param grid_size 盤面の大きさ（1辺 1 ~ max_grid_size）
+    /// @param win_length 勝ちになる並びの長さ（1 ~ 盤面の長辺）
+    void initialize(const Size& grid_size, uint32 win_length);
+    void clear(void);
+    bool is_empty(void) const { return grid_.isEmpty(); }
+    bool is_finished(void) const { return winner_.has_value(); }
+    Optional<Cell> get_winner(void) const { return winner_; }
+    Cell get_turn(void) const { return turn_; }
+    const Grid<Cell>& get_grid(void) const { return grid_; }
+    uint32 get_win_length(void) const { return win_length_; }
+    /// @brief 勝敗をビットボードで判定しているか
+    bool uses_bitboard(void) const { return uses_bitboard_; }
+    uint32 get_move_count(void) const { return move_count_; }
+    uint64 get_hash(void) const { return hash_; }
+    /// @brief 操作が合法か（盤面内の空きセルに手番の記号を置くか）
+    bool can_operate(const Operation& op) const;
+    /// @brief 操作を適用する（勝敗はビットボードか、置いたセルを通る4本の線だけで判定する）
+    /// @return 合法で適用された場合 true
+    bool operate(const Operation& op);
+    /// @brief 操作の陣営（〇が 0, ×が 1, 記号のない操作は範囲外）
+    static size_t side_of(const Operation& op) { return static_cast<size_t>(op.cell_type) - 1; }
+    /// @brief 手番のプレイヤーの合法手の一覧
+    Array<Operation> get_legal_operations(void) const;
+    /// @brief 盤面を1セル2ビットに詰めて書き出す（勝敗は盤面から求め直せるので送らない）
+    void write_packed(Serializer<MemoryWriter>& writer) const;
+    /// @brief write_packed() で書き出した盤面を読み込む
+    /// @return 読み込めた場合 true（盤面が大きすぎる・データが足りない・ありえない盤面の場合は false）
+    bool read_packed(Deserializer<MemoryViewReader>& reader);
+    static constexpr uint32 cell_bits = BitPacking::bits_for(static_cast<uint32>(Cell::Cross));
+    static constexpr int32 max_grid_size = 1024; // 盤面の1辺の最大値
+  };
+
   class Game : public IGame {
   private:
+    // 描画用のフォント（ヘッドレス実行では生成しないよう、最初の描画時にキャッシュから借りる）
+    struct Assets {
+      FontCache::Handle font_detail; // ゲームに関わるテキストのフォント
+      FontCache::Handle font_symbol; // 盤面記号描画のフォント
+    };
+    constexpr static int32 detail_font_size = 256;
+    constexpr static int32 symbol_font_size = 100;
+    static constexpr uint16 snapshot_version = 2; // スナップショットの形式
     OnlineManager* network_ = nullptr; // ネットワーク層へのポインタ
-    Grid<Cell> grid_; // 盤面情報
-    size_t cell_size_ = 100; // 1つのセルの1辺の長さ
+    Sequencing::Reconciler<Board, Operation> moves_; // ホストの確定順にそろえる盤面とルール
+    Size grid_size_{ 3, 3 }; // 次のゲームの盤面の大きさ
+    uint32 win_length_ = 3; // 次のゲームで勝ちになる並びの長さ
+    constexpr static size_t max_cell_size = 100; // セルの1辺の長さの上限
+    size_t cell_size_ = max_cell_size; // 1つのセルの1辺の長さ
     Point cell_offset_{ 100, 100 }; // 盤面描画時のオフセット
     Cell player_symbol_ = Cell::None; // このプレイヤーの記号
+    Array<LocalPlayerID> player_ids_; // [0] が〇, [1] が×のプレイヤー（スナップショットで引き継ぐ）
     bool is_started_ = false; // ゲームが開始されているか
-    bool is_turn_ = false; // 自分のターンであるか
-    bool is_finished_ = false; // ゲームが終了しているか
-    Optional<Cell> winner_ = none; // ゲームの勝者
-    Font font_detail_{ FontMethod::MSDF, 256, Typeface::Bold }; // ゲームに関わるテキストのフォント
-    Font font_symbol_{ FontMethod::MSDF, static_cast<int32>(cell_size_), Typeface::Bold }; // 盤面記号描画のフォント
+    mutable std::unique_ptr<Assets> assets_;
+    const Assets& get_assets_(void) const;
+    bool is_turn_(void) const; // 自分のターンであるか
     Point get_cell_point_(const size_t y, const size_t x) const; // セルの左上座標
     Rect get_cell_rect_(const Point& pos) const; // セルの四角形
     Rect get_cell_rect_(const size_t y, const size_t x) const;
+    void layout_(void); // 盤面の大きさに合わせてセルの大きさを決める
     Optional<Operation> get_operation_(void) const;
-    void operate_(const Operation& op);
-    void calc_result_(void);
+    void submit_(const Operation& op);
+    void check_finished_(const bool was_finished);
   public:
+    constexpr static StringView game_id = U"TicTacToe";
+    constexpr static uint8 max_players = 2;
+    /// @brief ロビーで選べるルール（"{幅}x{高さ}k{並べる数}", 先頭が既定）
+    constexpr static std::array<StringView, 4> rules{ U"3x3k3", U"8x8k8", U"15x15k5", U"19x19k5" };
     Game() = default;
-    void set_network(OnlineManager* network) override {network_ = network;}
-    String get_game_id(void) const override {return U"TicTacToe";}
-    uint8 get_max_players(void) const override {return 2;}
+    /// @brief 描画用のフォントを非同期に読み込み始める（ロビーにいる間に呼ぶ）
+    static void preload_assets(void) {
+      FontCache::shared().preload(FontMethod::MSDF, detail_font_size, Typeface::Bold, U"DrawYouWinLose!NotTurn");
+      FontCache::shared().preload(FontMethod::MSDF, symbol_font_size, Typeface::Bold, U"OX");
+    }
+    void set_network(OnlineManager* network) override {network_ = network; moves_.set_network(network);}
+    String get_game_id(void) const override {return String{ game_id };}
+    uint8 get_max_players(void) const override {return max_players;}
     bool is_started(void) const override {return is_started_;}
-    bool is_finished(void) const override {return is_finished_;}
+    bool is_finished(void) const override {return moves_.get_confirmed().is_finished();}
+    StateHash get_state_hash(void) const override {
+      return { moves_.get_confirmed().get_move_count(), moves_.get_confirmed().get_hash() };
+    }
     void update(void) override;
-    void draw(void) const override;
+    void tick([[maybe_unused]] double dt) override {}
+    void draw(double alpha) const override;
     void debug(void) override {}
     void on_game_start(const Array<LocalPlayer>& players, bool is_host) override;
     void on_player_left(LocalPlayerID player_id) override;
     void on_leave_room(void) override;
+    void on_host_changed(bool is_host) override;
+    void write_snapshot(Serializer<MemoryWriter>& writer) const override;
+    bool read_snapshot(Deserializer<MemoryViewReader>& reader) override;
     void on_event_received(LocalPlayerID player_id, uint8 event_code, Deserializer<MemoryViewReader>& reader) override;
-    void initialize(const size_t grid_size, const Cell player_symbol);
+    bool is_turn(void) const override { return is_turn_(); }
+    bool play_random_move(void) override;
+    /// @brief 次のゲームの盤面の大きさと勝ちになる並びの長さを設定する（全員で同じ値にし、ゲーム開始前に呼ぶ）
+    void set_rule(const Size& grid_size, const uint32 win_length) {
+      grid_size_ = Size{ Clamp(grid_size.x, 1, Board::max_grid_size), Clamp(grid_size.y, 1, Board::max_grid_size) };
+      win_length_ = Clamp<uint32>(win_length, 1, Max(grid_size_.x, grid_size_.y));
+    }
+    String get_rule(void) const override { return U"{}x{}k{}"_fmt(grid_size_.x, grid_size_.y, win_length_); }
+    bool set_rule(StringView rule) override;
+    void initialize(const Size& grid_size, const uint32 win_length, const Cell player_symbol);
     void reset(void);
+    const Board& get_board(void) const { return moves_.get_predicted(); }
   };
 
+  inline bool Game::set_rule(const StringView rule) {
+    const size_t x = rule.indexOf(U'x');
+    const size_t k = (x == StringView::npos) ? StringView::npos : rule.indexOf(U'k', x);
+    if (k == StringView::npos) return false;
+    const Optional<int32> width = ParseOpt<int32>(rule.substr(0, x));
+    const Optional<int32> height = ParseOpt<int32>(rule.substr(x + 1, k - x - 1));
+    const Optional<uint32> win_length = ParseOpt<uint32>(rule.substr(k + 1));
+    if (not width or not height or not win_length or *width < 1 or *height < 1 or *win_length < 1) return false;
+    if (*width > Board::max_grid_size or *height > Board::max_grid_size) return false;
+    set_rule(Size{ *width, *height }, *win_length);
+    return true;
+  }
+  inline void Board::initialize(const Size& grid_size, const uint32 win_length) {
+    const Size size{ Clamp(grid_size.x, 1, max_grid_size), Clamp(grid_size.y, 1, max_grid_size) };
+    grid_.assign(size, Cell::None);
+    win_length_ = Clamp<uint32>(win_length, 1, Max(size.x, size.y));
+    empty_count_ = grid_.size_elements();
+    turn_ = Cell::Circle;
+    winner_ = none;
+    move_count_ = 0;
+    sync_bitboard_();
+    rehash_();
+  }
+  inline void Board::clear(void) {
+    grid_.clear();
+    circles_ = 0;
+    crosses_ = 0;
+    uses_bitboard_ = false;
+    empty_count_ = 0;
+    turn_ = Cell::Circle;
+    winner_ = none;
+    move_count_ = 0;
+    rehash_();
+  }
+  inline bool Board::can_operate(const Operation& op) const {
+    if (grid_.isEmpty() or is_finished()) return false;
+    if (not grid_.inBounds(op.pos)) return false;
+    return (op.cell_type == turn_) and (grid_[op.pos] == Cell::None);
+  }
+  inline bool Board::operate(const Operation& op) {
+    if (not can_operate(op)) return false;
+    grid_[op.pos] = op.cell_type;
+    --empty_count_;
+    const Cell next_turn = (op.cell_type == Cell::Circle) ? Cell::Cross : Cell::Circle;
+    // 置いた記号と手番の変化だけをハッシュに反映する
+    hash_ ^= Zobrist::key(0, op.pos.y * grid_.width() + op.pos.x, static_cast<uint32>(op.cell_type));
+    hash_ ^= Zobrist::key(1, 0, static_cast<uint32>(turn_)) ^ Zobrist::key(1, 0, static_cast<uint32>(next_turn));
+    turn_ = next_turn;
+    ++move_count_;
+    if (uses_bitboard_) {
+      const uint64 bit = uint64{ 1 } << (op.pos.y * grid_.width() + op.pos.x);
+      if (op.cell_type == Cell::Circle) circles_ |= bit;
+      else crosses_ |= bit;
+      winner_ = evaluate(circles_, crosses_, grid_.width());
+      return true;
+    }
+    // 新しくそろう可能性があるのは置いたセルを通る線だけ
+    if (is_winning_move_(op.pos)) winner_ = op.cell_type;
+    else if (empty_count_ == 0) winner_ = Cell::None;
+    return true;
+  }
+  inline bool Board::is_winning_move_(const Point& pos) const {
+    const Cell cell = grid_[pos];
+    if (cell == Cell::None) return false;
+    constexpr Point directions[] = { { 1, 0 }, { 0, 1 }, { 1, 1 }, { 1, -1 } };
+    for (const Point& dir : directions) {
+      // 置いたセルから両方向に同じ記号が続く数を数える（win_length_ に届いた時点で打ち切る）
+      uint32 length = 1;
+      for (Point p = pos + dir; length < win_length_ and grid_.inBounds(p) and grid_[p] == cell; p += dir) ++length;
+      for (Point p = pos - dir; length < win_length_ and grid_.inBounds(p) and grid_[p] == cell; p -= dir) ++length;
+      if (length >= win_length_) return true;
+    }
+    return false;
+  }
+  inline void Board::sync_bitboard_(void) {
+    // 正方形で1列そろえたら勝ちのときだけ、勝ちの並びが win_masks の行・列・対角線と一致する
+    uses_bitboard_ = (grid_.width() == grid_.height()) and (grid_.width() <= max_bitboard_size) and (win_length_ == grid_.width());
+    circles_ = 0;
+    crosses_ = 0;
+    if (not uses_bitboard_) return;
+    for (size_t i = 0; i < grid_.size_elements(); ++i) {
+      if (grid_.data()[i] == Cell::Circle) circles_ |= uint64{ 1 } << i;
+      else if (grid_.data()[i] == Cell::Cross) crosses_ |= uint64{ 1 } << i;
+    }
+  }
+  inline void Board::rehash_(void) {
+    hash_ = Zobrist::key(1, 0, static_cast<uint32>(turn_));
+    for (size_t i = 0; i < grid_.size_elements(); ++i) {
+      hash_ ^= Zobrist::key(0, i, static_cast<uint32>(grid_.data()[i]));
+    }
+  }
+  inline void Board::write_packed(Serializer<MemoryWriter>& writer) const {
+    writer(static_cast<uint16>(grid_.width()), static_cast<uint16>(grid_.height()), static_cast<uint16>(win_length_), move_count_);
+    BitPacking::Writer bits{ writer };
+    bits.write(static_cast<uint32>(turn_), cell_bits);
+    bits.write_grid(grid_, cell_bits);
+    bits.flush();
+  }
+  inline bool Board::read_packed(Deserializer<MemoryViewReader>& reader) {
+    uint16 width = 0, height = 0, win_length = 0;
+    uint32 move_count = 0;
+    reader(width, height, win_length, move_count);
+    if (width > max_grid_size or height > max_grid_size or win_length == 0) return false;
+    BitPacking::Reader bits{ reader, cell_bits * (1 + size_t{ width } * height) };
+    if (not bits.is_valid()) return false;
+    // 途中で失敗しても今の盤面を壊さないよう、別の盤面に読み込んで確かめてから置き換える
+    Board board;
+    board.grid_.assign(width, height, Cell::None);
+    board.turn_ = static_cast<Cell>(bits.read(cell_bits));
+    bits.read_grid(board.grid_, cell_bits);
+    if (not bits.is_valid() or (board.turn_ != Cell::Circle and board.turn_ != Cell::Cross)) return false;
+    if (std::any_of(board.grid_.begin(), board.grid_.end(), [](const Cell cell) { return cell > Cell::Cross; })) return false;
+    // set_rule() と同じく、盤面の長辺より長い並びは受け付けない
+    if (not board.grid_.isEmpty() and win_length > Max(width, height)) return false;
+    board.win_length_ = win_length;
+    board.move_count_ = move_count;
+    board.empty_count_ = board.grid_.count(Cell::None);
+    // 1手で置く記号はちょうど1つ
+    if (move_count != board.grid_.size_elements() - board.empty_count_) return false;
+    board.sync_bitboard_();
+    board.winner_ = none;
+    if (not board.grid_.isEmpty()) board.calc_result_();
+    // ハッシュは受け取った値を信用せず盤面から計算し直す
+    board.rehash_();
+    *this = std::move(board);
+    return true;
+  }
+  inline Array<Operation> Board::get_legal_operations(void) const {
+    Array<Operation> operations;
+    if (grid_.isEmpty() or is_finished()) return operations;
+    for (size_t h : step(grid_.height())) {
+      for (size_t w : step(grid_.width())) {
+        if (grid_[h][w] == Cell::None) operations.emplace_back(Point(w, h), turn_);
+      }
+    }
+    return operations;
+  }
+
+  inline void Board::calc_result_(void) {
+    // 盤面全体から勝敗を求め直す（スナップショットを読み込んだときだけ使う）
+    if (uses_bitboard_) {
+      winner_ = evaluate(circles_, crosses_, grid_.width());
+      return;
+    }
+    for (size_t h : step(grid_.height())) {
+      for (size_t w : step(grid_.width())) {
+        if (is_winning_move_(Point(w, h))) {
+          winner_ = grid_[h][w];
+          return;
+        }
+      }
+    }
+    if (empty_count_ == 0) winner_ = Cell::None;
+  }
+
   inline Point Game::get_cell_point_(const size_t y, const size_t x) const {
     return Point(x * cell_size_, y * cell_size_) + cell_offset_;
   }
@@ -70,137 +373,147 @@ namespace TicTacToe {
   inline Rect Game::get_cell_rect_(const size_t y, const size_t x) const {
     return Rect{get_cell_point_(y, x), cell_size_};
   }
-  inline void Game::operate_(const Operation& op) {
-    if (grid_.isEmpty() or is_finished_) return;
-    grid_[op.pos] = op.cell_type;
-    is_turn_ = (player_symbol_ != op.cell_type);
-    const bool is_finished_pre_ = is_finished_;
-    calc_result_();
-    if (winner_) {
-      is_finished_ = true;
-    }
-    // ゲームが終了状態に切り替わった瞬間を検知
-    if (is_finished_ and not is_finished_pre_) {
+  inline const Game::Assets& Game::get_assets_(void) const {
+    if (not assets_) {
+      assets_.reset(new Assets{
+        FontCache::shared().get(FontMethod::MSDF, detail_font_size, Typeface::Bold),
+        FontCache::shared().get(FontMethod::MSDF, symbol_font_size, Typeface::Bold),
+      });
+    }
+    return *assets_;
+  }
+  inline bool Game::is_turn_(void) const {
+    const Board& board = moves_.get_predicted();
+    return is_started_ and not board.is_finished() and (board.get_turn() == player_symbol_);
+  }
+  inline void Game::check_finished_(const bool was_finished) {
+    // 確定した盤面が終了状態に切り替わった瞬間を検知
+    if (moves_.get_confirmed().is_finished() and not was_finished) {
       // ホストだけがルームを閉じる
-      if (network_ and network_->isHost()) {
+      if (network_ and network_->is_host()) {
         network_->set_room_open(false);
         network_->set_room_visible(false);
       }
     }
   }
+  inline void Game::layout_(void) {
+    const Size grid_size = moves_.get_confirmed().get_grid().size();
+    if (grid_size.x == 0 or grid_size.y == 0) return;
+    // 盤面が画面に収まるようにセルを縮める
+    const size_t fit_width = Max(Scene::Width() - 2 * cell_offset_.x, 0) / grid_size.x;
+    const size_t fit_height = Max(Scene::Height() - 2 * cell_offset_.y, 0) / grid_size.y;
+    cell_size_ = Clamp<size_t>(Min(fit_width, fit_height), 1, max_cell_size);
+  }
   inline Optional<Operation> Game::get_operation_() const {
-    if (not (is_started_ and is_turn_ and not is_finished_)) return none;
-    for (size_t h : step(grid_.height())) {
-      for (size_t w : step(grid_.width())) {
-        if (get_cell_rect_(h, w).leftClicked() and grid_.at(h, w) == Cell::None) {
-          return Operation{ Point(w,h), player_symbol_ };
-        }
-      }
-    }
-    return none;
+    if (not is_turn_() or not MouseL.down()) return none;
+    // クリック位置から直接セルを求める（全セルの矩形を調べない）
+    const Point cursor = Cursor::Pos() - cell_offset_;
+    if (cursor.x < 0 or cursor.y < 0) return none;
+    const int32 cell_size = static_cast<int32>(cell_size_);
+    const Point pos{ cursor.x / cell_size, cursor.y / cell_size };
+    const Grid<Cell>& grid = moves_.get_predicted().get_grid();
+    if (not grid.inBounds(pos) or grid[pos] != Cell::None) return none;
+    return Operation{ pos, player_symbol_ };
   }
-  inline void Game::calc_result_(void) {
-    std::function<Optional<Cell>(std::function<Cell(size_t)>, size_t)> check_line
-      = [](std::function<Cell(size_t)> get_cell, size_t count) -> Optional<Cell> {
-      Cell first = get_cell(0);
-      if (first == Cell::None) return none;
-      for (size_t i = 1; i < count; i++) {
-        if (get_cell(i) != first) return none;
-      }
-      return first;
-      };
-    // 行チェック
-    for (size_t col : step(grid_.height())) {
-      Optional<Cell> result
-        = check_line([&](size_t i) { return grid_[col][i]; }, grid_.width());
-      if (result) {
-        winner_ = *result;
-        return;
-      }
-    }
-    // 列チェック
-    for (size_t row : step(grid_.width())) {
-      Optional<Cell> result
-        = check_line([&](size_t i) {return grid_[i][row]; }, grid_.height());
-      if (result) {
-        winner_ = *result;
-        return;
-      }
-    }
-    // 左上から右下
-    Optional<Cell> result1
-      = check_line([&](size_t i) { return grid_[i][i]; }, grid_.height());
-    if (result1) {
-      winner_ = *result1;
-      return;
-    }
-    // 右上から左下
-    Optional<Cell> result2
-      = check_line([&](size_t i) { return grid_[grid_.height() - 1 - i][i]; }, grid_.height());
-    if (result2) {
-      winner_ = *result2;
-      return;
-    }
-    // 引き分けチェック（None が残っていないか）
-    for (const Point& p : Step2D(Point{ 0,0 }, grid_.size(), Point{ 1,1 })) {
-      if (grid_[p] == Cell::None) return;
-    }
-    winner_ = Cell::None; // 引き分け
+  inline void Game::submit_(const Operation& op) {
+    if (not is_started_) return;
+    // 自分の操作はすぐ盤面に反映し、ホストの確定順で後から整合させる
+    const bool was_finished = moves_.get_confirmed().is_finished();
+    moves_.submit(op);
+    check_finished_(was_finished);
   }
-
   inline void Game::update() {
     if (Optional<Operation> op = get_operation_()) {
-      if (network_) {
-        network_->send_game_event(Operation::code, *op);
-      }
-      operate_(*op);
+      submit_(*op);
     }
   }
+  inline bool Game::play_random_move(void) {
+    if (not is_turn_()) return false;
+    const Array<Operation> operations = moves_.get_predicted().get_legal_operations();
+    if (operations.isEmpty()) return false;
+    submit_(operations.choice());
+    return true;
+  }
   inline void Game::on_game_start(const Array<LocalPlayer>& players, bool is_host) {
-    initialize(3, is_host ? Cell::Circle : Cell::Cross);
+    initialize(grid_size_, win_length_, is_host ? Cell::Circle : Cell::Cross);
+    // 開始時のホストが〇
+    player_ids_.clear();
+    for (const LocalPlayer& player : players) {
+      if (player.isHost) player_ids_.push_front(player.localID);
+      else player_ids_.push_back(player.localID);
+    }
+    moves_.set_authors(player_ids_);
     if (is_host and network_) network_->set_room_visible(false);
   }
+  inline void Game::on_host_changed(const bool is_host) {
+    if (not is_started_) return;
+    moves_.on_host_changed(is_host);
+    if (not is_host or not network_) return;
+    // ルームの管理を引き継ぐ（対戦中は再参加できるよう開けたまま隠す）
+    network_->set_room_visible(false);
+    network_->set_room_open(not moves_.get_confirmed().is_finished());
+  }
+  inline void Game::write_snapshot(Serializer<MemoryWriter>& writer) const {
+    writer(snapshot_version);
+    moves_.write(writer);
+    writer(player_ids_);
+  }
+  inline bool Game::read_snapshot(Deserializer<MemoryViewReader>& reader) {
+    uint16 version = 0;
+    reader(version);
+    if (version != snapshot_version or not moves_.read(reader)) return false;
+    reader(player_ids_);
+    moves_.set_authors(player_ids_);
+    const LocalPlayerID self_id = network_ ? network_->get_local_player_id() : -1;
+    if (player_ids_.size() >= 2 and player_ids_[0] == self_id) player_symbol_ = Cell::Circle;
+    else if (player_ids_.size() >= 2 and player_ids_[1] == self_id) player_symbol_ = Cell::Cross;
+    is_started_ = not moves_.get_confirmed().is_empty();
+    layout_();
+    return true;
+  }
   inline void Game::on_player_left(LocalPlayerID player_id) {
     // ゲームが既に終了しているなら、状態をリセットしない
-    if (is_finished_) return;
+    if (moves_.get_confirmed().is_finished()) return;
     reset();
   }
   inline void Game::on_leave_room() {
     reset();
   }
   inline void Game::on_event_received(const LocalPlayerID player_id, const uint8 event_code, Deserializer<MemoryViewReader>& reader) {
-    if (event_code == Operation::code) {
-      Operation op;
-      reader(op);
-      operate_(op);
-    }
+    if (not is_started_) return;
+    const bool was_finished = moves_.get_confirmed().is_finished();
+    if (moves_.on_event_received(player_id, event_code, reader)) check_finished_(was_finished);
   }
-  inline void Game::initialize(const size_t grid_size, Cell player_symbol) {
-    grid_.assign(grid_size, grid_size, Cell::None);
+  inline void Game::initialize(const Size& grid_size, const uint32 win_length, Cell player_symbol) {
+    Board board;
+    board.initialize(grid_size, win_length);
+    moves_.reset(board);
+    layout_();
     player_symbol_ = player_symbol;
     is_started_ = true;
-    is_turn_ = (player_symbol == Cell::Circle);
-    is_finished_ = false;
-    winner_ = none;
   }
   inline void Game::reset() {
-    grid_.clear();
+    moves_.reset(Board{});
     player_symbol_ = Cell::None;
+    player_ids_.clear();
     is_started_ = false;
-    is_turn_ = false;
-    is_finished_ = false;
-    winner_ = none;
   }
-  inline void Game::draw(void) const {
+  inline void Game::draw([[maybe_unused]] const double alpha) const {
     if (not is_started_) return;
-    for (size_t h = 0; h < grid_.height(); h++) {
-      for (size_t w = 0; w < grid_.width(); w++) {
+    const Assets& assets = get_assets_();
+    const Board& board = moves_.get_predicted();
+    const Grid<Cell>& grid = board.get_grid();
+    const Optional<Cell> winner = board.get_winner();
+    const bool is_turn = is_turn_();
+    const double frame_thickness = Clamp(cell_size_ / 20.0, 1.0, 5.0);
+    for (size_t h = 0; h < grid.height(); h++) {
+      for (size_t w = 0; w < grid.width(); w++) {
         // グリッドを描画
-        get_cell_rect_(h, w).draw(Palette::Black).drawFrame(5, Palette::White);
+        get_cell_rect_(h, w).draw(Palette::Black).drawFrame(frame_thickness, Palette::White);
         // セルの種類に応じた描画
-        Cell cell_type = grid_[h][w];
+        Cell cell_type = grid[h][w];
         if (cell_type != Cell::None) {
-          font_symbol_(cell_type == Cell::Circle ? U"O" : U"X").drawAt(
+          assets.font_symbol(cell_type == Cell::Circle ? U"O" : U"X").drawAt(
             cell_size_ * 0.8,
             get_cell_point_(h, w) + Point(cell_size_, cell_size_)/2
           );
@@ -208,29 +521,29 @@ namespace TicTacToe {
       }
     }
     Vec2 draw_text_center{ Vec2{ Scene::Center().x, Scene::Center().y * 1.5 } };
-    if (is_finished_) {
-      font_detail_(
-        winner_ == Cell::None
+    if (board.is_finished()) {
+      assets.font_detail(
+        winner == Cell::None
           ? U"Draw"
-          : winner_ == player_symbol_
+          : winner == player_symbol_
             ? U"You Win!"
             : U"You Lose"
       ).drawAt(
         128,
         draw_text_center,
-        winner_ == Cell::None
+        winner == Cell::None
           ? Palette::Black
-          : winner_ == player_symbol_
+          : winner == player_symbol_
             ? Palette::Red
             : Palette::Blue
       );
     } else {
-      font_detail_(
-        is_turn_ ? U"Your Turn!" : U"Not Your Turn"
+      assets.font_detail(
+        is_turn ? U"Your Turn!" : U"Not Your Turn"
       ).drawAt(
         128,
         draw_text_center,
-        is_turn_ ? Palette::Red : Palette::Blue
+        is_turn ? Palette::Red : Palette::Blue
       );
     }
   }
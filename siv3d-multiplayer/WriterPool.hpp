@@ -0,0 +1,40 @@
+﻿# pragma once
+# include <Siv3D.hpp>
+
+/// @brief 送信用の Serializer<MemoryWriter> を使い回すプール
+/// @remark 返却されたバッファは容量を残したまま中身だけ消すので、定常状態ではヒープ確保が起きない
+class WriterPool {
+public:
+  struct Stats {
+    size_t in_use = 0; // 貸し出し中の数
+    size_t high_water = 0; // 同時に貸し出した数の最大値
+    size_t created = 0; // 新しく作成した数（定常状態では増えない）
+    size_t pooled = 0; // 返却されてプールにある数
+    size_t largest_buffer = 0; // 返却されたバッファの最大サイズ（バイト）
+  };
+  /// @brief 空のバッファを借りる
+  Serializer<MemoryWriter> acquire(void) {
+    ++stats_.in_use;
+    stats_.high_water = Max(stats_.high_water, stats_.in_use);
+    if (free_.isEmpty()) {
+      ++stats_.created;
+      return Serializer<MemoryWriter>{};
+    }
+    Serializer<MemoryWriter> writer = std::move(free_.back());
+    free_.pop_back();
+    stats_.pooled = free_.size();
+    return writer;
+  }
+  /// @brief 使い終わったバッファを返す
+  void release(Serializer<MemoryWriter>&& writer) {
+    if (stats_.in_use > 0) --stats_.in_use;
+    stats_.largest_buffer = Max(stats_.largest_buffer, writer->getBlob().size());
+    writer->clear();
+    free_.push_back(std::move(writer));
+    stats_.pooled = free_.size();
+  }
+  const Stats& get_stats(void) const { return stats_; }
+private:
+  Array<Serializer<MemoryWriter>> free_;
+  Stats stats_;
+};
@@ -0,0 +1,21 @@
+﻿# pragma once
+# include <Siv3D.hpp>
+
+// 盤面の要素ごとの乱数キーを XOR で重ねる Zobrist ハッシュ（1手あたり O(1) で更新できる）
+namespace Zobrist {
+
+  /// @brief SplitMix64 の攪拌関数
+  inline constexpr uint64 mix(uint64 x) {
+    x += 0x9E3779B97F4A7C15ull;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+    return x ^ (x >> 31);
+  }
+
+  /// @brief 盤面の表 table の index 番目の要素が value であることを表すキー（全クライアントで同じ値になる）
+  /// @remark value が 0（空）のときは 0 を返すので、空の盤面のハッシュは 0 になる
+  inline constexpr uint64 key(const uint32 table, const size_t index, const uint32 value) {
+    if (value == 0) return 0;
+    return mix((uint64{ table } << 56) ^ (static_cast<uint64>(index) << 8) ^ value);
+  }
+}